@@ -0,0 +1,43 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Benchmark of the conversion on synthetic graphs.
+*	Deep chains of synthetic_model.hpp of growing sizes are converted by
+*	MxnetNodes2CaffeNet. The time per node should stay flat
+*	as the graph grows if all passes are linear.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "synthetic_model.hpp"
+
+int main(int nArgCnt, char *ppArgs[]) {
+	size_t nMaxNodes = nArgCnt > 1 ? std::atoi(ppArgs[1]) : 400000;
+	printf("%10s %10s %12s %12s\n", "nodes", "layers", "ms", "us/node");
+	for (size_t nNumNodes = nMaxNodes / 16; nNumNodes <= nMaxNodes;
+			nNumNodes *= 2) {
+		auto model = MakeDeepChain(nNumNodes / 9);
+		auto &nodes = model.nodes;
+		std::map<std::string, std::vector<std::string>> blobMapping;
+		BlobShapes blobShapes;
+		std::vector<NodeBlobs> nodeBlobs;
+		caffe::NetParameter net;
+		auto tBeg = std::chrono::steady_clock::now();
+		MxnetNodes2CaffeNet(nodes, {}, model.inputInfos, blobMapping,
+				blobShapes, nodeBlobs, net);
+		auto tEnd = std::chrono::steady_clock::now();
+		double dMs = std::chrono::duration<double, std::milli>(
+				tEnd - tBeg).count();
+		printf("%10zu %10d %12.1f %12.3f\n", nodes.size(), net.layer_size(),
+				dMs, dMs * 1000. / nodes.size());
+	}
+	return 0;
+}
@@ -0,0 +1,316 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Benchmark of the stages of a conversion on synthetic models.
+*	Workloads of deep chains, wide DenseNet concatenations, a 100k-node
+*	unrolled graph and params files from 100MB to 20GB are written to the
+*	work directory, then converted like mxnet2caffe does. The time, the
+*	throughput and the peak RSS of each stage are reported and written to
+*	a json file, to be compared between versions. The prototxt is also
+*	printed by TextFormat, as the reference of the time of the printer, and
+*	both outputs are checked to be identical.
+*	Params files are evicted from the page cache before loading, so reading
+*	them from the disk is measured by the caffemodel write, which reads the
+*	mapped parameters. Sizes over max_params_mb, or over half of the free
+*	space of the work directory, are skipped.
+*
+*	Usage: bench [work_dir] [result_json] [max_params_mb] [num_threads]
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "json_helper.hpp"
+#include "model_writer.hpp"
+#include "prototxt_printer.hpp"
+#include "resource_usage.hpp"
+#include "shape_inference.hpp"
+#include "synthetic_model.hpp"
+
+// Models with more parameters are written with external weights
+const size_t MAX_EMBEDDED_WEIGHTS = size_t(1536) << 20;
+
+struct StageResult {
+	std::string strName;
+	double dSeconds;
+	size_t nBytes;	// bytes read or written, 0 if not an I/O stage
+	size_t nPeakRss;
+};
+
+// Every layer of a dense block takes the concatenation of all outputs
+//	before it, so the concats have up to nNumLayers + 1 inputs
+SyntheticModel MakeDenseNet(size_t nNumBlocks, size_t nNumLayers,
+		size_t nGrowthRate) {
+	SyntheticModel workload;
+	workload.strName = "densenet_concat";
+	auto data = AddData(workload, {1, 3, 64, 64});
+	size_t nChannels = 2 * nGrowthRate;
+	auto stem = AddNode(workload, "Convolution", "stem", {data,
+			AddVariable(workload, "stem_weight", {nChannels, 3, 3, 3}, false)},
+			{{"kernel", "(3, 3)"}, {"pad", "(1, 1)"},
+			{"num_filter", std::to_string(nChannels)}, {"no_bias", "True"}});
+	std::vector<MxnetInput> features = {stem};
+	for (size_t b = 0; b < nNumBlocks; ++b) {
+		std::string strBlock = "block" + std::to_string(b);
+		for (size_t l = 0; l < nNumLayers; ++l) {
+			std::string strLayer = strBlock + "_layer" + std::to_string(l);
+			auto concat = features.size() == 1 ? features[0] : AddNode(
+					workload, "Concat", strLayer + "_concat", features,
+					{{"dim", "1"},
+					{"num_args", std::to_string(features.size())}});
+			features.push_back(AddBnReluConv(workload, concat,
+					nChannels + l * nGrowthRate, nGrowthRate, 3, strLayer));
+		}
+		nChannels += nNumLayers * nGrowthRate;
+		auto concat = AddNode(workload, "Concat", strBlock + "_concat",
+				features, {{"dim", "1"},
+				{"num_args", std::to_string(features.size())}});
+		if (b + 1 < nNumBlocks) {
+			auto trans = AddBnReluConv(workload, concat, nChannels,
+					nChannels / 2, 1, strBlock + "_trans");
+			nChannels /= 2;
+			features = {AddNode(workload, "Pooling", strBlock + "_pool",
+					{trans}, {{"pool_type", "avg"}, {"kernel", "(2, 2)"},
+					{"stride", "(2, 2)"}})};
+		}
+	}
+	return workload;
+}
+
+// A recurrent cell unrolled over steps, 3 nodes each, with the weights
+//	shared by all steps
+SyntheticModel MakeUnrolledGraph(size_t nNumSteps) {
+	SyntheticModel workload;
+	workload.strName = "unrolled_100k";
+	auto hidden = AddData(workload, {1, 64});
+	auto weight = AddVariable(workload, "cell_weight", {64, 64}, false);
+	auto bias = AddVariable(workload, "cell_bias", {64}, false);
+	for (size_t t = 0; t < nNumSteps; ++t) {
+		std::string strStep = "t" + std::to_string(t);
+		auto fc = AddNode(workload, "FullyConnected", strStep + "_fc",
+				{hidden, weight, bias}, {{"num_hidden", "64"}});
+		auto sum = AddNode(workload, "elemwise_add", strStep + "_sum",
+				{fc, hidden}, {});
+		hidden = AddNode(workload, "Activation", strStep + "_tanh", {sum},
+				{{"act_type", "tanh"}});
+	}
+	return workload;
+}
+
+// 8 square FullyConnected layers holding about nMegaBytes of weights
+SyntheticModel MakeLargeParams(size_t nMegaBytes) {
+	SyntheticModel workload;
+	workload.strName = "params_" + std::to_string(nMegaBytes) + "mb";
+	size_t nDim = (size_t)std::sqrt((double)(nMegaBytes << 20) / 8 /
+			sizeof(float));
+	auto prev = AddData(workload, {1, nDim});
+	for (size_t i = 0; i < 8; ++i) {
+		std::string strName = "fc" + std::to_string(i);
+		prev = AddNode(workload, "FullyConnected", strName, {prev,
+				AddVariable(workload, strName + "_weight", {nDim, nDim},
+				false), AddVariable(workload, strName + "_bias", {nDim},
+				false)}, {{"num_hidden", std::to_string(nDim)}});
+	}
+	return workload;
+}
+
+size_t FreeDiskBytes(const std::string &strDir) {
+	struct statvfs fsStat;
+	CHECK_EQ(statvfs(strDir.c_str(), &fsStat), 0) << strDir;
+	return (size_t)fsStat.f_bavail * fsStat.f_frsize;
+}
+
+// Flushes the file and drops it from the page cache, so it is read from
+//	the disk next time
+void EvictPageCache(const std::string &strFn) {
+	int fd = open(strFn.c_str(), O_RDONLY);
+	CHECK_GE(fd, 0) << strFn;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// Runs a stage returning the bytes it read or wrote
+StageResult MeasureStage(const std::string &strName,
+		const std::function<size_t()> &stage) {
+	ResetPeakRss();
+	auto tBeg = std::chrono::steady_clock::now();
+	size_t nBytes = stage();
+	auto tEnd = std::chrono::steady_clock::now();
+	return {strName, std::chrono::duration<double>(tEnd - tBeg).count(),
+			nBytes, PeakRssBytes()};
+}
+
+std::vector<StageResult> RunWorkload(const SyntheticModel &workload,
+		const std::string &strWorkDir, size_t nNumThreads) {
+	std::string strPrefix = strWorkDir + "/bench_" + workload.strName;
+	std::string strJsonFn = strPrefix + "-symbol.json";
+	std::string strParamsFn = strPrefix + "-0000.params";
+	std::string strProtoFn = strPrefix + ".prototxt";
+	std::string strTextFn = strPrefix + ".textformat.prototxt";
+	std::string strModelFn = strPrefix + ".caffemodel";
+	std::string strWeightsFn;
+	WriteMxnetSymbol(workload.nodes, strJsonFn);
+	WriteMxnetParams(workload.params, FillRandomParam, strParamsFn);
+	size_t nParamsBytes = FileBytes(strParamsFn);
+	if (nParamsBytes > MAX_EMBEDDED_WEIGHTS) {
+		strWeightsFn = strPrefix + ".weights";
+	}
+	EvictPageCache(strParamsFn);
+
+	std::vector<StageResult> stages;
+	std::pair<std::vector<MxnetNode>, std::vector<MxnetInput>> parsed;
+	stages.push_back(MeasureStage("json_parse", [&]() {
+			parsed = ParseMxnetJson(strJsonFn);
+			return FileBytes(strJsonFn);
+		}));
+	std::vector<MxnetParam> mxnetParams;
+	stages.push_back(MeasureStage("params_load", [&]() {
+			mxnetParams = LoadMxnetParam(strParamsFn);
+			return nParamsBytes;
+		}));
+	std::map<std::string, std::vector<std::string>> blobMapping;
+	BlobShapes blobShapes;
+	std::vector<NodeBlobs> nodeBlobs;
+	caffe::NetParameter net;
+	CaffeWeights weights;
+	stages.push_back(MeasureStage("convert", [&]() {
+			MxnetNodes2CaffeNet(parsed.first, {}, workload.inputInfos,
+					blobMapping, blobShapes, nodeBlobs, net);
+			weights = BindCaffeWeights(net, blobMapping, mxnetParams,
+					blobShapes);
+			return size_t(0);
+		}));
+	stages.push_back(MeasureStage("prototxt_write", [&]() {
+			std::ofstream protoFile(strProtoFn);
+			CHECK(protoFile.is_open()) << strProtoFn;
+			PrintNetPrototxt(net, protoFile);
+			protoFile.close();
+			return FileBytes(strProtoFn);
+		}));
+	// Reference of the printer, which must print the same bytes
+	stages.push_back(MeasureStage("textformat_write", [&]() {
+			std::ofstream textFile(strTextFn);
+			CHECK(textFile.is_open()) << strTextFn;
+			google::protobuf::io::OstreamOutputStream outStream(&textFile);
+			CHECK(google::protobuf::TextFormat::Print(net, &outStream));
+			return FileBytes(strTextFn);
+		}));
+	{
+		std::ostringstream printed;
+		PrintNetPrototxt(net, printed);
+		std::string strText;
+		CHECK(google::protobuf::TextFormat::PrintToString(net, &strText));
+		CHECK(printed.str() == strText) << "Prototxt of " << workload.strName
+				<< " differs from TextFormat::Print";
+	}
+	stages.push_back(MeasureStage("caffemodel_write", [&]() {
+			WriteCaffeModel(net, weights, strModelFn, strWeightsFn,
+					nNumThreads);
+			return FileBytes(strModelFn) + (strWeightsFn.empty() ? 0 :
+					FileBytes(strWeightsFn));
+		}));
+
+	for (auto &strFn : {strJsonFn, strParamsFn, strProtoFn, strTextFn,
+			strModelFn, strWeightsFn}) {
+		if (!strFn.empty()) {
+			std::remove(strFn.c_str());
+		}
+	}
+	return stages;
+}
+
+int main(int nArgCnt, char *ppArgs[]) {
+	std::string strWorkDir = nArgCnt > 1 ? ppArgs[1] : "/tmp";
+	std::string strResultFn = nArgCnt > 2 ? ppArgs[2] : "bench_result.json";
+	size_t nMaxParamsMb = nArgCnt > 3 ? std::atoll(ppArgs[3]) : 20480;
+	size_t nNumThreads = nArgCnt > 4 ? std::atoi(ppArgs[4]) : 0;
+
+	std::vector<std::function<SyntheticModel()>> makers = {
+			[]() { return MakeDeepChain(4096); },
+			[]() { return MakeDenseNet(4, 48, 12); },
+			[]() { return MakeUnrolledGraph(33333); }
+		};
+	Json jSkipped = Json::array();
+	for (size_t nMegaBytes : {100, 1024, 5120, 20480}) {
+		std::string strName = "params_" + std::to_string(nMegaBytes) + "mb";
+		// The params file and the caffemodel are on the disk together
+		size_t nNeeded = 2 * (nMegaBytes << 20) + (size_t(64) << 20);
+		if (nMegaBytes > nMaxParamsMb) {
+			jSkipped.push_back({{"workload", strName},
+					{"reason", "over max_params_mb"}});
+		} else if (nNeeded > FreeDiskBytes(strWorkDir)) {
+			jSkipped.push_back({{"workload", strName},
+					{"reason", "not enough free disk space"}});
+		} else {
+			makers.push_back([=]() { return MakeLargeParams(nMegaBytes); });
+		}
+	}
+
+	bool bStagePeak = ResetPeakRss();
+	Json jWorkloads = Json::array();
+	printf("%-18s %-17s %10s %10s %12s %12s\n", "workload", "stage", "seconds",
+			"MB/s", "knodes/s", "peak RSS MB");
+	for (auto &maker : makers) {
+		SyntheticModel workload = maker();
+		size_t nParamsBytes = 0;
+		for (auto &param : workload.params) {
+			nParamsBytes += ShapeCount(param.shape) * sizeof(float);
+		}
+		auto stages = RunWorkload(workload, strWorkDir, nNumThreads);
+		Json jStages = Json::object();
+		for (auto &stage : stages) {
+			double dMbPerSec = stage.nBytes / 1048576. / stage.dSeconds;
+			double dNodesPerSec = workload.nodes.size() / stage.dSeconds;
+			printf("%-18s %-17s %10.3f %10.1f %12.1f %12.1f\n",
+					workload.strName.c_str(), stage.strName.c_str(),
+					stage.dSeconds, dMbPerSec, dNodesPerSec / 1000.,
+					stage.nPeakRss / 1048576.);
+			Json jStage = {{"seconds", stage.dSeconds},
+					{"nodes_per_second", dNodesPerSec},
+					{"peak_rss_bytes", stage.nPeakRss}};
+			if (stage.nBytes > 0) {
+				jStage["bytes"] = stage.nBytes;
+				jStage["mb_per_second"] = dMbPerSec;
+			}
+			jStages[stage.strName] = std::move(jStage);
+		}
+		jWorkloads.push_back({{"name", workload.strName},
+				{"nodes", workload.nodes.size()},
+				{"params_bytes", nParamsBytes},
+				{"stages", std::move(jStages)}});
+		// Freed memory of a workload is not counted in the next one
+		malloc_trim(0);
+	}
+	for (auto &jSkip : jSkipped) {
+		printf("%-18s skipped, %s\n", jSkip["workload"].get<std::string>(
+				).c_str(), jSkip["reason"].get<std::string>().c_str());
+	}
+
+	Json jResult = {{"num_threads", nNumThreads},
+			{"peak_rss_per_stage", bStagePeak},
+			{"workloads", std::move(jWorkloads)},
+			{"skipped", std::move(jSkipped)}};
+	std::ofstream resultFile(strResultFn);
+	CHECK(resultFile.is_open()) << strResultFn;
+	resultFile << jResult.dump(1) << std::endl;
+	return 0;
+}
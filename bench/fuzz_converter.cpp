@@ -0,0 +1,640 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Fuzzing of the conversion by random graphs.
+*	Random but valid MxNet graphs of the supported ops are generated with
+*	their parameters, written as symbol json and params files, and read back
+*	by the parser. Each one is converted, its caffemodel written, and the
+*	converted net verified layer by layer against the reference executor.
+*	The caffemodel is also written with external weights, which must load
+*	in caffe to the same blobs as the embedded ones.
+*	Each graph is checked by a forked worker, so that a graph refused by the
+*	converter is reported as failed instead of ending the run. Files of
+*	failed graphs are kept for reproduction, the time of conversion is
+*	reported by the size of graphs.
+*
+*	Usage: fuzz_converter [num_graphs] [max_nodes] [seed] [work_dir]
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "external_weights.hpp"
+#include "model_writer.hpp"
+#include "prototxt_printer.hpp"
+#include "shape_inference.hpp"
+#include "synthetic_model.hpp"
+#include "verification.hpp"
+#include "worker_pool.hpp"
+
+const double FUZZ_TOLERANCE = 1e-3;
+
+struct FuzzGraph {
+	SyntheticModel model;
+	std::vector<std::vector<float>> paramData; // of model.params
+};
+
+// An output of a node available as an input of new nodes
+struct FuzzTensor {
+	MxnetInput output;
+	Shape shape;
+};
+
+// Parameters of a convolution, to be tied by later ones
+struct FuzzConv {
+	size_t nChannels;
+	size_t nKernel;
+	size_t nNumGroup;
+	size_t nNumFilter;
+	bool bNoBias;
+	std::vector<MxnetInput> params;
+};
+
+class GraphGenerator {
+public:
+	explicit GraphGenerator(unsigned nSeed) : m_rng(nSeed) {}
+
+	FuzzGraph Generate(size_t nNumOps);
+
+private:
+	size_t RandInt(size_t nMin, size_t nMax) {
+		return std::uniform_int_distribution<size_t>(nMin, nMax)(m_rng);
+	}
+	bool RandBool() {
+		return RandInt(0, 1) == 1;
+	}
+	float RandFloat(float fMin, float fMax) {
+		return std::uniform_real_distribution<float>(fMin, fMax)(m_rng);
+	}
+	std::string Str(size_t n) {
+		return std::to_string(n);
+	}
+	std::string Pair(size_t n) {
+		return "(" + Str(n) + ", " + Str(n) + ")";
+	}
+	std::string Bool(bool b) {
+		return b ? "True" : "False";
+	}
+
+	// Recent tensors are preferred, older ones make long skips
+	const FuzzTensor &PickTensor() {
+		size_t nBack = std::geometric_distribution<size_t>(0.4)(m_rng);
+		return m_tensors[m_tensors.size() - 1 - std::min(nBack,
+				m_tensors.size() - 1)];
+	}
+	std::vector<const FuzzTensor*> FindSameShape(const Shape &shape) {
+		std::vector<const FuzzTensor*> found;
+		for (auto &tensor : m_tensors) {
+			if (tensor.shape == shape) {
+				found.push_back(&tensor);
+			}
+		}
+		return found;
+	}
+	MxnetInput AddVariable(const std::string &strName, const Shape &shape,
+			float fMin, float fMax, bool bAux);
+	MxnetInput AddNode(const std::string &strOp,
+			const std::vector<MxnetInput> &inputs,
+			const std::vector<StringPair> &attrs,
+			const std::string &strName = std::string());
+	void Publish(const MxnetInput &output, const Shape &shape) {
+		m_tensors.push_back({output, shape});
+	}
+
+	void AddConvolution(const FuzzTensor &x);
+	void AddBatchNorm(const FuzzTensor &x);
+	void AddActivation(const FuzzTensor &x);
+	void AddPooling(const FuzzTensor &x);
+	void AddElemwise(const FuzzTensor &x);
+	void AddConcat(const FuzzTensor &x);
+	void AddSlice(const FuzzTensor &x);
+	void AddBroadcast(const FuzzTensor &x);
+	void AddUnary(const FuzzTensor &x);
+	void AddHead(const FuzzTensor &x);
+
+	std::mt19937 m_rng;
+	FuzzGraph m_graph;
+	std::vector<FuzzTensor> m_tensors;
+	std::vector<FuzzConv> m_convs;
+};
+
+MxnetInput GraphGenerator::AddVariable(const std::string &strName,
+		const Shape &shape, float fMin, float fMax, bool bAux) {
+	m_graph.paramData.emplace_back(ShapeCount(shape));
+	for (auto &fVal : m_graph.paramData.back()) {
+		fVal = RandFloat(fMin, fMax);
+	}
+	return ::AddVariable(m_graph.model, strName, shape, bAux);
+}
+
+MxnetInput GraphGenerator::AddNode(const std::string &strOp,
+		const std::vector<MxnetInput> &inputs,
+		const std::vector<StringPair> &attrs, const std::string &strName) {
+	return ::AddNode(m_graph.model, strOp, strName.empty() ? strOp +
+			Str(m_graph.model.nodes.size()) : strName, inputs, attrs);
+}
+
+// Parameters of an earlier convolution over as many channels are tied
+//	sometimes, caffe shares them by ParamSpec names
+void GraphGenerator::AddConvolution(const FuzzTensor &x) {
+	size_t nChannels = x.shape[1];
+	const FuzzConv *pTied = nullptr;
+	for (auto &conv : m_convs) {
+		if (conv.nChannels == nChannels && RandInt(0, 2) == 0) {
+			pTied = &conv;
+			break;
+		}
+	}
+	FuzzConv conv = {nChannels, RandBool() ? 1U : 3U, 1, RandInt(1, 16),
+			RandBool(), {}};
+	if (pTied != nullptr) {
+		conv = *pTied;
+	} else if (nChannels > 1 && RandInt(0, 3) == 0) {
+		conv.nNumGroup = nChannels; // depthwise
+		conv.nNumFilter = nChannels * RandInt(1, 2);
+	}
+	size_t nKernel = conv.nKernel;
+	size_t nDilate = (nKernel > 1 && RandInt(0, 3) == 0) ? 2 : 1;
+	size_t nExtent = nDilate * (nKernel - 1) + 1;
+	size_t nPad = RandInt(0, nExtent / 2);
+	size_t nMinSize = std::min(x.shape[2], x.shape[3]) + 2 * nPad;
+	if (nMinSize < nExtent) {
+		return;
+	}
+	size_t nStride = (nMinSize >= nExtent + 2 && RandBool()) ? 2 : 1;
+	if (pTied == nullptr) {
+		std::string strName = "Convolution" + Str(
+				m_graph.model.nodes.size());
+		float fRange = 1.f / std::sqrt((float)(nChannels / conv.nNumGroup *
+				nKernel * nKernel));
+		conv.params.push_back(AddVariable(strName + "_weight",
+				{conv.nNumFilter, nChannels / conv.nNumGroup, nKernel,
+				nKernel}, -fRange, fRange, false));
+		if (!conv.bNoBias) {
+			conv.params.push_back(AddVariable(strName + "_bias",
+					{conv.nNumFilter}, -.5f, .5f, false));
+		}
+		m_convs.push_back(conv);
+	}
+	std::vector<MxnetInput> inputs = {x.output};
+	inputs.insert(inputs.end(), conv.params.begin(), conv.params.end());
+	std::vector<StringPair> attrs = {{"kernel", Pair(nKernel)},
+			{"num_filter", Str(conv.nNumFilter)}, {"stride", Pair(nStride)},
+			{"pad", Pair(nPad)}, {"no_bias", Bool(conv.bNoBias)}};
+	if (nDilate > 1) {
+		attrs.emplace_back("dilate", Pair(nDilate));
+	}
+	if (conv.nNumGroup > 1) {
+		attrs.emplace_back("num_group", Str(conv.nNumGroup));
+	}
+	auto output = AddNode("Convolution", inputs, attrs);
+	Shape shape = {x.shape[0], conv.nNumFilter,
+			(x.shape[2] + 2 * nPad - nExtent) / nStride + 1,
+			(x.shape[3] + 2 * nPad - nExtent) / nStride + 1};
+	Publish(output, shape);
+}
+
+void GraphGenerator::AddBatchNorm(const FuzzTensor &x) {
+	size_t nChannels = x.shape[1];
+	std::string strName = "BatchNorm" + Str(m_graph.model.nodes.size());
+	std::vector<MxnetInput> inputs = {x.output,
+			AddVariable(strName + "_gamma", {nChannels}, .5f, 1.5f, false),
+			AddVariable(strName + "_beta", {nChannels}, -.5f, .5f, false),
+			AddVariable(strName + "_moving_mean", {nChannels}, -.5f, .5f,
+					true),
+			AddVariable(strName + "_moving_var", {nChannels}, .5f, 2.f, true)};
+	// Defaults of eps and fix_gamma differ from caffe, they are left out
+	//	sometimes to check the converter applies the defaults of MxNet
+	std::vector<StringPair> attrs = {{"use_global_stats", Bool(RandBool())}};
+	if (RandBool()) {
+		attrs.emplace_back("eps", RandBool() ? "0.001" : "2e-05");
+	}
+	if (RandBool()) {
+		attrs.emplace_back("fix_gamma", Bool(RandBool()));
+	}
+	auto output = AddNode("BatchNorm", inputs, attrs);
+	Publish(output, x.shape);
+}
+
+void GraphGenerator::AddActivation(const FuzzTensor &x) {
+	static const char *actTypes[] = {"relu", "sigmoid", "tanh"};
+	switch (RandInt(0, 4)) {
+	case 0:
+		Publish(AddNode("LeakyReLU", {x.output}, {{"act_type", "leaky"},
+				{"slope", "0.1"}}), x.shape);
+		break;
+	case 1:
+		Publish(AddNode("LeakyReLU", {x.output}, {{"act_type", "elu"},
+				{"slope", "0.5"}}), x.shape);
+		break;
+	case 2: {
+		std::string strName = "LeakyReLU" + Str(m_graph.model.nodes.size());
+		auto gamma = AddVariable(strName + "_gamma", {x.shape[1]}, 0.f, .5f,
+				false);
+		Publish(AddNode("LeakyReLU", {x.output, gamma},
+				{{"act_type", "prelu"}}), x.shape);
+		break;
+	}
+	default:
+		Publish(AddNode("Activation", {x.output},
+				{{"act_type", actTypes[RandInt(0, 2)]}}), x.shape);
+	}
+}
+
+// Both conventions of MxNet and strided windows over the padding, those
+//	rounded otherwise than by caffe are to be refused by the converter
+void GraphGenerator::AddPooling(const FuzzTensor &x) {
+	std::string strType = RandBool() ? "max" : "avg";
+	if (RandInt(0, 3) == 0) {
+		Publish(AddNode("Pooling", {x.output}, {{"pool_type", strType},
+				{"kernel", "(1, 1)"}, {"global_pool", "True"}}),
+				{x.shape[0], x.shape[1], 1, 1});
+		return;
+	}
+	size_t nKernel = RandInt(2, 3);
+	size_t nMinSize = std::min(x.shape[2], x.shape[3]);
+	if (nMinSize < nKernel) {
+		return;
+	}
+	size_t nStride = RandInt(1, 2);
+	size_t nPad = RandInt(0, nKernel - 1);
+	bool bFull = RandBool();
+	auto OutSize = [&](size_t nIn) {
+			return (nIn + 2 * nPad - nKernel + (bFull ? nStride - 1 : 0)) /
+					nStride + 1;
+		};
+	Publish(AddNode("Pooling", {x.output}, {{"pool_type", strType},
+			{"kernel", Pair(nKernel)}, {"stride", Pair(nStride)},
+			{"pad", Pair(nPad)},
+			{"pooling_convention", bFull ? "full" : "valid"}}),
+			{x.shape[0], x.shape[1], OutSize(x.shape[2]),
+			OutSize(x.shape[3])});
+}
+
+void GraphGenerator::AddElemwise(const FuzzTensor &x) {
+	auto candidates = FindSameShape(x.shape);
+	std::vector<MxnetInput> inputs = {x.output};
+	size_t nNumInputs = RandInt(0, 2) == 0 ? RandInt(3, 4) : 2;
+	for (size_t i = 1; i < nNumInputs; ++i) {
+		inputs.push_back(candidates[RandInt(0, candidates.size() - 1)]->output);
+	}
+	if (nNumInputs > 2) {
+		Publish(AddNode(RandBool() ? "add_n" : "ElementWiseSum", inputs,
+				{{"num_args", Str(nNumInputs)}}), x.shape);
+		return;
+	}
+	static const char *binaryOps[] = {"elemwise_add", "_Plus", "elemwise_sub",
+			"_Minus", "elemwise_mul"};
+	Publish(AddNode(binaryOps[RandInt(0, 4)], inputs, {}), x.shape);
+}
+
+void GraphGenerator::AddConcat(const FuzzTensor &x) {
+	std::vector<MxnetInput> inputs = {x.output};
+	Shape shape = x.shape;
+	for (auto &tensor : m_tensors) {
+		if (inputs.size() < 4 && &tensor != &x && tensor.shape[0] ==
+				x.shape[0] && tensor.shape[2] == x.shape[2] &&
+				tensor.shape[3] == x.shape[3] && shape[1] +
+				tensor.shape[1] <= 32 && RandBool()) {
+			inputs.push_back(tensor.output);
+			shape[1] += tensor.shape[1];
+		}
+	}
+	if (inputs.size() < 2) {
+		return;
+	}
+	Publish(AddNode(RandBool() ? "Concat" : "concat", inputs, {{"dim", "1"},
+			{"num_args", Str(inputs.size())}}), shape);
+}
+
+void GraphGenerator::AddSlice(const FuzzTensor &x) {
+	size_t nNumOutputs = (x.shape[1] % 3 == 0) ? 3 :
+			((x.shape[1] % 2 == 0) ? 2 : 1);
+	if (nNumOutputs == 1) {
+		return;
+	}
+	auto output = AddNode("SliceChannel", {x.output}, {{"axis", "1"},
+			{"num_outputs", Str(nNumOutputs)}});
+	Shape shape = x.shape;
+	shape[1] /= nNumOutputs;
+	for (size_t j = 0; j < nNumOutputs; ++j) {
+		Publish(MxnetInput(output.first, j), shape);
+	}
+}
+
+// Channel attention: the globally pooled tensor is broadcasted back
+void GraphGenerator::AddBroadcast(const FuzzTensor &x) {
+	auto pooled = AddNode("Pooling", {x.output}, {{"pool_type", "avg"},
+			{"kernel", "(1, 1)"}, {"global_pool", "True"}});
+	auto gate = AddNode("Activation", {pooled}, {{"act_type", "sigmoid"}});
+	static const char *broadcastOps[] = {"broadcast_mul", "broadcast_add",
+			"broadcast_sub"};
+	Publish(AddNode(broadcastOps[RandInt(0, 2)], {x.output, gate}, {}),
+			x.shape);
+}
+
+void GraphGenerator::AddUnary(const FuzzTensor &x) {
+	switch (RandInt(0, 2)) {
+	case 0:
+		Publish(AddNode("abs", {x.output}, {}), x.shape);
+		break;
+	case 1:
+		Publish(AddNode("_mul_scalar", {x.output}, {{"scalar", "0.5"}}),
+				x.shape);
+		break;
+	default:
+		Publish(AddNode("Dropout", {x.output}, {{"p", "0.5"}}), x.shape);
+	}
+}
+
+// Flattened FullyConnected, optionally with a softmax over classes
+void GraphGenerator::AddHead(const FuzzTensor &x) {
+	MxnetInput input = x.output;
+	size_t nNumInput = ShapeCount(x.shape) / x.shape[0];
+	switch (RandInt(0, 2)) {
+	case 0:
+		input = AddNode("Flatten", {input}, {});
+		break;
+	case 1:
+		input = AddNode("reshape", {input}, {{"shape", "(0, -1)"}});
+		break;
+	}
+	size_t nNumHidden = RandInt(1, 10);
+	bool bNoBias = RandBool();
+	std::string strName = "FullyConnected" + Str(
+			m_graph.model.nodes.size());
+	float fRange = 1.f / std::sqrt((float)nNumInput);
+	std::vector<MxnetInput> inputs = {input, AddVariable(strName + "_weight",
+			{nNumHidden, nNumInput}, -fRange, fRange, false)};
+	if (!bNoBias) {
+		inputs.push_back(AddVariable(strName + "_bias", {nNumHidden},
+				-.5f, .5f, false));
+	}
+	auto output = AddNode("FullyConnected", inputs, {
+			{"num_hidden", Str(nNumHidden)}, {"no_bias", Bool(bNoBias)}});
+	Shape shape = {x.shape[0], nNumHidden};
+	switch (RandInt(0, 2)) {
+	case 0:
+		output = AddNode("softmax", {output}, {{"axis", "-1"}});
+		break;
+	case 1:
+		output = AddNode("SoftmaxActivation", {output}, {{"mode", "instance"}});
+		break;
+	}
+	Publish(output, shape);
+}
+
+FuzzGraph GraphGenerator::Generate(size_t nNumOps) {
+	m_graph = FuzzGraph();
+	m_tensors.clear();
+	m_convs.clear();
+	Shape inputShape = {RandInt(1, 2), RandInt(1, 8), RandInt(4, 12),
+			RandInt(4, 12)};
+	Publish(AddData(m_graph.model, inputShape), inputShape);
+	while (m_graph.model.nodes.size() < nNumOps * 3) {
+		const FuzzTensor x = PickTensor();
+		switch (RandInt(0, 9)) {
+		case 0: case 1: AddConvolution(x); break;
+		case 2: AddBatchNorm(x); break;
+		case 3: AddActivation(x); break;
+		case 4: AddPooling(x); break;
+		case 5: AddElemwise(x); break;
+		case 6: AddConcat(x); break;
+		case 7: AddSlice(x); break;
+		case 8: AddBroadcast(x); break;
+		default: AddUnary(x);
+		}
+	}
+	if (RandBool()) {
+		AddHead(m_tensors.back());
+	}
+	return std::move(m_graph);
+}
+
+std::string ReadFile(const std::string &strFn) {
+	std::ifstream inFile(strFn, std::ios::binary);
+	CHECK(inFile.is_open()) << strFn;
+	return std::string(std::istreambuf_iterator<char>(inFile),
+			std::istreambuf_iterator<char>());
+}
+
+struct SizeStat {
+	size_t nNumGraphs;
+	size_t nNumNodes;
+	double dConvertMs;
+	double dWriteMs;
+};
+
+// The caffemodel written with external weights is loaded by caffe as the one
+//	with embedded weights, layers sharing their blobs by ParamSpec names
+//	included
+std::string CheckExternalWeights(const caffe::NetParameter &net,
+		const CaffeWeights &weights, const std::vector<std::string> &files) {
+	WriteCaffeModel(net, weights, files[4], files[5], 1);
+	auto inferenceNet = InferenceNet(net);
+	caffe::Net<float> embeddedNet(inferenceNet);
+	embeddedNet.CopyTrainedLayersFrom(files[3]);
+	caffe::Net<float> externalNet(inferenceNet);
+	auto pWeightsFile = LoadExternalWeights(externalNet, files[4], files[5]);
+	for (size_t i = 0; i < embeddedNet.layers().size(); ++i) {
+		auto &embeddedBlobs = embeddedNet.layers()[i]->blobs();
+		auto &externalBlobs = externalNet.layers()[i]->blobs();
+		CHECK_EQ(embeddedBlobs.size(), externalBlobs.size());
+		for (size_t j = 0; j < embeddedBlobs.size(); ++j) {
+			auto &pEmbedded = embeddedBlobs[j];
+			auto &pExternal = externalBlobs[j];
+			if (pEmbedded->count() != pExternal->count() || !std::equal(
+					pEmbedded->cpu_data(), pEmbedded->cpu_data() +
+					pEmbedded->count(), pExternal->cpu_data())) {
+				return "blob " + std::to_string(j) + " of layer " +
+						embeddedNet.layer_names()[i] + " differs with " +
+						"external weights";
+			}
+		}
+	}
+	return std::string();
+}
+
+// Converts, writes and verifies the graph, the failure is returned
+std::string CheckGraph(const FuzzGraph &graph, unsigned nGraphSeed,
+		const std::vector<std::string> &files, double &dConvertMs,
+		double &dWriteMs) {
+	WriteMxnetSymbol(graph.model.nodes, files[0]);
+	WriteMxnetParams(graph.model.params, [&](size_t iParam, size_t nOffset,
+			float *pData, size_t nCount) {
+				std::copy_n(graph.paramData[iParam].data() + nOffset,
+						nCount, pData);
+			}, files[1]);
+
+	auto parsed = ParseMxnetJson(files[0]);
+	auto &mxnetNodes = parsed.first;
+	auto mxnetParams = LoadMxnetParam(files[1]);
+	auto &inputInfos = graph.model.inputInfos;
+	std::map<std::string, std::vector<std::string>> blobMapping;
+	BlobShapes blobShapes;
+	std::vector<NodeBlobs> nodeBlobs;
+	caffe::NetParameter net;
+	auto tBeg = std::chrono::steady_clock::now();
+	MxnetNodes2CaffeNet(mxnetNodes, {}, inputInfos, blobMapping,
+			blobShapes, nodeBlobs, net);
+	auto tConverted = std::chrono::steady_clock::now();
+	auto weights = BindCaffeWeights(net, blobMapping, mxnetParams,
+			blobShapes);
+	WriteCaffeModel(net, weights, files[3], "", 1);
+	auto tEnd = std::chrono::steady_clock::now();
+	dConvertMs = std::chrono::duration<double, std::milli>(
+			tConverted - tBeg).count();
+	dWriteMs = std::chrono::duration<double, std::milli>(
+			tEnd - tConverted).count();
+
+	std::ofstream protoFile(files[2]);
+	PrintNetPrototxt(net, protoFile);
+	protoFile.close();
+
+	std::string strModel;
+	BuildCaffeModel(net, weights).SerializeToString(&strModel);
+	if (ReadFile(files[3]) != strModel) {
+		return "caffemodel differs from BuildCaffeModel";
+	}
+	std::string strFailure = CheckExternalWeights(net, weights, files);
+	if (!strFailure.empty()) {
+		return strFailure;
+	}
+	auto result = VerifyConversion(mxnetNodes, parsed.second, mxnetParams,
+			nodeBlobs, net, weights, RandomInputs(mxnetNodes, inputInfos,
+			nGraphSeed), 1);
+	size_t nFirst = FirstExceeding(result.layers, FUZZ_TOLERANCE);
+	if (nFirst < result.layers.size()) {
+		return "layer " + result.layers[nFirst].strLayer +
+				" exceeds the tolerance\n" + FormatErrorTable(
+				result.layers, FUZZ_TOLERANCE);
+	} else if (FirstExceeding(result.outputs, FUZZ_TOLERANCE) <
+			result.outputs.size()) {
+		return "outputs exceed the tolerance\n" +
+				FormatErrorTable(result.outputs, FUZZ_TOLERANCE);
+	}
+	return std::string();
+}
+
+int main(int nArgCnt, char *ppArgs[]) {
+	size_t nNumGraphs = nArgCnt > 1 ? std::atoi(ppArgs[1]) : 200;
+	size_t nMaxNodes = nArgCnt > 2 ? std::atoi(ppArgs[2]) : 64;
+	unsigned nSeed = nArgCnt > 3 ? std::atoi(ppArgs[3]) : 1;
+	std::string strWorkDir = nArgCnt > 4 ? ppArgs[4] : "/tmp";
+	CHECK_GE(nMaxNodes, 1U);
+
+	// A graph refused by a CHECK of the converter is a failure as well, each
+	//	one is checked by a worker reporting the times and the failure
+	WorkerPool pool(1, 0);
+	size_t nNumFailed = 0;
+	std::map<size_t, SizeStat> sizeStats; // by the power of 2 of nodes
+	for (size_t g = 0; g < nNumGraphs; ++g) {
+		unsigned nGraphSeed = nSeed + (unsigned)g;
+		GraphGenerator generator(nGraphSeed);
+		std::mt19937 sizeRng(nGraphSeed);
+		auto graph = generator.Generate(std::uniform_int_distribution<size_t>(
+				1, nMaxNodes)(sizeRng));
+		std::string strPrefix = strWorkDir + "/fuzz" + std::to_string(
+				nGraphSeed);
+		std::vector<std::string> files = {strPrefix + "-symbol.json",
+				strPrefix + "-0000.params", strPrefix + ".prototxt",
+				strPrefix + ".caffemodel", strPrefix + ".external.caffemodel",
+				strPrefix + ".weights"};
+
+		int pipeFds[2];
+		CHECK_EQ(pipe(pipeFds), 0) << std::strerror(errno);
+		pid_t nPid = pool.Start(0, [&]() {
+				close(pipeFds[0]);
+				double times[2] = {0., 0.};
+				std::string strFailure = CheckGraph(graph, nGraphSeed, files,
+						times[0], times[1]);
+				std::string strReport((const char*)times, sizeof(times));
+				strReport += strFailure;
+				for (size_t nWritten = 0; nWritten < strReport.size(); ) {
+					ssize_t nRet = write(pipeFds[1], strReport.data() +
+							nWritten, strReport.size() - nWritten);
+					CHECK(nRet >= 0 || errno == EINTR) << std::strerror(errno);
+					nWritten += std::max(nRet, ssize_t(0));
+				}
+			});
+		close(pipeFds[1]);
+		std::string strReport;
+		char buf[65536];
+		for (;;) {
+			ssize_t nRead = read(pipeFds[0], buf, sizeof(buf));
+			if (nRead < 0 && errno == EINTR) {
+				continue;
+			}
+			CHECK_GE(nRead, 0) << std::strerror(errno);
+			if (nRead == 0) {
+				break;
+			}
+			strReport.append(buf, nRead);
+		}
+		close(pipeFds[0]);
+		pid_t nExitedPid;
+		WorkerExit exit;
+		while (!pool.Wait(nPid, nExitedPid, exit)) {
+			// interrupted by a signal
+		}
+
+		double times[2] = {0., 0.};
+		std::string strFailure;
+		if (!exit.bSucceeded || strReport.size() < sizeof(times)) {
+			strFailure = "the conversion is aborted, see the log above";
+		} else {
+			std::copy_n(strReport.data(), sizeof(times), (char*)times);
+			strFailure = strReport.substr(sizeof(times));
+		}
+		if (!strFailure.empty()) {
+			++nNumFailed;
+			printf("FAILED seed %u, %zu nodes, files %s*: %s\n", nGraphSeed,
+					graph.model.nodes.size(), strPrefix.c_str(),
+					strFailure.c_str());
+			fflush(stdout);
+		} else {
+			for (auto &strFn : files) {
+				std::remove(strFn.c_str());
+			}
+		}
+
+		size_t nBucket = 1;
+		while (nBucket * 2 <= graph.model.nodes.size()) {
+			nBucket *= 2;
+		}
+		auto &stat = sizeStats[nBucket];
+		++stat.nNumGraphs;
+		stat.nNumNodes += graph.model.nodes.size();
+		stat.dConvertMs += times[0];
+		stat.dWriteMs += times[1];
+	}
+
+	printf("%10s %8s %12s %14s %14s\n", "nodes>=", "graphs", "avg nodes",
+			"convert us/n", "write us/n");
+	for (auto &stat : sizeStats) {
+		auto &s = stat.second;
+		printf("%10zu %8zu %12.1f %14.3f %14.3f\n", stat.first, s.nNumGraphs,
+				(double)s.nNumNodes / s.nNumGraphs,
+				s.dConvertMs * 1000. / s.nNumNodes,
+				s.dWriteMs * 1000. / s.nNumNodes);
+	}
+	printf("%zu of %zu graphs failed\n", nNumFailed, nNumGraphs);
+	return nNumFailed > 0 ? 1 : 0;
+}
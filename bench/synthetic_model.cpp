@@ -0,0 +1,159 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Building and writing synthetic MxNet models
+*/
+
+#include "synthetic_model.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <glog/logging.h>
+
+#include "json_helper.hpp"
+#include "mxnet_executor.hpp"
+#include "shape_inference.hpp"
+
+MxnetInput AddNode(SyntheticModel &model, const std::string &strOp,
+		const std::string &strName, const std::vector<MxnetInput> &inputs,
+		const std::vector<StringPair> &attrs) {
+	MxnetNode node;
+	node.strOp = strOp;
+	node.strName = strName;
+	node.inputs = inputs;
+	node.attrs = attrs;
+	model.nodes.emplace_back(std::move(node));
+	return MxnetInput(model.nodes.size() - 1, 0);
+}
+
+MxnetInput AddVariable(SyntheticModel &model, const std::string &strName,
+		const Shape &shape, bool bAux) {
+	model.params.push_back({strName, shape, bAux});
+	return AddNode(model, "null", strName, {}, {});
+}
+
+MxnetInput AddData(SyntheticModel &model, const Shape &shape) {
+	model.inputInfos.emplace_back("data", shape);
+	return AddNode(model, "null", "data", {}, {});
+}
+
+MxnetInput AddBnReluConv(SyntheticModel &model, const MxnetInput &input,
+		size_t nChannels, size_t nNumFilter, size_t nKernel,
+		const std::string &strName) {
+	std::vector<MxnetInput> bnInputs = {input};
+	for (auto strParam : {"_gamma", "_beta", "_moving_mean", "_moving_var"}) {
+		bnInputs.push_back(AddVariable(model, strName + "_bn" + strParam,
+				{nChannels}, std::string(strParam).find("moving") == 1));
+	}
+	auto bn = AddNode(model, "BatchNorm", strName + "_bn", bnInputs,
+			{{"eps", "2e-05"}, {"fix_gamma", "False"}});
+	auto relu = AddNode(model, "Activation", strName + "_relu", {bn},
+			{{"act_type", "relu"}});
+	auto weight = AddVariable(model, strName + "_conv_weight",
+			{nNumFilter, nChannels, nKernel, nKernel}, false);
+	std::string strPad = nKernel == 3 ? "(1, 1)" : "(0, 0)";
+	return AddNode(model, "Convolution", strName + "_conv", {relu, weight},
+			{{"kernel", nKernel == 3 ? "(3, 3)" : "(1, 1)"}, {"pad", strPad},
+			{"num_filter", std::to_string(nNumFilter)}, {"no_bias", "True"}});
+}
+
+SyntheticModel MakeDeepChain(size_t nNumBlocks) {
+	SyntheticModel model;
+	model.strName = "deep_chain";
+	auto prev = AddData(model, {1, 16, 16, 16});
+	for (size_t i = 0; i < nNumBlocks; ++i) {
+		prev = AddBnReluConv(model, prev, 16, 16, 3,
+				"block" + std::to_string(i));
+	}
+	return model;
+}
+
+void WriteMxnetSymbol(const std::vector<MxnetNode> &mxnetNodes,
+		const std::string &strFn) {
+	Json jNodes = Json::array();
+	Json jArgNodes = Json::array();
+	for (size_t i = 0; i < mxnetNodes.size(); ++i) {
+		auto &node = mxnetNodes[i];
+		Json jNode = {{"op", node.strOp}, {"name", node.strName},
+				{"inputs", Json::array()}};
+		if (!node.attrs.empty()) {
+			jNode["attrs"] = Json::object();
+			for (auto &attr : node.attrs) {
+				jNode["attrs"][attr.first] = attr.second;
+			}
+		}
+		for (auto &input : node.inputs) {
+			jNode["inputs"].push_back({input.first, input.second, 0});
+		}
+		if (node.strOp == "null") {
+			jArgNodes.push_back(i);
+		}
+		jNodes.push_back(std::move(jNode));
+	}
+	Json jHeads = Json::array();
+	for (auto &output : MxnetGraphOutputs(mxnetNodes)) {
+		jHeads.push_back({output.first, output.second, 0});
+	}
+	Json jSymbol = {{"nodes", std::move(jNodes)},
+			{"arg_nodes", std::move(jArgNodes)}, {"heads", std::move(jHeads)}};
+	std::ofstream jsonFile(strFn);
+	CHECK(jsonFile.is_open()) << strFn;
+	jsonFile << jSymbol.dump(1);
+	CHECK(jsonFile.good()) << strFn;
+}
+
+void WriteMxnetParams(const std::vector<SyntheticParam> &params,
+		const ParamFiller &filler, const std::string &strFn) {
+	const size_t nChunkSize = 1 << 20;
+	std::ofstream paramsFile(strFn, std::ios::binary);
+	CHECK(paramsFile.is_open()) << strFn;
+	auto Write = [&](const void *pData, size_t nBytes) {
+			paramsFile.write((const char*)pData, nBytes);
+		};
+	auto WriteU64 = [&](uint64_t nVal) { Write(&nVal, sizeof(nVal)); };
+	auto WriteU32 = [&](uint32_t nVal) { Write(&nVal, sizeof(nVal)); };
+	WriteU64(0x112);
+	WriteU64(0);
+	WriteU64(params.size());
+	std::vector<float> chunk;
+	for (size_t i = 0; i < params.size(); ++i) {
+		auto &param = params[i];
+		WriteU32(0xF993FAC9);
+		WriteU32(0); // stype
+		WriteU32((uint32_t)param.shape.size());
+		for (auto d : param.shape) {
+			WriteU64(d);
+		}
+		WriteU32(1); // cpu
+		WriteU32(0);
+		WriteU32(0); // float32
+		size_t nCount = ShapeCount(param.shape);
+		for (size_t nOffset = 0; nOffset < nCount; nOffset += nChunkSize) {
+			chunk.resize(std::min(nChunkSize, nCount - nOffset));
+			filler(i, nOffset, chunk.data(), chunk.size());
+			Write(chunk.data(), chunk.size() * sizeof(float));
+		}
+	}
+	WriteU64(params.size());
+	for (auto &param : params) {
+		std::string strName = (param.bAux ? "aux:" : "arg:") + param.strName;
+		WriteU64(strName.size());
+		Write(strName.data(), strName.size());
+	}
+	paramsFile.close();
+	CHECK(!paramsFile.fail()) << "Failed to write " << strFn;
+}
+
+void FillRandomParam(size_t iParam, size_t nOffset, float *pData,
+		size_t nCount) {
+	uint64_t nState = (iParam + 1) * 0x9E3779B97F4A7C15ULL + nOffset;
+	for (size_t i = 0; i < nCount; ++i) {
+		nState ^= nState << 13;
+		nState ^= nState >> 7;
+		nState ^= nState << 17;
+		pData[i] = (float)(nState >> 40) / (float)(1 << 23) - 1.f;
+	}
+}
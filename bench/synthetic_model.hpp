@@ -0,0 +1,74 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Building and writing synthetic MxNet models.
+*	Graphs are built in memory node by node, shared by the benchmarks and
+*	the fuzzer, and written as symbol json and params files in the formats
+*	read by mxnet_parser.hpp. The values of parameters are streamed by
+*	chunks, so params files beyond the memory can be written.
+*/
+
+#ifndef SYNTHETIC_MODEL_HPP_
+#define SYNTHETIC_MODEL_HPP_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "mxnet_parser.hpp"
+
+struct SyntheticParam {
+	std::string strName;
+	Shape shape;
+	bool bAux;	// moving statistics are auxiliary states of MxNet
+};
+
+// A MxNet graph with the parameters of its variables and its inputs
+struct SyntheticModel {
+	std::string strName;
+	std::vector<MxnetNode> nodes;
+	std::vector<SyntheticParam> params;
+	std::vector<InputInfo> inputInfos;
+};
+
+// Appends a node, returns its first output
+MxnetInput AddNode(SyntheticModel &model, const std::string &strOp,
+		const std::string &strName, const std::vector<MxnetInput> &inputs,
+		const std::vector<StringPair> &attrs);
+
+// Appends the variable node of a parameter
+MxnetInput AddVariable(SyntheticModel &model, const std::string &strName,
+		const Shape &shape, bool bAux);
+
+// Appends the input node "data"
+MxnetInput AddData(SyntheticModel &model, const Shape &shape);
+
+// BatchNorm, ReLU and Convolution of 9 nodes with the parameters
+MxnetInput AddBnReluConv(SyntheticModel &model, const MxnetInput &input,
+		size_t nChannels, size_t nNumFilter, size_t nKernel,
+		const std::string &strName);
+
+// Blocks of AddBnReluConv with 3x3 kernels over data of (1, 16, 16, 16)
+SyntheticModel MakeDeepChain(size_t nNumBlocks);
+
+// Fills nCount values of the iParam-th parameter from the nOffset-th value
+using ParamFiller = std::function<void(size_t iParam, size_t nOffset,
+		float *pData, size_t nCount)>;
+
+// Variables are listed in arg_nodes and the outputs of the graph in heads
+void WriteMxnetSymbol(const std::vector<MxnetNode> &mxnetNodes,
+		const std::string &strFn);
+
+// NDArray list of float32 arrays on cpu, named "arg:" or "aux:" + name
+void WriteMxnetParams(const std::vector<SyntheticParam> &params,
+		const ParamFiller &filler, const std::string &strFn);
+
+// Pseudo random values in [-1, 1) of the parameters, cheap enough to fill
+//	gigabytes
+void FillRandomParam(size_t iParam, size_t nOffset, float *pData,
+		size_t nCount);
+
+#endif /* SYNTHETIC_MODEL_HPP_ */
@@ -0,0 +1,296 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Conversion of many models in one run
+*/
+
+#include "batch_conversion.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "parallel.hpp"
+#include "resource_usage.hpp"
+#include "worker_pool.hpp"
+
+// Memory of a conversion besides the params and the net: the libraries,
+//	the protobuf messages being written and the buffers of files
+const size_t BASE_CONVERSION_BYTES = 64 << 20;
+
+// Bytes of the parsed nodes, the caffe net and the shapes for each byte of
+//	the MxNet json
+const size_t NET_BYTES_PER_JSON_BYTE = 16;
+
+size_t EstimateConversionBytes(const Json &jConfig,
+		const std::string &strWorkPath) {
+	auto FileOfKey = [&](const char *pKey) -> size_t {
+			auto iValue = jConfig.find(pKey);
+			if (iValue == jConfig.end() || !iValue->is_string()) {
+				return 0;
+			}
+			return FileBytes(strWorkPath + iValue->get<std::string>());
+		};
+	return BASE_CONVERSION_BYTES + FileOfKey("mxnet_params") +
+			FileOfKey("mxnet_json") * NET_BYTES_PER_JSON_BYTE;
+}
+
+// A job of a config, its json is left null if it can not be parsed
+BatchJob MakeBatchJob(const std::string &strName, Json jConfig,
+		const std::string &strWorkPath, const std::string &strDefaultLogFn) {
+	BatchJob job = {strName, Json(), strWorkPath, strDefaultLogFn, 0};
+	if (!jConfig.is_object()) {
+		return job;
+	}
+	auto iProto = jConfig.find("caffe_prototxt");
+	if (iProto != jConfig.end() && iProto->is_string()) {
+		job.strLogFn = ReplaceExtension(
+				strWorkPath + iProto->get<std::string>(), ".log");
+	}
+	job.nEstimatedBytes = EstimateConversionBytes(jConfig, strWorkPath);
+	job.jConfig = std::move(jConfig);
+	return job;
+}
+
+BatchJob ConfigFileJob(const std::string &strConfFn) {
+	Json jConfig;
+	std::ifstream configFile(strConfFn);
+	if (configFile.is_open()) {
+		jConfig = Json::parse(configFile, nullptr, false);
+	}
+	return MakeBatchJob(strConfFn, std::move(jConfig),
+			DirectoryOf(strConfFn), ReplaceExtension(strConfFn, ".log"));
+}
+
+std::vector<BatchJob> LoadManifest(const std::string &strManifest) {
+	std::vector<BatchJob> jobs;
+	std::ifstream manifestFile(strManifest);
+	if (manifestFile.is_open()) {
+		Json jManifest = Json::parse(manifestFile, nullptr, false);
+		if (jManifest.is_array()) {
+			std::string strWorkPath = DirectoryOf(strManifest);
+			for (size_t i = 0; i < jManifest.size(); ++i) {
+				auto &jEntry = jManifest[i];
+				if (jEntry.is_string()) {
+					jobs.emplace_back(ConfigFileJob(
+							strWorkPath + jEntry.get<std::string>()));
+					continue;
+				}
+				std::string strName = strManifest + "[" +
+						std::to_string(i) + "]";
+				auto iProto = jEntry.find("caffe_prototxt");
+				if (jEntry.is_object() && iProto != jEntry.end() &&
+						iProto->is_string()) {
+					strName = strWorkPath + iProto->get<std::string>();
+				}
+				jobs.emplace_back(MakeBatchJob(strName, std::move(jEntry),
+						strWorkPath, ReplaceExtension(strManifest,
+						"_" + std::to_string(i) + ".log")));
+			}
+			return jobs;
+		}
+	}
+
+	// Not a list of configs, taken as a glob pattern of config files
+	glob_t globResult;
+	int nRet = glob(strManifest.c_str(), 0, nullptr, &globResult);
+	CHECK(nRet == 0 || nRet == GLOB_NOMATCH) << "Failed to glob " <<
+			strManifest;
+	for (size_t i = 0; nRet == 0 && i < globResult.gl_pathc; ++i) {
+		jobs.emplace_back(ConfigFileJob(globResult.gl_pathv[i]));
+	}
+	globfree(&globResult);
+	CHECK(!jobs.empty()) << "No config matches " << strManifest;
+	return jobs;
+}
+
+// Runs in the forked process, with its output going to the log of the job
+void RunBatchWorker(const BatchJob &job, const BatchOptions &options,
+		size_t nNumThreads) {
+	int nLogFd = open(job.strLogFn.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+			0644);
+	if (nLogFd >= 0) {
+		dup2(nLogFd, STDOUT_FILENO);
+		dup2(nLogFd, STDERR_FILENO);
+		close(nLogFd);
+	}
+	auto po = ParseConfig(job.jConfig, job.strWorkPath);
+	po.analysis = options.analysis;
+	if (po.nNumThreads == 0) {
+		po.nNumThreads = nNumThreads;
+		po.calibOptions.nNumThreads = nNumThreads;
+	}
+	ConvertModel(po);
+}
+
+bool IsFatalLogLine(const std::string &strLine) {
+	bool bGlogFatal = strLine.size() > 1 && strLine[0] == 'F' &&
+			(std::isdigit((unsigned char)strLine[1]) || strLine[1] == ' ');
+	return bGlogFatal || strLine.find("what():") != std::string::npos;
+}
+
+std::string DescribeExitStatus(int nStatus) {
+	if (WIFSIGNALED(nStatus)) {
+		return std::string("Killed by signal ") + strsignal(WTERMSIG(nStatus));
+	}
+	return "Exited with status " + std::to_string(WEXITSTATUS(nStatus));
+}
+
+// The last fatal line of the log
+std::string FatalLineOfLog(const std::string &strLogFn) {
+	std::ifstream logFile(strLogFn);
+	std::string strLine, strFatal;
+	while (std::getline(logFile, strLine)) {
+		if (IsFatalLogLine(strLine)) {
+			strFatal = strLine;
+		}
+	}
+	return strFatal;
+}
+
+double SecondsBetween(std::chrono::steady_clock::time_point tBeg,
+		std::chrono::steady_clock::time_point tEnd) {
+	return std::chrono::duration<double>(tEnd - tBeg).count();
+}
+
+std::vector<BatchOutcome> ConvertBatch(const std::vector<BatchJob> &jobs,
+		const BatchOptions &options) {
+	WorkerPool pool(std::min(NumWorkerThreads(options.nNumJobs),
+			std::max(jobs.size(), size_t(1))), options.nMemoryBudget);
+	LOG(INFO) << "Converting " << jobs.size() << " models, " <<
+			pool.NumJobs() << " at a time within " << (pool.Budget() >> 20) <<
+			" MB";
+
+	auto tBatch = std::chrono::steady_clock::now();
+	std::vector<BatchOutcome> outcomes(jobs.size());
+	std::map<pid_t, size_t> runningJobs;
+	size_t nNext = 0, nNumDone = 0;
+	auto LogDone = [&](const BatchOutcome &outcome) {
+			++nNumDone;
+			LOG(INFO) << "[" << nNumDone << "/" << jobs.size() << "] " <<
+					outcome.strName << (outcome.bSucceeded ? " converted" :
+					" failed") << " in " << std::fixed <<
+					std::setprecision(2) << outcome.dWallSeconds << " s" <<
+					(outcome.bSucceeded ? "" : ": " + outcome.strError);
+		};
+	while (nNext < jobs.size() || !runningJobs.empty()) {
+		// Jobs start in order, as long as the pool takes them
+		while (nNext < jobs.size() &&
+				pool.CanStart(jobs[nNext].nEstimatedBytes)) {
+			auto &job = jobs[nNext];
+			auto &outcome = outcomes[nNext];
+			outcome = {job.strName, false, "", SecondsBetween(tBatch,
+					std::chrono::steady_clock::now()), 0., 0., 0,
+					job.nEstimatedBytes, job.strLogFn};
+			if (job.jConfig.is_null()) {
+				outcome.strError = "Invalid config json";
+				outcome.strLogFn.clear();
+				LogDone(outcome);
+				++nNext;
+				continue;
+			}
+			pid_t nPid = pool.Start(job.nEstimatedBytes, [&]() {
+					RunBatchWorker(job, options, pool.NumThreads());
+				});
+			runningJobs[nPid] = nNext;
+			++nNext;
+		}
+		if (runningJobs.empty()) {
+			continue;
+		}
+
+		pid_t nPid = -1;
+		WorkerExit exit;
+		if (!pool.Wait(-1, nPid, exit)) {
+			continue;
+		}
+		auto iRunning = runningJobs.find(nPid);
+		auto &job = jobs[iRunning->second];
+		auto &outcome = outcomes[iRunning->second];
+		outcome.dWallSeconds = exit.dWallSeconds;
+		outcome.dCpuSeconds = exit.dCpuSeconds;
+		outcome.nPeakRss = exit.nPeakRss;
+		outcome.bSucceeded = exit.bSucceeded;
+		if (!outcome.bSucceeded) {
+			outcome.strError = FatalLineOfLog(job.strLogFn);
+		}
+		if (!outcome.bSucceeded && outcome.strError.empty()) {
+			outcome.strError = DescribeExitStatus(exit.nStatus);
+		}
+		runningJobs.erase(iRunning);
+		LogDone(outcome);
+	}
+	return outcomes;
+}
+
+std::string FormatBatchReport(const std::vector<BatchOutcome> &outcomes,
+		double dWallSeconds) {
+	size_t nNumFailed = 0;
+	double dSumSeconds = 0.;
+	std::ostringstream oss;
+	oss << std::left << std::setw(48) << "model" << std::setw(8) <<
+			"status" << std::right << std::setw(10) << "queued s" <<
+			std::setw(10) << "wall s" << std::setw(10) << "cpu s" <<
+			std::setw(12) << "peak MB" << std::setw(12) << "est. MB";
+	oss << std::fixed;
+	for (auto &outcome : outcomes) {
+		oss << "\n" << std::left << std::setw(48) << outcome.strName <<
+				std::setw(8) << (outcome.bSucceeded ? "ok" : "failed") <<
+				std::right << std::setprecision(2) << std::setw(10) <<
+				outcome.dQueuedSeconds << std::setw(10) <<
+				outcome.dWallSeconds << std::setw(10) << outcome.dCpuSeconds <<
+				std::setprecision(1) << std::setw(12) <<
+				outcome.nPeakRss / 1048576. << std::setw(12) <<
+				outcome.nEstimatedBytes / 1048576.;
+		nNumFailed += outcome.bSucceeded ? 0 : 1;
+		dSumSeconds += outcome.dWallSeconds;
+	}
+	for (auto &outcome : outcomes) {
+		if (!outcome.bSucceeded) {
+			oss << "\n" << outcome.strName << ": " << outcome.strError;
+			if (!outcome.strLogFn.empty()) {
+				oss << " (see " << outcome.strLogFn << ")";
+			}
+		}
+	}
+	oss << std::setprecision(2) << "\n" << outcomes.size() - nNumFailed <<
+			" converted, " << nNumFailed << " failed, in " << dWallSeconds <<
+			" s for " << dSumSeconds << " s of conversions";
+	return oss.str();
+}
+
+void WriteBatchReport(const std::vector<BatchOutcome> &outcomes,
+		double dWallSeconds, const std::string &strFn) {
+	Json jModels = Json::array();
+	size_t nNumFailed = 0;
+	for (auto &outcome : outcomes) {
+		jModels.push_back({{"name", outcome.strName},
+				{"succeeded", outcome.bSucceeded},
+				{"error", outcome.strError},
+				{"queued_seconds", outcome.dQueuedSeconds},
+				{"wall_seconds", outcome.dWallSeconds},
+				{"cpu_seconds", outcome.dCpuSeconds},
+				{"peak_rss_bytes", outcome.nPeakRss},
+				{"estimated_bytes", outcome.nEstimatedBytes},
+				{"log", outcome.strLogFn}});
+		nNumFailed += outcome.bSucceeded ? 0 : 1;
+	}
+	std::ofstream reportFile(strFn);
+	CHECK(reportFile.is_open()) << strFn;
+	reportFile << Json({{"wall_seconds", dWallSeconds},
+			{"succeeded", outcomes.size() - nNumFailed},
+			{"failed", nNumFailed},
+			{"models", std::move(jModels)}}).dump(1) << std::endl;
+}
@@ -0,0 +1,76 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Conversion of many models in one run.
+*	A manifest is either a json file of a list of configs, given by their
+*	files or inline, or a glob pattern of config files. Each model is
+*	converted by a worker process forked from the running one, so the start
+*	of the libraries is paid once and a model failing a check does not stop
+*	the others; its log is kept next to its prototxt as <name>.log. Workers
+*	run concurrently up to a number of jobs and a memory budget, as
+*	scheduled by worker_pool.hpp.
+*/
+
+#ifndef BATCH_CONVERSION_HPP_
+#define BATCH_CONVERSION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "conversion.hpp"
+
+struct BatchJob {
+	std::string strName;	// config file, or prototxt of inline configs
+	Json jConfig;			// null if the config can not be read
+	std::string strWorkPath;
+	std::string strLogFn;
+	size_t nEstimatedBytes;
+};
+
+struct BatchOptions {
+	size_t nNumJobs;		// models converted concurrently, 0 for all cores
+	size_t nMemoryBudget;	// bytes, 0 for 3/4 of the physical memory
+	AnalysisOptions analysis;
+};
+
+struct BatchOutcome {
+	std::string strName;
+	bool bSucceeded;
+	std::string strError;	// last fatal line of the log
+	double dQueuedSeconds;	// from the start of the batch to its own
+	double dWallSeconds;
+	double dCpuSeconds;
+	size_t nPeakRss;
+	size_t nEstimatedBytes;
+	std::string strLogFn;
+};
+
+// Jobs of a manifest in their order, those of a glob sorted by name
+std::vector<BatchJob> LoadManifest(const std::string &strManifest);
+
+// Memory of converting a model, the params mapped and touched once plus the
+//	net, which grows with the json
+size_t EstimateConversionBytes(const Json &jConfig,
+		const std::string &strWorkPath);
+
+// A line of glog's fatal message or of an uncaught exception
+bool IsFatalLogLine(const std::string &strLine);
+
+// Why a worker failed, from its status of wait()
+std::string DescribeExitStatus(int nStatus);
+
+// Converts all jobs, returns the outcomes in the order of jobs. Models of
+//	num_threads 0 share the cores with the other jobs.
+std::vector<BatchOutcome> ConvertBatch(const std::vector<BatchJob> &jobs,
+		const BatchOptions &options);
+
+// One line for each model and the totals
+std::string FormatBatchReport(const std::vector<BatchOutcome> &outcomes,
+		double dWallSeconds);
+
+void WriteBatchReport(const std::vector<BatchOutcome> &outcomes,
+		double dWallSeconds, const std::string &strFn);
+
+#endif /* BATCH_CONVERSION_HPP_ */
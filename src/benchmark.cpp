@@ -0,0 +1,228 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Benchmark of the forward of the converted net on CPU
+*/
+
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <glog/logging.h>
+
+#include "json_helper.hpp"
+#include "parallel.hpp"
+
+// A copy of the net with the first dimension of all inputs set to the batch
+caffe::NetParameter BatchedNet(const caffe::NetParameter &net,
+		size_t nBatchSize) {
+	caffe::NetParameter batchedNet(net);
+	for (auto &layer : *batchedNet.mutable_layer()) {
+		if (layer.type() != "Input") {
+			continue;
+		}
+		for (auto &shape : *layer.mutable_input_param()->mutable_shape()) {
+			CHECK_GT(shape.dim_size(), 0) << "Input " << layer.name() <<
+					" has no dimension";
+			shape.set_dim(0, (int64_t)nBatchSize);
+		}
+	}
+	return batchedNet;
+}
+
+void FillInputs(caffe::Net<float> &caffeNet, const caffe::NetParameter &net,
+		unsigned nSeed) {
+	std::set<std::string> labels;
+	for (auto &layer : net.layer()) {
+		if (layer.type() == "SoftmaxWithLoss" && layer.bottom_size() > 1) {
+			labels.insert(layer.bottom(1));
+		}
+	}
+	std::mt19937 rng(nSeed);
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	auto &inputIndices = caffeNet.input_blob_indices();
+	for (size_t i = 0; i < inputIndices.size(); ++i) {
+		auto *pBlob = caffeNet.input_blobs()[i];
+		float *pData = pBlob->mutable_cpu_data();
+		bool bLabel = labels.count(caffeNet.blob_names()[inputIndices[i]]) > 0;
+		for (int j = 0; j < pBlob->count(); ++j) {
+			pData[j] = bLabel ? 0.f : dist(rng);
+		}
+	}
+}
+
+double Percentile(const std::vector<double> &sorted, double dPercent) {
+	size_t nRank = (size_t)std::ceil(dPercent / 100. * sorted.size());
+	return sorted[std::min(std::max(nRank, size_t(1)), sorted.size()) - 1];
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point tBeg) {
+	return std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - tBeg).count();
+}
+
+std::vector<LayerTime> TimeLayers(caffe::Net<float> &caffeNet,
+		size_t nNumIterations) {
+	auto &layerNames = caffeNet.layer_names();
+	std::vector<LayerTime> layers(layerNames.size());
+	for (size_t l = 0; l < layerNames.size(); ++l) {
+		layers[l] = {layerNames[l], caffeNet.layers()[l]->type(), 0.};
+	}
+	for (size_t n = 0; n < nNumIterations; ++n) {
+		for (size_t l = 0; l < layers.size(); ++l) {
+			auto tBeg = std::chrono::steady_clock::now();
+			caffeNet.ForwardFromTo((int)l, (int)l);
+			layers[l].dMeanMs += MillisecondsSince(tBeg);
+		}
+	}
+	for (auto &layer : layers) {
+		layer.dMeanMs /= nNumIterations;
+	}
+	return layers;
+}
+
+std::vector<BenchmarkResult> BenchmarkForward(const caffe::NetParameter &net,
+		const CaffeWeights &weights, const BenchmarkOptions &options) {
+	CHECK(!options.batchSizes.empty() && !options.threadCounts.empty());
+	CHECK_GT(options.nNumIterations, 0U);
+	size_t nMaxThreads = 0;
+	for (auto &nNumThreads : options.threadCounts) {
+		nMaxThreads = std::max(nMaxThreads, NumWorkerThreads(nNumThreads));
+	}
+
+	std::vector<BenchmarkResult> results;
+	for (auto nBatchSize : options.batchSizes) {
+		CHECK_GT(nBatchSize, 0U);
+		auto batchedNet = InferenceNet(BatchedNet(net, nBatchSize));
+		// Nets are created once for a batch size by the threads using them
+		std::vector<std::unique_ptr<caffe::Net<float>>> caffeNets(nMaxThreads);
+		std::vector<LayerTime> layerTimes;
+		for (auto nNumThreads : options.threadCounts) {
+			nNumThreads = NumWorkerThreads(nNumThreads);
+			std::vector<std::vector<double>> latencies(nNumThreads);
+			std::vector<double> timedMs(nNumThreads);
+			std::atomic<size_t> nNumReady(0);
+			ParallelFor(nNumThreads, nNumThreads, [&](size_t iThread) {
+					auto &pNet = caffeNets[iThread];
+					if (pNet == nullptr) {
+						pNet.reset(new caffe::Net<float>(batchedNet));
+						BindNetWeights(*pNet, batchedNet, weights);
+						FillInputs(*pNet, batchedNet, (unsigned)iThread);
+					}
+					for (size_t n = 0; n < options.nNumWarmup; ++n) {
+						pNet->Forward();
+					}
+					// Timed forwards of all threads start together
+					++nNumReady;
+					while (nNumReady < nNumThreads) {
+						std::this_thread::yield();
+					}
+					auto tBeg = std::chrono::steady_clock::now();
+					for (size_t n = 0; n < options.nNumIterations; ++n) {
+						auto tForward = std::chrono::steady_clock::now();
+						pNet->Forward();
+						latencies[iThread].push_back(
+								MillisecondsSince(tForward));
+					}
+					timedMs[iThread] = MillisecondsSince(tBeg);
+				});
+
+			std::vector<double> allLatencies;
+			for (auto &threadLatencies : latencies) {
+				allLatencies.insert(allLatencies.end(),
+						threadLatencies.begin(), threadLatencies.end());
+			}
+			std::sort(allLatencies.begin(), allLatencies.end());
+			double dWallMs = *std::max_element(timedMs.begin(), timedMs.end());
+			BenchmarkResult result;
+			result.nBatchSize = nBatchSize;
+			result.nNumThreads = nNumThreads;
+			result.dP50Ms = Percentile(allLatencies, 50.);
+			result.dP99Ms = Percentile(allLatencies, 99.);
+			result.dMeanMs = std::accumulate(allLatencies.begin(),
+					allLatencies.end(), 0.) / allLatencies.size();
+			result.dSamplesPerSec = (double)nBatchSize * allLatencies.size() /
+					dWallMs * 1000.;
+			if (layerTimes.empty()) {
+				layerTimes = TimeLayers(*caffeNets[0], options.nNumIterations);
+			}
+			result.layers = layerTimes;
+			results.emplace_back(std::move(result));
+		}
+	}
+	return results;
+}
+
+std::string FormatBenchmarkReport(
+		const std::vector<BenchmarkResult> &results) {
+	std::ostringstream oss;
+	oss << std::setw(8) << "batch" << std::setw(10) << "threads" <<
+			std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" <<
+			std::setw(12) << "mean ms" << std::setw(14) << "samples/s";
+	oss << std::fixed << std::setprecision(3);
+	for (auto &result : results) {
+		oss << "\n" << std::setw(8) << result.nBatchSize << std::setw(10) <<
+				result.nNumThreads << std::setw(12) << result.dP50Ms <<
+				std::setw(12) << result.dP99Ms << std::setw(12) <<
+				result.dMeanMs << std::setw(14) << std::setprecision(1) <<
+				result.dSamplesPerSec << std::setprecision(3);
+	}
+	return oss.str();
+}
+
+std::string FormatLayerTimes(const BenchmarkResult &result) {
+	auto layers = result.layers;
+	std::stable_sort(layers.begin(), layers.end(),
+			[](const LayerTime &l1, const LayerTime &l2) {
+				return l1.dMeanMs > l2.dMeanMs;
+			});
+	double dTotalMs = 0.;
+	for (auto &layer : layers) {
+		dTotalMs += layer.dMeanMs;
+	}
+	std::ostringstream oss;
+	oss << std::left << std::setw(32) << "layer" << std::setw(20) << "type" <<
+			std::right << std::setw(12) << "mean ms" << std::setw(10) << "%";
+	oss << std::fixed;
+	for (auto &layer : layers) {
+		oss << "\n" << std::left << std::setw(32) << layer.strLayer <<
+				std::setw(20) << layer.strType << std::right <<
+				std::setprecision(3) << std::setw(12) << layer.dMeanMs <<
+				std::setprecision(1) << std::setw(10) <<
+				(dTotalMs > 0. ? layer.dMeanMs * 100. / dTotalMs : 0.);
+	}
+	return oss.str();
+}
+
+void WriteBenchmarkReport(const std::vector<BenchmarkResult> &results,
+		const std::string &strFn) {
+	Json jResults = Json::array();
+	for (auto &result : results) {
+		Json jLayers = Json::array();
+		for (auto &layer : result.layers) {
+			jLayers.push_back({{"name", layer.strLayer},
+					{"type", layer.strType}, {"mean_ms", layer.dMeanMs}});
+		}
+		jResults.push_back({{"batch_size", result.nBatchSize},
+				{"threads", result.nNumThreads}, {"p50_ms", result.dP50Ms},
+				{"p99_ms", result.dP99Ms}, {"mean_ms", result.dMeanMs},
+				{"samples_per_second", result.dSamplesPerSec},
+				{"layers", std::move(jLayers)}});
+	}
+	std::ofstream reportFile(strFn);
+	CHECK(reportFile.is_open()) << strFn;
+	reportFile << Json({{"results", std::move(jResults)}}).dump(1) <<
+			std::endl;
+}
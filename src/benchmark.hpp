@@ -0,0 +1,62 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Benchmark of the forward of the converted net on CPU.
+*	For each batch size the inputs are reshaped, and each thread count runs
+*	that many caffe::Net sharing the weights concurrently, like serving
+*	requests in parallel. Threads inside a forward are those of the BLAS
+*	library linked by caffe (OPENBLAS_NUM_THREADS, MKL_NUM_THREADS, ...).
+*/
+
+#ifndef BENCHMARK_HPP_
+#define BENCHMARK_HPP_
+
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "model_writer.hpp"
+
+struct BenchmarkOptions {
+	std::vector<size_t> batchSizes;
+	std::vector<size_t> threadCounts;	// of concurrent nets
+	size_t nNumWarmup;					// forwards not timed, per thread
+	size_t nNumIterations;				// timed forwards, per thread
+};
+
+struct LayerTime {
+	std::string strLayer;
+	std::string strType;
+	double dMeanMs;
+};
+
+struct BenchmarkResult {
+	size_t nBatchSize;
+	size_t nNumThreads;
+	double dP50Ms;				// latency of a forward
+	double dP99Ms;
+	double dMeanMs;
+	double dSamplesPerSec;		// of all threads together
+	// Forward of each layer alone by one thread, the same for all thread
+	//	counts of a batch size
+	std::vector<LayerTime> layers;
+};
+
+// Inputs are random in [-1, 1), labels of SoftmaxWithLoss are zeros
+std::vector<BenchmarkResult> BenchmarkForward(const caffe::NetParameter &net,
+		const CaffeWeights &weights, const BenchmarkOptions &options);
+
+// One line for each batch size and thread count
+std::string FormatBenchmarkReport(const std::vector<BenchmarkResult> &results);
+
+// Layers of a result sorted by their time, with their share of the total
+std::string FormatLayerTimes(const BenchmarkResult &result);
+
+void WriteBenchmarkReport(const std::vector<BenchmarkResult> &results,
+		const std::string &strFn);
+
+#endif /* BENCHMARK_HPP_ */
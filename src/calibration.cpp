@@ -0,0 +1,327 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Calibration of activation ranges for INT8 inference
+*/
+
+#include "calibration.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "parallel.hpp"
+#include "quantization.hpp"
+
+// Number of levels of the quantized distribution in the KL search
+const size_t KL_LEVELS = 128;
+
+bool IsDirectory(const std::string &strPath) {
+	struct stat pathStat;
+	return stat(strPath.c_str(), &pathStat) == 0 && S_ISDIR(pathStat.st_mode);
+}
+
+// Sorted regular files of a directory, hidden files are skipped
+std::vector<std::string> ListFiles(const std::string &strDir) {
+	DIR *pDir = opendir(strDir.c_str());
+	CHECK(pDir != nullptr) << strDir << ": " << strerror(errno);
+	std::vector<std::string> files;
+	for (dirent *pEnt = readdir(pDir); pEnt != nullptr; pEnt = readdir(pDir)) {
+		std::string strPath = strDir + "/" + pEnt->d_name;
+		if (pEnt->d_name[0] != '.' && !IsDirectory(strPath)) {
+			files.push_back(strPath);
+		}
+	}
+	closedir(pDir);
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+// Float32 data of a .npy or a raw file
+std::vector<float> LoadSampleFile(const std::string &strFn) {
+	std::ifstream inFile(strFn, std::ios::binary);
+	CHECK(inFile.is_open()) << strFn;
+	std::string strBytes((std::istreambuf_iterator<char>(inFile)),
+			std::istreambuf_iterator<char>());
+	size_t nDataPos = 0;
+	if (IsEndWith(strFn, ".npy")) {
+		CHECK(strBytes.size() >= 10 && strBytes.compare(0, 6, "\x93NUMPY") == 0)
+				<< strFn << " is not a npy file";
+		size_t nHeaderBytes = (uint8_t)strBytes[8] | (uint8_t)strBytes[9] << 8;
+		nDataPos = 10;
+		if (strBytes[6] > 1) { // version 2 and 3 have a 4-byte length
+			CHECK_GE(strBytes.size(), 12U) << strFn;
+			nHeaderBytes |= (size_t)((uint8_t)strBytes[10] << 16 |
+					(uint8_t)strBytes[11] << 24);
+			nDataPos = 12;
+		}
+		CHECK_LE(nDataPos + nHeaderBytes, strBytes.size()) << strFn;
+		std::string strHeader = strBytes.substr(nDataPos, nHeaderBytes);
+		CHECK(strHeader.find("'<f4'") != std::string::npos) << strFn <<
+				" is not float32: " << strHeader;
+		CHECK(strHeader.find("'fortran_order': False") != std::string::npos)
+				<< strFn << " is not in C order";
+		nDataPos += nHeaderBytes;
+	}
+	CHECK_EQ((strBytes.size() - nDataPos) % sizeof(float), 0) << strFn;
+	std::vector<float> data((strBytes.size() - nDataPos) / sizeof(float));
+	memcpy(data.data(), strBytes.data() + nDataPos,
+			data.size() * sizeof(float));
+	return data;
+}
+
+// Files of samples for each input blob, all of the same number
+std::vector<std::vector<std::string>> ListSamples(const std::string &strDir,
+		const caffe::Net<float> &caffeNet) {
+	auto &inputIndices = caffeNet.input_blob_indices();
+	std::vector<std::vector<std::string>> samples;
+	if (inputIndices.size() == 1) {
+		samples.push_back(ListFiles(strDir));
+	} else {
+		for (auto iBlob : inputIndices) {
+			samples.push_back(ListFiles(strDir + "/" +
+					caffeNet.blob_names()[iBlob]));
+			CHECK_EQ(samples.back().size(), samples.front().size()) <<
+					"Number of samples mismatch for input " <<
+					caffeNet.blob_names()[iBlob];
+		}
+	}
+	CHECK(!samples.empty() && !samples.front().empty()) <<
+			"No sample in " << strDir;
+	return samples;
+}
+
+// Forwards all batches in the files of the sample, and visits the net after
+//	each forward
+void RunSample(caffe::Net<float> &caffeNet,
+		const std::vector<std::vector<std::string>> &samples, size_t iSample,
+		const std::function<void(const caffe::Net<float>&)> &visitor) {
+	auto &inputBlobs = caffeNet.input_blobs();
+	std::vector<std::vector<float>> inputData;
+	size_t nNumBatches = 0;
+	for (size_t i = 0; i < inputBlobs.size(); ++i) {
+		auto &strFn = samples[i][iSample];
+		inputData.emplace_back(LoadSampleFile(strFn));
+		size_t nCount = inputBlobs[i]->count();
+		CHECK_EQ(inputData[i].size() % nCount, 0) << strFn << " of " <<
+				inputData[i].size() << " floats is not batches of the input " <<
+				"of " << nCount;
+		CHECK(i == 0 || nNumBatches == inputData[i].size() / nCount) <<
+				"Number of batches mismatch for " << strFn;
+		nNumBatches = inputData[i].size() / nCount;
+	}
+	for (size_t b = 0; b < nNumBatches; ++b) {
+		for (size_t i = 0; i < inputBlobs.size(); ++i) {
+			size_t nCount = inputBlobs[i]->count();
+			memcpy(inputBlobs[i]->mutable_cpu_data(),
+					inputData[i].data() + b * nCount, nCount * sizeof(float));
+		}
+		caffeNet.Forward();
+		visitor(caffeNet);
+	}
+}
+
+// Threshold of the histogram of absolute values minimizing the KL divergence
+//	between the clipped distribution and the quantization to KL_LEVELS levels
+//	of the values within the threshold, as the entropy calibration of MxNet.
+size_t KLThresholdBin(const std::vector<uint64_t> &hist) {
+	size_t nNumBins = hist.size();
+	if (nNumBins <= KL_LEVELS) {
+		return nNumBins;
+	}
+	const double dEps = 1e-4; // smoothing of empty bins of q
+	double dOutliers = 0.;
+	for (size_t i = KL_LEVELS; i < nNumBins; ++i) {
+		dOutliers += hist[i];
+	}
+	double dBestKL = std::numeric_limits<double>::max();
+	size_t nBestBin = nNumBins;
+	std::vector<double> p, q;
+	for (size_t i = KL_LEVELS; i <= nNumBins; ++i) {
+		// The reference distribution clipped at bin i
+		p.assign(hist.begin(), hist.begin() + i);
+		p[i - 1] += dOutliers;
+		if (i < nNumBins) {
+			dOutliers -= hist[i];
+		}
+		// Values within the threshold merged to the levels, and expanded over
+		//	the non-zero bins of p
+		q.assign(i, 0.);
+		for (size_t j = 0; j < KL_LEVELS; ++j) {
+			size_t nBeg = j * i / KL_LEVELS;
+			size_t nEnd = (j + 1) * i / KL_LEVELS;
+			double dSum = 0.;
+			size_t nNonZeros = 0;
+			for (size_t k = nBeg; k < nEnd; ++k) {
+				dSum += hist[k];
+				nNonZeros += (p[k] != 0.);
+			}
+			for (size_t k = nBeg; k < nEnd && nNonZeros > 0; ++k) {
+				q[k] = (p[k] != 0.) ? dSum / nNonZeros : 0.;
+			}
+		}
+		double dSumP = 0., dSumQ = 0.;
+		size_t nZerosQ = 0, nNonZerosQ = 0;
+		for (size_t k = 0; k < i; ++k) {
+			dSumP += p[k];
+			dSumQ += q[k];
+			nZerosQ += (p[k] != 0. && q[k] == 0.);
+			nNonZerosQ += (q[k] != 0.);
+		}
+		if (dSumP == 0. || nNonZerosQ == 0) {
+			continue;
+		}
+		// Moves a little mass to the bins where p is but q is not
+		double dEpsNonZero = dEps * nZerosQ / nNonZerosQ;
+		double dKL = 0.;
+		for (size_t k = 0; k < i; ++k) {
+			if (p[k] != 0.) {
+				double dQ = (q[k] != 0.) ? q[k] - dEpsNonZero : dEps;
+				dKL += p[k] / dSumP * std::log((p[k] / dSumP) / (dQ / dSumQ));
+			}
+		}
+		if (dKL < dBestKL) {
+			dBestKL = dKL;
+			nBestBin = i;
+		}
+	}
+	return nBestBin;
+}
+
+// Upper bin of the histogram covering the percentile of values
+size_t PercentileThresholdBin(const std::vector<uint64_t> &hist,
+		double dPercentile) {
+	double dTotal = 0.;
+	for (auto n : hist) {
+		dTotal += n;
+	}
+	double dTarget = dTotal * dPercentile / 100.;
+	double dCumulative = 0.;
+	for (size_t i = 0; i < hist.size(); ++i) {
+		dCumulative += hist[i];
+		if (dCumulative >= dTarget) {
+			return i + 1;
+		}
+	}
+	return hist.size();
+}
+
+std::vector<BlobThreshold> CalibrateActivations(
+		const caffe::NetParameter &net, const CaffeWeights &weights,
+		const CalibrationOptions &options) {
+	CHECK(options.strMethod == "kl" || options.strMethod == "percentile") <<
+			"Unknown calibration method " << options.strMethod;
+	CHECK(options.dPercentile > 0. && options.dPercentile <= 100.);
+	CHECK_GT(options.nNumBins, 0U);
+
+	auto inferenceNet = InferenceNet(net);
+	std::unique_ptr<caffe::Net<float>> pFirstNet(
+			new caffe::Net<float>(inferenceNet));
+	BindNetWeights(*pFirstNet, inferenceNet, weights);
+	auto samples = ListSamples(options.strSampleDir, *pFirstNet);
+	size_t nNumSamples = samples.front().size();
+	size_t nNumBlobs = pFirstNet->blobs().size();
+	size_t nNumWorkers = std::min(NumWorkerThreads(options.nNumThreads),
+			nNumSamples);
+	LOG(INFO) << "Calibrating " << nNumBlobs << " blobs by " << nNumSamples <<
+			" samples in " << nNumWorkers << " threads";
+
+	// Each worker has its own net and statistics, merged after each pass
+	std::vector<std::unique_ptr<caffe::Net<float>>> caffeNets(nNumWorkers);
+	caffeNets[0] = std::move(pFirstNet);
+	auto RunPass = [&](const std::function<void(size_t,
+			const caffe::Net<float>&)> &visitor) {
+			std::atomic<size_t> nNextSample(0);
+			ParallelFor(nNumWorkers, nNumWorkers, [&](size_t iWorker) {
+					auto &pNet = caffeNets[iWorker];
+					if (pNet == nullptr) {
+						pNet.reset(new caffe::Net<float>(inferenceNet));
+						BindNetWeights(*pNet, inferenceNet, weights);
+					}
+					for (size_t i = nNextSample++; i < nNumSamples;
+							i = nNextSample++) {
+						RunSample(*pNet, samples, i,
+								[&](const caffe::Net<float> &caffeNet) {
+									visitor(iWorker, caffeNet);
+								});
+					}
+				});
+		};
+
+	// The first pass finds the ranges of the histograms
+	std::vector<std::vector<float>> workerMaxAbs(nNumWorkers,
+			std::vector<float>(nNumBlobs, 0.f));
+	RunPass([&](size_t iWorker, const caffe::Net<float> &caffeNet) {
+			auto &maxAbs = workerMaxAbs[iWorker];
+			for (size_t i = 0; i < nNumBlobs; ++i) {
+				auto &pBlob = caffeNet.blobs()[i];
+				maxAbs[i] = std::max(maxAbs[i],
+						MaxAbs(pBlob->cpu_data(), pBlob->count()));
+			}
+		});
+	std::vector<float> maxAbs(nNumBlobs, 0.f);
+	for (auto &workerMax : workerMaxAbs) {
+		for (size_t i = 0; i < nNumBlobs; ++i) {
+			maxAbs[i] = std::max(maxAbs[i], workerMax[i]);
+		}
+	}
+
+	// The second pass collects the histograms of absolute values
+	size_t nNumBins = options.nNumBins;
+	std::vector<std::vector<uint64_t>> hists(nNumWorkers * nNumBlobs,
+			std::vector<uint64_t>(nNumBins, 0));
+	RunPass([&](size_t iWorker, const caffe::Net<float> &caffeNet) {
+			for (size_t i = 0; i < nNumBlobs; ++i) {
+				auto &hist = hists[iWorker * nNumBlobs + i];
+				auto &pBlob = caffeNet.blobs()[i];
+				const float *pData = pBlob->cpu_data();
+				float fBinScale = maxAbs[i] > 0.f ? nNumBins / maxAbs[i] : 0.f;
+				for (int j = 0; j < pBlob->count(); ++j) {
+					size_t nBin = (size_t)(std::fabs(pData[j]) * fBinScale);
+					++hist[std::min(nBin, nNumBins - 1)];
+				}
+			}
+		});
+
+	std::vector<BlobThreshold> thresholds(nNumBlobs);
+	ParallelFor(nNumBlobs, options.nNumThreads, [&](size_t i) {
+			auto &hist = hists[i];
+			for (size_t w = 1; w < nNumWorkers; ++w) {
+				auto &workerHist = hists[w * nNumBlobs + i];
+				for (size_t j = 0; j < nNumBins; ++j) {
+					hist[j] += workerHist[j];
+				}
+			}
+			size_t nBin = (options.strMethod == "kl") ? KLThresholdBin(hist) :
+					PercentileThresholdBin(hist, options.dPercentile);
+			thresholds[i] = {caffeNets[0]->blob_names()[i], maxAbs[i],
+					maxAbs[i] * nBin / nNumBins};
+		});
+	return thresholds;
+}
+
+void WriteCalibrationTable(const std::vector<BlobThreshold> &thresholds,
+		const std::string &strFn) {
+	std::ofstream outFile(strFn);
+	CHECK(outFile.is_open()) << strFn;
+	outFile << std::setprecision(9);
+	for (auto &threshold : thresholds) {
+		outFile << threshold.strBlob << " " << threshold.fThreshold << " " <<
+				threshold.fThreshold / 127.f << "\n";
+	}
+	CHECK(outFile.good()) << strFn;
+}
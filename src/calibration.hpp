@@ -0,0 +1,53 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Calibration of activation ranges for INT8 inference.
+*	The converted net is run by caffe on CPU over local sample tensors, the
+*	histograms of absolute values of every blob are collected and the
+*	thresholds are chosen by KL divergence or by a percentile.
+*
+*	Samples are .npy files (float32, C order) or raw float32 files, each one
+*	holds one or more batches of an input. For a net of a single input the
+*	files are directly in the sample directory, otherwise in sub-directories
+*	named by the inputs, and files of the same sorted order are fed together.
+*/
+
+#ifndef CALIBRATION_HPP_
+#define CALIBRATION_HPP_
+
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "model_writer.hpp"
+
+struct CalibrationOptions {
+	std::string strSampleDir;
+	std::string strMethod;	// "kl" or "percentile"
+	double dPercentile;		// of absolute values, in (0, 100]
+	size_t nNumBins;		// of histograms
+	size_t nNumThreads;		// 0 for all hardware threads
+};
+
+struct BlobThreshold {
+	std::string strBlob;
+	float fMaxAbs;
+	float fThreshold;		// scale of int8 is fThreshold / 127
+};
+
+// Runs the samples in parallel, each thread has its own caffe::Net sharing
+//	the weights. Blobs are calibrated by the values after the forward, so
+//	in-place layers are calibrated with their outputs.
+std::vector<BlobThreshold> CalibrateActivations(
+		const caffe::NetParameter &net, const CaffeWeights &weights,
+		const CalibrationOptions &options);
+
+// A line of "<blob> <threshold> <scale>" for each blob
+void WriteCalibrationTable(const std::vector<BlobThreshold> &thresholds,
+		const std::string &strFn);
+
+#endif /* CALIBRATION_HPP_ */
@@ -11,11 +11,14 @@
 #ifndef _COMMON_HPP
 #define _COMMON_HPP
 
+#include <map>
 #include <vector>
 #include <string>
 #include <utility>
 
 using Shape = std::vector<size_t>;
 using StringPair = std::pair<std::string, std::string>;
+using InputInfo = std::pair<std::string, Shape>;
+using BlobShapes = std::map<std::string, Shape>;
 
 #endif // _COMMON_HPP
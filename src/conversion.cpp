@@ -0,0 +1,314 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* The conversion of one model as configured by a config json
+*
+* Written by Devymex <yumengwang@deepglint.com>, Jan. 2019
+*/
+
+#include "conversion.hpp"
+
+#include <fstream>
+#include <map>
+#include <google/protobuf/arena.h>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "cost_model.hpp"
+#include "memory_planner.hpp"
+#include "model_writer.hpp"
+#include "mxnet_parser.hpp"
+#include "profiler.hpp"
+#include "prototxt_printer.hpp"
+#include "quantization.hpp"
+#include "verification.hpp"
+
+StringPair SplitString(std::string str, size_t nPos) {
+	if (nPos == 0) {
+		return std::make_pair(std::string(), std::move(str));
+	} else if (nPos >= str.size()) {
+		return std::make_pair(std::move(str), std::string());
+	}
+	return std::make_pair(str.substr(0, nPos),
+			str.substr(nPos, str.size() - nPos));
+}
+
+ProgramOptions ParseConfig(Json jConfig, const std::string &strWorkPath) {
+	ProgramOptions po = ProgramOptions();
+	po.strMxnetJson = strWorkPath + std::string(jConfig["mxnet_json"]);
+	po.strMxnetParams = strWorkPath + std::string(jConfig["mxnet_params"]);
+	po.strCaffeProto = strWorkPath + std::string(jConfig["caffe_prototxt"]);
+	std::string strCaffeModel = jConfig.value("caffe_caffemodel", "");
+	if (!strCaffeModel.empty()) {
+		po.strCaffeModel = strWorkPath + strCaffeModel;
+	}
+
+	Json::iterator jInputs = jConfig.find("inputs");
+	po.inputInfos = ParseArray<InputInfo>(jInputs,
+			[](Json::iterator iInput) -> InputInfo {
+				std::string strName = (*iInput)["name"];
+				CHECK(!strName.empty());
+				Json::iterator jShape = iInput->find("shape");
+				CHECK(jShape != iInput->end());
+				auto intShape = ParseArray<int>(jShape);
+				CHECK(!intShape.empty());
+				Shape shape;
+				for (auto s : intShape) {
+					CHECK_GT(s, 0);
+					shape.emplace_back(s);
+				}
+				return std::make_pair(strName, shape);
+			}
+		);
+	CHECK(!po.inputInfos.empty());
+	po.bReuseBlobs = jConfig.value("reuse_blobs", false);
+	int nNumThreads = jConfig.value("num_threads", 0);
+	CHECK_GE(nNumThreads, 0) << "Invalid num_threads";
+	po.nNumThreads = nNumThreads;
+	po.bVerify = jConfig.value("verify", false);
+	po.dVerifyTolerance = jConfig.value("verify_tolerance", 1e-4);
+	std::string strCaffeWeights = jConfig.value("caffe_weights", "");
+	if (!strCaffeWeights.empty()) {
+		CHECK(!po.strCaffeModel.empty()) << "caffe_weights without caffemodel";
+		po.strCaffeWeights = strWorkPath + strCaffeWeights;
+	}
+	std::string strInt8Weights = jConfig.value("caffe_int8_weights", "");
+	if (!strInt8Weights.empty()) {
+		po.strInt8Weights = strWorkPath + strInt8Weights;
+	}
+	std::string strSampleDir = jConfig.value("calibration_samples", "");
+	if (!strSampleDir.empty()) {
+		po.calibOptions.strSampleDir = strWorkPath + strSampleDir;
+	}
+	po.calibOptions.strMethod = jConfig.value("calibration_method", "kl");
+	po.calibOptions.dPercentile = jConfig.value("calibration_percentile",
+			99.99);
+	int nNumBins = jConfig.value("calibration_bins", 2048);
+	CHECK_GT(nNumBins, 0) << "Invalid calibration_bins";
+	po.calibOptions.nNumBins = nNumBins;
+	po.calibOptions.nNumThreads = po.nNumThreads;
+	CHECK(!po.strCaffeModel.empty() || !po.strInt8Weights.empty()) <<
+			"Neither caffe_caffemodel nor caffe_int8_weights is given";
+	return po;
+}
+
+ProgramOptions LoadConfig(const std::string &strConfFn) {
+	std::ifstream configFile(strConfFn);
+	CHECK(configFile.is_open()) << strConfFn;
+	Json jConfig;
+	configFile >> jConfig;
+	configFile.close();
+	return ParseConfig(std::move(jConfig), DirectoryOf(strConfFn));
+}
+
+std::string DirectoryOf(const std::string &strFn) {
+	auto pathAndName = SplitString(strFn, strFn.find_last_of("\\/") + 1);
+	if (pathAndName.second.empty()) {
+		return std::string();
+	}
+	return pathAndName.first;
+}
+
+std::string ReplaceExtension(const std::string &strProtoFn,
+		const std::string &strExt) {
+	size_t nDot = strProtoFn.find_last_of(".");
+	size_t nSlash = strProtoFn.find_last_of("\\/");
+	if (nDot == std::string::npos ||
+			(nSlash != std::string::npos && nDot < nSlash)) {
+		nDot = strProtoFn.size();
+	}
+	return strProtoFn.substr(0, nDot) + strExt;
+}
+
+std::string GenerateModelName(std::string strProtoFn) {
+	auto pathAndName = SplitString(strProtoFn,
+			strProtoFn.find_last_of("\\/") + 1);
+	if (pathAndName.second.empty()) {
+		std::swap(pathAndName.first, pathAndName.second);
+	}
+	strProtoFn = pathAndName.second;
+	auto nameAndExt = SplitString(strProtoFn, strProtoFn.find_last_of("."));
+	if (nameAndExt.first.empty()) {
+		std::swap(nameAndExt.first, nameAndExt.second);
+	}
+	return nameAndExt.first;
+}
+
+MxnetModel LoadMxnetModel(const std::string &strJsonFn,
+		const std::string &strParamsFn) {
+	MxnetModel model;
+	{
+		ProfileScope scope("parse_json");
+		auto mxnetParseResult = ParseMxnetJson(strJsonFn);
+		model.nodes = std::move(mxnetParseResult.first);
+		model.heads = std::move(mxnetParseResult.second);
+	}
+	{
+		ProfileScope scope("load_params");
+		model.params = LoadMxnetParam(strParamsFn);
+	}
+	return model;
+}
+
+void ConvertModel(const ProgramOptions &po) {
+	if (po.analysis.bProfile) {
+		StartProfiling();
+	}
+	ConvertLoadedModel(po, LoadMxnetModel(po.strMxnetJson, po.strMxnetParams));
+}
+
+void ConvertLoadedModel(const ProgramOptions &po, const MxnetModel &model) {
+	auto &analysis = po.analysis;
+	if (analysis.bProfile && !IsProfiling()) {
+		StartProfiling();
+	}
+	auto &mxnetNodes = model.nodes;
+	auto &mxnetParams = model.params;
+	std::map<std::string, std::vector<std::string>> blobMapping;
+	BlobShapes blobShapes;
+	std::vector<NodeBlobs> nodeBlobs;
+	// Arenas are available to all messages since protobuf 3.14
+#if GOOGLE_PROTOBUF_VERSION >= 3014000
+	google::protobuf::Arena arena;
+	auto &protoNet = *google::protobuf::Arena::CreateMessage<
+			caffe::NetParameter>(&arena);
+#else
+	caffe::NetParameter protoNet;
+#endif
+	{
+		ProfileScope scope("convert");
+		// Nodes of MxNet are in topological order, which the layers keep,
+		//	so they are not sorted from the heads
+		MxnetNodes2CaffeNet(mxnetNodes, {}, po.inputInfos, blobMapping,
+				blobShapes, nodeBlobs, protoNet);
+	}
+	protoNet.set_name(GenerateModelName(po.strCaffeProto));
+
+	{
+		ProfileScope scope("plan_memory");
+		LOG(INFO) << "Activation memory: " << FormatMemoryReport(
+				PlanActivationMemory(protoNet, blobShapes));
+		if (po.bReuseBlobs) {
+			auto blobRenames = ReuseDeadBlobs(protoNet, blobShapes);
+			RenameNodeBlobs(nodeBlobs, blobRenames);
+			LOG(INFO) << "Activation memory after reusing " <<
+					blobRenames.size() << " dead blobs: " << FormatMemoryReport(
+							PlanActivationMemory(protoNet, blobShapes));
+		}
+	}
+
+	if (analysis.bCostModel) {
+		ProfileScope scope("cost_model");
+		auto costs = EstimateLayerCosts(protoNet, blobShapes);
+		std::string strReportFn = ReplaceExtension(po.strCaffeProto,
+				".cost.json");
+		WriteCostReport(costs, strReportFn);
+		LOG(INFO) << "Cost of layers, written to " << strReportFn << ":\n" <<
+				FormatLayerCosts(costs);
+		LOG(INFO) << "Cost by type of layers:\n" << FormatCostSummary(costs);
+	}
+
+	{
+		ProfileScope scope("write_prototxt");
+		std::ofstream protoFile(po.strCaffeProto);
+		CHECK(protoFile.is_open()) << po.strCaffeProto;
+		PrintNetPrototxt(protoNet, protoFile);
+		protoFile.close();
+	}
+
+	CaffeWeights caffeWeights;
+	{
+		ProfileScope scope("bind_weights");
+		caffeWeights = BindCaffeWeights(protoNet, blobMapping, mxnetParams,
+				blobShapes);
+	}
+	if (!po.strCaffeModel.empty()) {
+		ProfileScope scope("write_caffemodel");
+		WriteCaffeModel(protoNet, caffeWeights, po.strCaffeModel,
+				po.strCaffeWeights, po.nNumThreads);
+	}
+	if (!po.strInt8Weights.empty()) {
+		ProfileScope scope("quantize_int8");
+		auto quantized = QuantizeWeights(protoNet, caffeWeights,
+				po.nNumThreads);
+		LOG(INFO) << "Int8 quantization errors:\n" <<
+				FormatQuantizationReport(protoNet, quantized);
+		WriteInt8Weights(protoNet, caffeWeights, quantized, po.strInt8Weights);
+	}
+	if (!po.calibOptions.strSampleDir.empty()) {
+		ProfileScope scope("calibrate");
+		auto thresholds = CalibrateActivations(protoNet, caffeWeights,
+				po.calibOptions);
+		std::string strTableFn = ReplaceExtension(po.strCaffeProto,
+				".calibtable");
+		WriteCalibrationTable(thresholds, strTableFn);
+		LOG(INFO) << "Calibration table of " << thresholds.size() <<
+				" blobs written to " << strTableFn;
+	}
+	if (po.bVerify) {
+		ProfileScope scope("verify");
+		auto inputs = RandomInputs(mxnetNodes, po.inputInfos, 0);
+		auto result = VerifyConversion(mxnetNodes, model.heads, mxnetParams,
+				nodeBlobs, protoNet, caffeWeights, inputs, po.nNumThreads);
+		LOG(INFO) << "Errors of layers to MxNet:\n" <<
+				FormatErrorTable(result.layers, po.dVerifyTolerance);
+		LOG(INFO) << "Errors of outputs to MxNet:\n" <<
+				FormatErrorTable(result.outputs, po.dVerifyTolerance);
+		size_t nFirst = FirstExceeding(result.layers, po.dVerifyTolerance);
+		if (nFirst < result.layers.size()) {
+			auto &error = result.layers[nFirst];
+			LOG(WARNING) << "Layer " << error.strLayer << " is the first to " <<
+					"exceed the relative error " << po.dVerifyTolerance <<
+					", on the output of node " << error.strNode;
+		} else if (FirstExceeding(result.outputs, po.dVerifyTolerance) <
+				result.outputs.size()) {
+			LOG(WARNING) << "Outputs exceed the relative error " <<
+					po.dVerifyTolerance;
+		}
+	}
+
+	if (analysis.bBenchmark) {
+		ProfileScope scope("benchmark");
+		auto results = BenchmarkForward(protoNet, caffeWeights,
+				analysis.benchOptions);
+		std::string strReportFn = ReplaceExtension(po.strCaffeProto,
+				".benchmark.json");
+		WriteBenchmarkReport(results, strReportFn);
+		LOG(INFO) << "Forward latency on CPU, written to " << strReportFn <<
+				":\n" << FormatBenchmarkReport(results);
+		// Layer times are the same for all thread counts of a batch size
+		auto costs = EstimateLayerCosts(protoNet, blobShapes);
+		std::vector<RooflineReport> rooflines;
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (i == 0 || results[i].nBatchSize != results[i - 1].nBatchSize) {
+				LOG(INFO) << "Forward time of layers at batch size " <<
+						results[i].nBatchSize << ":\n" <<
+						FormatLayerTimes(results[i]);
+				rooflines.push_back(CompareWithCosts(costs,
+						po.inputInfos.front().second.front(), results[i],
+						analysis.rooflinePeaks, analysis.dRooflineThreshold));
+			}
+		}
+		std::string strRooflineFn = ReplaceExtension(po.strCaffeProto,
+				".roofline.json");
+		WriteRooflineReports(rooflines, strRooflineFn);
+		for (auto &roofline : rooflines) {
+			LOG(INFO) << "Measured against predicted time of layers, " <<
+					"written to " << strRooflineFn << ":\n" <<
+					FormatRooflineReport(roofline);
+		}
+	}
+
+	if (analysis.bProfile) {
+		std::string strReportFn = ReplaceExtension(po.strCaffeProto,
+				".profile.json");
+		std::string strTraceFn = ReplaceExtension(po.strCaffeProto,
+				".trace.json");
+		WriteProfileReport(strReportFn);
+		WriteChromeTrace(strTraceFn);
+		LOG(INFO) << "Profile of stages, written to " << strReportFn <<
+				" and " << strTraceFn << ":\n" << FormatProfileReport();
+	}
+}
@@ -0,0 +1,87 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* The conversion of one model as configured by a config json, from parsing
+*	the MxNet files to writing the caffe files and the optional reports.
+*	Used by the command line, for one config or a batch of them.
+*
+* Written by Devymex <yumengwang@deepglint.com>, Jan. 2019
+*/
+
+#ifndef CONVERSION_HPP_
+#define CONVERSION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "calibration.hpp"
+#include "common.hpp"
+#include "json_helper.hpp"
+#include "mxnet_parser.hpp"
+#include "roofline.hpp"
+
+// Reports given by the flags of the command line rather than the config
+struct AnalysisOptions {
+	bool bProfile;
+	bool bCostModel;
+	bool bBenchmark;
+	BenchmarkOptions benchOptions;
+	RooflinePeaks rooflinePeaks;
+	double dRooflineThreshold;
+};
+
+struct ProgramOptions {
+	std::string strMxnetJson;
+	std::string strMxnetParams;
+	std::string strCaffeProto;
+	std::string strCaffeModel;
+	std::string strCaffeWeights;
+	std::string strInt8Weights;
+	std::vector<InputInfo> inputInfos;
+	CalibrationOptions calibOptions;
+	bool bReuseBlobs;
+	bool bVerify;
+	double dVerifyTolerance;
+	size_t nNumThreads;
+	AnalysisOptions analysis;
+};
+
+// Options of a config json, the files in it are relative to strWorkPath.
+//	No analysis is enabled.
+ProgramOptions ParseConfig(Json jConfig, const std::string &strWorkPath);
+
+// Options of a config json file, the files in it are relative to the path of
+//	the config
+ProgramOptions LoadConfig(const std::string &strConfFn);
+
+// Path of strFn, with the trailing slash, empty for the current path
+std::string DirectoryOf(const std::string &strFn);
+
+// Files written next to the prototxt, with its extension replaced
+std::string ReplaceExtension(const std::string &strProtoFn,
+		const std::string &strExt);
+
+// Name of the file without path and extension
+std::string GenerateModelName(std::string strProtoFn);
+
+// The parsed json and the mapped params of a model, which may be kept to
+//	convert the model again
+struct MxnetModel {
+	std::vector<MxnetNode> nodes;
+	std::vector<MxnetInput> heads;
+	std::vector<MxnetParam> params;
+};
+
+MxnetModel LoadMxnetModel(const std::string &strJsonFn,
+		const std::string &strParamsFn);
+
+// Converts the model and writes all files and reports of the options
+void ConvertModel(const ProgramOptions &po);
+
+// Same as ConvertModel, with the MxNet files of the options already loaded
+void ConvertLoadedModel(const ProgramOptions &po, const MxnetModel &model);
+
+#endif /* CONVERSION_HPP_ */
@@ -0,0 +1,614 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* A long-running daemon converting the jobs of local clients
+*/
+
+#include "conversion_daemon.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "batch_conversion.hpp"
+#include "daemon_protocol.hpp"
+#include "worker_pool.hpp"
+
+// Requests longer than this are refused
+const size_t MAX_REQUEST_BYTES = 16 << 20;
+
+// Clients with more events not read are dropped
+const size_t MAX_OUTGOING_BYTES = 16 << 20;
+
+struct FileStamp {
+	size_t nBytes;
+	int64_t nMtimeNs;	// -1 if the file can not be found
+};
+
+FileStamp StampOfFile(const std::string &strFn) {
+	struct stat fileStat;
+	if (stat(strFn.c_str(), &fileStat) != 0) {
+		return {0, -1};
+	}
+	return {(size_t)fileStat.st_size, (int64_t)fileStat.st_mtim.tv_sec *
+			1000000000 + fileStat.st_mtim.tv_nsec};
+}
+
+bool IsSameFile(const FileStamp &stamp1, const FileStamp &stamp2) {
+	return stamp1.nMtimeNs >= 0 && stamp1.nMtimeNs == stamp2.nMtimeNs &&
+			stamp1.nBytes == stamp2.nBytes;
+}
+
+// Models loaded by the daemon, the most recently used first. A model is
+//	loaded by a thread, so that the daemon goes on serving the clients,
+//	after a forked child has loaded it without failing. A load failing, or
+//	of files changed meanwhile, only leaves it uncached.
+class ModelCache {
+public:
+	explicit ModelCache(size_t nCapacity);
+	~ModelCache();
+	// The model of the files if kept and the files are unchanged since
+	std::shared_ptr<const MxnetModel> Find(const std::string &strJsonFn,
+			const std::string &strParamsFn);
+	// Starts loading the files if they are unchanged since the stamps, and
+	//	no other files are being loaded
+	void StartLoading(const std::string &strJsonFn,
+			const std::string &strParamsFn, const FileStamp &jsonStamp,
+			const FileStamp &paramsStamp);
+	bool IsLoading() const;
+	// Readable when the loading is done
+	int NotifyFd() const;
+	// Keeps the loaded model, called when NotifyFd is readable
+	void FinishLoading();
+private:
+	struct Entry {
+		std::string strJsonFn;
+		std::string strParamsFn;
+		FileStamp jsonStamp;
+		FileStamp paramsStamp;
+		std::shared_ptr<const MxnetModel> pModel;
+	};
+	size_t m_nCapacity;
+	std::list<Entry> m_entries;
+	int m_notifyFds[2];
+	std::thread m_loader;
+	Entry m_loading;			// model is null if the load failed
+	std::string m_strError;
+};
+
+ModelCache::ModelCache(size_t nCapacity) : m_nCapacity(nCapacity) {
+	CHECK_EQ(pipe2(m_notifyFds, O_CLOEXEC), 0) << strerror(errno);
+}
+
+ModelCache::~ModelCache() {
+	if (m_loader.joinable()) {
+		m_loader.join();
+	}
+	close(m_notifyFds[0]);
+	close(m_notifyFds[1]);
+}
+
+std::shared_ptr<const MxnetModel> ModelCache::Find(
+		const std::string &strJsonFn, const std::string &strParamsFn) {
+	for (auto iEntry = m_entries.begin(); iEntry != m_entries.end();
+			++iEntry) {
+		if (iEntry->strJsonFn != strJsonFn ||
+				iEntry->strParamsFn != strParamsFn) {
+			continue;
+		}
+		if (!IsSameFile(iEntry->jsonStamp, StampOfFile(strJsonFn)) ||
+				!IsSameFile(iEntry->paramsStamp, StampOfFile(strParamsFn))) {
+			m_entries.erase(iEntry);
+			return nullptr;
+		}
+		m_entries.splice(m_entries.begin(), m_entries, iEntry);
+		return iEntry->pModel;
+	}
+	return nullptr;
+}
+
+void ModelCache::StartLoading(const std::string &strJsonFn,
+		const std::string &strParamsFn, const FileStamp &jsonStamp,
+		const FileStamp &paramsStamp) {
+	if (m_nCapacity == 0 || IsLoading() ||
+			!IsSameFile(jsonStamp, StampOfFile(strJsonFn)) ||
+			!IsSameFile(paramsStamp, StampOfFile(strParamsFn))) {
+		return;
+	}
+	// A check of the parser failing on files changed since the worker
+	//	would end the daemon, a child loads them first. The loader thread
+	//	loads them again if the child succeeded and they are unchanged.
+	m_loading = {strJsonFn, strParamsFn, jsonStamp, paramsStamp, nullptr};
+	m_strError.clear();
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(nullptr);
+	pid_t nPid = fork();
+	CHECK_GE(nPid, 0) << "Failed to fork: " << strerror(errno);
+	if (nPid == 0) {
+		LoadMxnetModel(m_loading.strJsonFn, m_loading.strParamsFn);
+		_exit(0);
+	}
+	m_loader = std::thread([this, nPid]() {
+			int nStatus = 0;
+			while (waitpid(nPid, &nStatus, 0) < 0 && errno == EINTR) {
+				// interrupted by a signal
+			}
+			if (!WIFEXITED(nStatus) || WEXITSTATUS(nStatus) != 0) {
+				m_strError = DescribeExitStatus(nStatus);
+			} else if (IsSameFile(m_loading.jsonStamp,
+					StampOfFile(m_loading.strJsonFn)) &&
+					IsSameFile(m_loading.paramsStamp,
+					StampOfFile(m_loading.strParamsFn))) {
+				try {
+					m_loading.pModel = std::make_shared<MxnetModel>(
+							LoadMxnetModel(m_loading.strJsonFn,
+							m_loading.strParamsFn));
+				} catch (const std::exception &e) {
+					m_strError = e.what();
+				}
+			}
+			char cDone = 0;
+			while (write(m_notifyFds[1], &cDone, 1) < 0 && errno == EINTR) {
+				// interrupted by a signal
+			}
+		});
+}
+
+bool ModelCache::IsLoading() const {
+	return m_loader.joinable();
+}
+
+int ModelCache::NotifyFd() const {
+	return m_notifyFds[0];
+}
+
+void ModelCache::FinishLoading() {
+	char cDone;
+	if (read(m_notifyFds[0], &cDone, 1) != 1) {
+		return;
+	}
+	m_loader.join();
+	Entry loaded = std::move(m_loading);
+	m_loading = Entry();
+	if (loaded.pModel == nullptr ||
+			!IsSameFile(loaded.jsonStamp, StampOfFile(loaded.strJsonFn)) ||
+			!IsSameFile(loaded.paramsStamp,
+			StampOfFile(loaded.strParamsFn))) {
+		LOG(WARNING) << "Not caching " << loaded.strJsonFn << ": " <<
+				(m_strError.empty() ? "files changed" : m_strError);
+		return;
+	}
+	for (auto iEntry = m_entries.begin(); iEntry != m_entries.end(); ) {
+		bool bSame = iEntry->strJsonFn == loaded.strJsonFn &&
+				iEntry->strParamsFn == loaded.strParamsFn;
+		iEntry = bSame ? m_entries.erase(iEntry) : std::next(iEntry);
+	}
+	m_entries.push_front(std::move(loaded));
+	if (m_entries.size() > m_nCapacity) {
+		m_entries.pop_back();
+	}
+}
+
+struct DaemonJob {
+	size_t nClientId;
+	Json jConfig;
+	std::string strWorkPath;
+	std::vector<std::string> args;
+	std::string strJsonFn;
+	std::string strParamsFn;
+	size_t nEstimatedBytes;
+};
+
+// The job of a request, false with the error if it is not one
+bool ParseDaemonJob(const std::string &strRequest, DaemonJob &job,
+		std::string &strError) {
+	Json jRequest = Json::parse(strRequest, nullptr, false);
+	if (!jRequest.is_object()) {
+		strError = "The job is not a json object";
+		return false;
+	}
+	auto iWorkPath = jRequest.find("work_path");
+	if (iWorkPath != jRequest.end()) {
+		if (!iWorkPath->is_string()) {
+			strError = "work_path is not a string";
+			return false;
+		}
+		job.strWorkPath = iWorkPath->get<std::string>();
+		if (!job.strWorkPath.empty() && job.strWorkPath.back() != '/') {
+			job.strWorkPath += "/";
+		}
+	}
+	auto iArgs = jRequest.find("args");
+	if (iArgs != jRequest.end()) {
+		if (!iArgs->is_array()) {
+			strError = "args is not an array";
+			return false;
+		}
+		for (auto &jArg : *iArgs) {
+			if (!jArg.is_string()) {
+				strError = "args are not strings";
+				return false;
+			}
+			job.args.push_back(jArg.get<std::string>());
+		}
+	}
+	for (auto *pKey : {"mxnet_json", "mxnet_params", "caffe_prototxt"}) {
+		auto iValue = jRequest.find(pKey);
+		if (iValue == jRequest.end() || !iValue->is_string()) {
+			strError = std::string(pKey) + " is not given";
+			return false;
+		}
+	}
+	job.strJsonFn = job.strWorkPath +
+			jRequest["mxnet_json"].get<std::string>();
+	job.strParamsFn = job.strWorkPath +
+			jRequest["mxnet_params"].get<std::string>();
+	job.nEstimatedBytes = EstimateConversionBytes(jRequest, job.strWorkPath);
+	job.jConfig = std::move(jRequest);
+	return true;
+}
+
+Json DoneEvent(bool bSucceeded, const std::string &strError,
+		double dWallSeconds, double dCpuSeconds, size_t nPeakRss) {
+	return {{"event", "done"}, {"succeeded", bSucceeded},
+			{"error", strError}, {"wall_seconds", dWallSeconds},
+			{"cpu_seconds", dCpuSeconds}, {"peak_rss_bytes", nPeakRss}};
+}
+
+class ConversionDaemon {
+public:
+	ConversionDaemon(const DaemonOptions &options,
+			const JobFlagsParser &parseFlags);
+	void Serve();
+private:
+	// Connection of a client, its events are queued until the socket takes
+	//	them, so that a client not reading does not stall the daemon
+	struct Client {
+		int nFd;
+		LineBuffer request;
+		bool bRequested;		// the job is read, nothing more is
+		bool bDone;				// closed once the events are sent
+		std::string strOutgoing;
+	};
+	struct RunningJob {
+		DaemonJob job;
+		int nPipeFd;
+		LineBuffer output;
+		std::string strError;	// last fatal line of the output
+		FileStamp jsonStamp;
+		FileStamp paramsStamp;
+		bool bCached;
+	};
+	void AcceptClient();
+	void ReadRequest(size_t nClientId);
+	// Events to a client which is gone are dropped, its job goes on
+	void SendEvent(size_t nClientId, const Json &jEvent);
+	void SendLastEvent(size_t nClientId, const Json &jEvent);
+	void FlushClient(size_t nClientId);
+	void CloseClient(size_t nClientId);
+	void StartJobs();
+	void RunWorker(const DaemonJob &job, const MxnetModel *pModel,
+			int nPipeFd, int nOutputFd);
+	void ReadOutput(pid_t nPid);
+	void ForwardLine(RunningJob &running, const std::string &strLine);
+	void FinishJob(pid_t nPid);
+
+	const DaemonOptions &m_options;
+	const JobFlagsParser &m_parseFlags;
+	WorkerPool m_pool;
+	int m_nListenFd;
+	ModelCache m_cache;
+	size_t m_nNextClientId;
+	std::map<size_t, Client> m_clients;
+	std::deque<DaemonJob> m_queuedJobs;
+	std::map<pid_t, RunningJob> m_runningJobs;
+};
+
+ConversionDaemon::ConversionDaemon(const DaemonOptions &options,
+		const JobFlagsParser &parseFlags)
+		: m_options(options), m_parseFlags(parseFlags),
+		m_pool(options.nNumJobs, options.nMemoryBudget),
+		m_nListenFd(-1), m_cache(options.nNumCachedModels),
+		m_nNextClientId(0) {
+}
+
+void ConversionDaemon::Serve() {
+	m_nListenFd = ListenUnixSocket(m_options.strSocketFn);
+	LOG(INFO) << "Listening on " << m_options.strSocketFn << ", " <<
+			m_pool.NumJobs() << " jobs at a time within " <<
+			(m_pool.Budget() >> 20) << " MB";
+	for (;;) {
+		StartJobs();
+		// Clients are polled for hang-ups even if nothing is to be done
+		std::vector<pollfd> pollFds = {{m_nListenFd, POLLIN, 0}};
+		std::vector<size_t> clientIds;
+		for (auto &client : m_clients) {
+			short nEvents = client.second.bRequested ? 0 : POLLIN;
+			if (!client.second.strOutgoing.empty()) {
+				nEvents |= POLLOUT;
+			}
+			pollFds.push_back({client.second.nFd, nEvents, 0});
+			clientIds.push_back(client.first);
+		}
+		std::vector<pid_t> workerPids;
+		for (auto &running : m_runningJobs) {
+			pollFds.push_back({running.second.nPipeFd, POLLIN, 0});
+			workerPids.push_back(running.first);
+		}
+		bool bLoading = m_cache.IsLoading();
+		if (bLoading) {
+			pollFds.push_back({m_cache.NotifyFd(), POLLIN, 0});
+		}
+		if (poll(pollFds.data(), pollFds.size(), -1) < 0) {
+			CHECK_EQ(errno, EINTR) << strerror(errno);
+			continue;
+		}
+		// Clients may be closed by the events of the workers, they are
+		//	looked up by their ids
+		size_t nNumClients = clientIds.size();
+		for (size_t i = 0; i < workerPids.size(); ++i) {
+			if (pollFds[1 + nNumClients + i].revents != 0) {
+				ReadOutput(workerPids[i]);
+			}
+		}
+		for (size_t i = 0; i < nNumClients; ++i) {
+			short nRevents = pollFds[1 + i].revents;
+			auto iClient = m_clients.find(clientIds[i]);
+			if (nRevents == 0 || iClient == m_clients.end()) {
+				continue;
+			}
+			if (!iClient->second.bRequested) {
+				ReadRequest(clientIds[i]);
+			} else if (nRevents & POLLOUT) {
+				FlushClient(clientIds[i]);
+			} else if (nRevents & (POLLHUP | POLLERR)) {
+				CloseClient(clientIds[i]);
+			}
+		}
+		if (pollFds[0].revents != 0) {
+			AcceptClient();
+		}
+		if (bLoading && pollFds.back().revents != 0) {
+			m_cache.FinishLoading();
+		}
+	}
+}
+
+void ConversionDaemon::AcceptClient() {
+	int nFd = accept4(m_nListenFd, nullptr, nullptr,
+			SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (nFd < 0) {
+		LOG(WARNING) << "Failed to accept a client: " << strerror(errno);
+		return;
+	}
+	m_clients[m_nNextClientId++] = {nFd, LineBuffer(), false, false, ""};
+}
+
+void ConversionDaemon::ReadRequest(size_t nClientId) {
+	auto &client = m_clients.at(nClientId);
+	char buf[65536];
+	ssize_t nRead = recv(client.nFd, buf, sizeof(buf), 0);
+	if (nRead < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+	if (nRead <= 0) {
+		CloseClient(nClientId);
+		return;
+	}
+	client.request.Append(buf, nRead);
+	std::string strRequest;
+	bool bComplete = client.request.PopLine(strRequest);
+	if (!bComplete && client.request.Size() <= MAX_REQUEST_BYTES) {
+		return;
+	}
+	client.bRequested = true;
+	client.request = LineBuffer();
+
+	DaemonJob job;
+	std::string strError = "The job is too large";
+	if (!bComplete || !ParseDaemonJob(strRequest, job, strError)) {
+		SendLastEvent(nClientId, DoneEvent(false, strError, 0., 0., 0));
+		return;
+	}
+	job.nClientId = nClientId;
+	SendEvent(nClientId, {{"event", "queued"},
+			{"position", m_queuedJobs.size()}});
+	m_queuedJobs.emplace_back(std::move(job));
+}
+
+void ConversionDaemon::SendEvent(size_t nClientId, const Json &jEvent) {
+	auto iClient = m_clients.find(nClientId);
+	if (iClient == m_clients.end()) {
+		return;
+	}
+	auto &strOutgoing = iClient->second.strOutgoing;
+	strOutgoing += jEvent.dump() + "\n";
+	if (strOutgoing.size() > MAX_OUTGOING_BYTES) {
+		LOG(WARNING) << "Dropped a client not reading its events";
+		CloseClient(nClientId);
+		return;
+	}
+	FlushClient(nClientId);
+}
+
+// The client is closed after the event is sent
+void ConversionDaemon::SendLastEvent(size_t nClientId, const Json &jEvent) {
+	auto iClient = m_clients.find(nClientId);
+	if (iClient != m_clients.end()) {
+		iClient->second.bDone = true;
+		SendEvent(nClientId, jEvent);
+	}
+}
+
+void ConversionDaemon::FlushClient(size_t nClientId) {
+	auto &client = m_clients.at(nClientId);
+	auto &strOutgoing = client.strOutgoing;
+	size_t nSent = 0;
+	while (nSent < strOutgoing.size()) {
+		ssize_t nRet = send(client.nFd, strOutgoing.data() + nSent,
+				strOutgoing.size() - nSent, MSG_NOSIGNAL);
+		if (nRet < 0 && errno == EINTR) {
+			continue;
+		} else if (nRet < 0 && errno == EAGAIN) {
+			break;
+		} else if (nRet <= 0) {
+			CloseClient(nClientId);
+			return;
+		}
+		nSent += nRet;
+	}
+	strOutgoing.erase(0, nSent);
+	if (strOutgoing.empty() && client.bDone) {
+		CloseClient(nClientId);
+	}
+}
+
+void ConversionDaemon::CloseClient(size_t nClientId) {
+	auto iClient = m_clients.find(nClientId);
+	close(iClient->second.nFd);
+	m_clients.erase(iClient);
+}
+
+void ConversionDaemon::StartJobs() {
+	// A worker forked while a model is loaded would inherit the locks held
+	//	by the loading thread, jobs wait for the load
+	if (m_cache.IsLoading()) {
+		return;
+	}
+	// Jobs start in order, as long as the pool takes them
+	while (!m_queuedJobs.empty() &&
+			m_pool.CanStart(m_queuedJobs.front().nEstimatedBytes)) {
+		RunningJob running;
+		running.job = std::move(m_queuedJobs.front());
+		m_queuedJobs.pop_front();
+		auto &job = running.job;
+		auto pModel = m_cache.Find(job.strJsonFn, job.strParamsFn);
+		running.bCached = pModel != nullptr;
+		running.jsonStamp = StampOfFile(job.strJsonFn);
+		running.paramsStamp = StampOfFile(job.strParamsFn);
+
+		int pipeFds[2];
+		CHECK_EQ(pipe2(pipeFds, O_CLOEXEC), 0) << strerror(errno);
+		pid_t nPid = m_pool.Start(job.nEstimatedBytes, [&]() {
+				RunWorker(job, pModel.get(), pipeFds[0], pipeFds[1]);
+			});
+		close(pipeFds[1]);
+		running.nPipeFd = pipeFds[0];
+		SendEvent(job.nClientId, {{"event", "started"},
+				{"cached", running.bCached}});
+		m_runningJobs.emplace(nPid, std::move(running));
+	}
+}
+
+void ConversionDaemon::RunWorker(const DaemonJob &job,
+		const MxnetModel *pModel, int nPipeFd, int nOutputFd) {
+	// Connections of the daemon are not the business of the worker
+	close(m_nListenFd);
+	for (auto &client : m_clients) {
+		close(client.second.nFd);
+	}
+	for (auto &running : m_runningJobs) {
+		close(running.second.nPipeFd);
+	}
+	close(nPipeFd);
+	dup2(nOutputFd, STDOUT_FILENO);
+	dup2(nOutputFd, STDERR_FILENO);
+	close(nOutputFd);
+
+	auto analysis = m_parseFlags(job.args);
+	auto po = ParseConfig(job.jConfig, job.strWorkPath);
+	po.analysis = analysis;
+	if (po.nNumThreads == 0) {
+		po.nNumThreads = m_pool.NumThreads();
+		po.calibOptions.nNumThreads = m_pool.NumThreads();
+	}
+	if (pModel != nullptr) {
+		ConvertLoadedModel(po, *pModel);
+	} else {
+		ConvertModel(po);
+	}
+}
+
+void ConversionDaemon::ReadOutput(pid_t nPid) {
+	auto &running = m_runningJobs.at(nPid);
+	char buf[65536];
+	ssize_t nRead = read(running.nPipeFd, buf, sizeof(buf));
+	if (nRead < 0 && errno == EINTR) {
+		return;
+	}
+	if (nRead > 0) {
+		running.output.Append(buf, nRead);
+		std::string strLine;
+		while (running.output.PopLine(strLine)) {
+			ForwardLine(running, strLine);
+		}
+		return;
+	}
+	// The pipe is closed as the worker exits
+	std::string strRest = running.output.PopRest();
+	if (!strRest.empty()) {
+		ForwardLine(running, strRest);
+	}
+	FinishJob(nPid);
+}
+
+void ConversionDaemon::ForwardLine(RunningJob &running,
+		const std::string &strLine) {
+	if (IsFatalLogLine(strLine)) {
+		running.strError = strLine;
+	}
+	SendEvent(running.job.nClientId, {{"event", "log"}, {"line", strLine}});
+}
+
+void ConversionDaemon::FinishJob(pid_t nPid) {
+	auto iRunning = m_runningJobs.find(nPid);
+	auto &running = iRunning->second;
+	auto &job = running.job;
+	close(running.nPipeFd);
+	pid_t nExitedPid = -1;
+	WorkerExit exit;
+	while (!m_pool.Wait(nPid, nExitedPid, exit)) {
+		// interrupted by a signal
+	}
+	bool bSucceeded = exit.bSucceeded;
+	if (bSucceeded) {
+		running.strError.clear();
+	} else if (running.strError.empty()) {
+		running.strError = DescribeExitStatus(exit.nStatus);
+	}
+	SendLastEvent(job.nClientId, DoneEvent(bSucceeded, running.strError,
+			exit.dWallSeconds, exit.dCpuSeconds, exit.nPeakRss));
+	LOG(INFO) << (bSucceeded ? "Converted " : "Failed to convert ") <<
+			job.strJsonFn << (running.bCached ? " from the cache" : "") <<
+			" in " << std::fixed << std::setprecision(2) << exit.dWallSeconds <<
+			" s" << (bSucceeded ? "" : ": " + running.strError);
+	// Files converted by a worker are safe to load in the daemon
+	if (bSucceeded && !running.bCached) {
+		m_cache.StartLoading(job.strJsonFn, job.strParamsFn,
+				running.jsonStamp, running.paramsStamp);
+	}
+	m_runningJobs.erase(iRunning);
+}
+
+void RunConversionDaemon(const DaemonOptions &options,
+		const JobFlagsParser &parseFlags) {
+	ConversionDaemon daemon(options, parseFlags);
+	daemon.Serve();
+}
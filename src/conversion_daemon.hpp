@@ -0,0 +1,47 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* A long-running daemon converting the jobs of local clients.
+*	Jobs come over a Unix domain socket (daemon_protocol.hpp) and are queued
+*	in order. As in batch_conversion.hpp, each job is converted by a worker
+*	forked from the daemon, up to a number of jobs and a memory budget, so
+*	a job costs no start of the libraries and a job failing a check does not
+*	stop the daemon. The output of the worker is streamed to the client
+*	line by line, queued for each client without blocking the daemon; a
+*	client leaving too much of it unread is dropped.
+*	The parsed json and the mapped params of the models converted last are
+*	kept by the daemon and inherited by the workers of later jobs of the
+*	same files, until the files change. A model is kept only after a worker
+*	has converted it, and is loaded by the daemon only after a forked child
+*	has loaded it again, so that files changed meanwhile and failing a check
+*	of the parser end the child and not the daemon. Files changing while
+*	the daemon loads them right after are not covered.
+*/
+
+#ifndef CONVERSION_DAEMON_HPP_
+#define CONVERSION_DAEMON_HPP_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "conversion.hpp"
+
+struct DaemonOptions {
+	std::string strSocketFn;
+	size_t nNumJobs;		// jobs converted concurrently, 0 for all cores
+	size_t nMemoryBudget;	// bytes, 0 for 3/4 of the physical memory
+	size_t nNumCachedModels;
+};
+
+// Options of analysis from the flags of a job, called in its worker
+using JobFlagsParser = std::function<AnalysisOptions(
+		const std::vector<std::string> &args)>;
+
+// Serves the jobs of clients until the process is killed
+void RunConversionDaemon(const DaemonOptions &options,
+		const JobFlagsParser &parseFlags);
+
+#endif /* CONVERSION_DAEMON_HPP_ */
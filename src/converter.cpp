@@ -14,84 +14,71 @@
 #include <algorithm>
 #include <functional>
 #include <numeric>
+#include <set>
+#include <unordered_map>
 
 #define CPU_ONLY
 #include <caffe/caffe.hpp>
 #include <glog/logging.h>
 
-#include "istream_helper.hpp"
-
-template<typename _Ty>
-_Ty Str2Num(std::string str, _Ty _min = std::numeric_limits<_Ty>::min(),
-		_Ty _max = std::numeric_limits<_Ty>::max()) {
-	CHECK(!str.empty());
-	std::istringstream iss(str);
-	_Ty val;
-	CHECK(iss >> val);
-	CHECK_GE(val, _min);
-	CHECK_LE(val, _max);
-	return val;
-}
+#include "profiler.hpp"
+#include "shape_inference.hpp"
+#include "str_helper.hpp"
 
-template<typename _Ty>
-std::pair<_Ty, _Ty> Str2Pair(std::string str,
-		_Ty _min = std::numeric_limits<_Ty>::min(),
-		_Ty _max = std::numeric_limits<_Ty>::max()) {
-	CHECK(!str.empty());
-	std::istringstream iss(str);
-	std::pair<_Ty, _Ty> ret;
-	CHECK(iss >> Expect('(') >> ret.first >> Expect(',') >>
-			ret.second >> Expect(')'));
-	CHECK_GE(ret.first, _min);
-	CHECK_LE(ret.first, _max);
-	CHECK_GE(ret.second, _min);
-	CHECK_LE(ret.second, _max);
-	return ret;
-}
+using Layers = google::protobuf::RepeatedPtrField<caffe::LayerParameter>;
 
-template<typename _Ty>
-std::vector<_Ty> Str2Tuple(std::string str) {
-	CHECK(!str.empty());
-	std::string::size_type beg = str.find('(');
-	std::string::size_type end = str.rfind(')');
-	CHECK_NE(beg, std::string::npos);
-	CHECK_NE(end, std::string::npos);
-	CHECK_GT(end - beg, 1);
-	str.erase(end, -1);
-	str.erase(0, beg + 1);
-	std::istringstream iss(str);
-	std::vector<_Ty> ret;
-	for (std::string strVal; std::getline(iss, strVal, ','); ) {
-		std::istringstream isv(strVal);
-		_Ty val;
-		isv >> val;
-		ret.push_back(val);
-	}
-	return ret;
-}
+struct ConvertInfo {
+	bool bInPlace;
+	int nOutNum;
+};
 
-template<typename _Ty>
-_Ty Pair2Num(const std::pair<_Ty, _Ty> &pair) {
-	CHECK_EQ(pair.first, pair.second);
-	return pair.first;
+// Output size of an axis of caffe's pooling: rounded up, and clipped if the
+//	last window starts in the padding
+size_t CaffePoolingOutSize(size_t nIn, int nKernel, int nPad, int nStride) {
+	int64_t nSpan = (int64_t)nIn + 2 * nPad - nKernel;
+	int64_t nOut = (nSpan + nStride - 1) / nStride + 1;
+	if (nPad > 0 && (nOut - 1) * nStride >= (int64_t)nIn + nPad) {
+		--nOut;
+	}
+	return (size_t)nOut;
 }
 
-bool Str2Bool(std::string str) {
-	if (str == "True" || str == "true" || str == "1") {
-		return true;
+// The pooling of caffe must give the shape inferred for MxNet, it does not
+//	if the windows of MxNet are rounded down and caffe has another one
+void CheckPoolingShape(const std::string &strName,
+		const caffe::PoolingParameter &poolParam,
+		const Shape &inShape, const Shape &outShape) {
+	if (poolParam.global_pooling()) {
+		return;
+	}
+	CHECK_EQ(inShape.size(), 4U);
+	bool bSquare = poolParam.has_kernel_size();
+	int kernels[2] = {
+			(int)(bSquare ? poolParam.kernel_size() : poolParam.kernel_h()),
+			(int)(bSquare ? poolParam.kernel_size() : poolParam.kernel_w())};
+	bool bSameStride = !poolParam.has_stride_h();
+	int strides[2] = {
+			(int)(bSameStride ? poolParam.stride() : poolParam.stride_h()),
+			(int)(bSameStride ? poolParam.stride() : poolParam.stride_w())};
+	bool bSamePad = !poolParam.has_pad_h();
+	int pads[2] = {
+			(int)(bSamePad ? poolParam.pad() : poolParam.pad_h()),
+			(int)(bSamePad ? poolParam.pad() : poolParam.pad_w())};
+	for (size_t i = 0; i < 2; ++i) {
+		size_t nCaffeOut = CaffePoolingOutSize(inShape[2 + i], kernels[i],
+				pads[i], strides[i]);
+		CHECK_EQ(nCaffeOut, outShape[2 + i]) << "Pooling \"" <<
+				strName << "\" of " << ShapeString(inShape) <<
+				" gives " << ShapeString(outShape) << " in MxNet, but " <<
+				nCaffeOut << " on axis " << 2 + i << " in caffe, which " <<
+				"rounds up the windows and drops a last one in the padding";
 	}
-	CHECK(str == "False" || str == "false" || str == "0");
-	return false;
 }
 
-struct ConvertInfo {
-	bool bInPlace;
-	int nOutNum;
-};
-
-ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
+ConvertInfo MxnetNode2CaffeLayer(const MxnetNode &mxnetNode,
+		const Shape &inShape, const std::vector<Shape> &outShapes,
 		caffe::LayerParameter &caffeLayer) {
-	caffeLayer.set_name(std::move(mxnetNode.strName));
+	caffeLayer.set_name(mxnetNode.strName);
 	ConvertInfo cvtInfo = {false, 1};
 
 	using AttrProc = std::function<void(std::string)>;
@@ -328,8 +315,10 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 				poolParam.clear_kernel_size();
 			}
 		};
+		// Caffe always rounds up, the shape is checked against the inferred
 		optAttrProcs["pooling_convention"] = [&](std::string strVal) {
-			//CHECK(strVal == "full");
+			CHECK(strVal == "valid" || strVal == "full") <<
+					"Unsupported pooling_convention " << strVal;
 		};
 		optAttrProcs["p_value"] = [&](std::string strVal) {
 			LOG(FATAL) << "Lp pooling is not supported";
@@ -341,6 +330,15 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 	} else if (mxnetNode.strOp == "elemwise_add" ||
 			mxnetNode.strOp == "_Plus") {
 		caffeLayer.set_type("Eltwise");
+	} else if (mxnetNode.strOp == "add_n" ||
+			mxnetNode.strOp == "ElementWiseSum") {
+		caffeLayer.set_type("Eltwise");
+		optAttrProcs["num_args"]; // ignored
+	} else if (mxnetNode.strOp == "elemwise_sub" ||
+			mxnetNode.strOp == "_Minus") {
+		caffeLayer.set_type("Eltwise");
+		caffeLayer.mutable_eltwise_param()->add_coeff(1.f);
+		caffeLayer.mutable_eltwise_param()->add_coeff(-1.f);
 	} else if (mxnetNode.strOp == "elemwise_mul") {
 		caffeLayer.set_type("Eltwise");
 		caffeLayer.mutable_eltwise_param()->set_operation(
@@ -348,6 +346,9 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 	} else if (mxnetNode.strOp == "BatchNorm") {
 		caffeLayer.set_type("BatchNorm");
 		auto &bnParam = *caffeLayer.mutable_batch_norm_param();
+		// Defaults of MxNet, eps is 1e-5 in caffe and gamma is fixed
+		bnParam.set_eps(1e-3f);
+		caffeLayer.add_param(); // just a tag for fix_gamma
 		optAttrProcs["eps"] = [&](std::string strVal) {
 			double dEpsilon = Str2Num<double>(strVal, 0., 1.);
 			bnParam.set_eps((float)dEpsilon);
@@ -361,8 +362,8 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 			bnParam.set_moving_average_fraction(fMomentum);
 		};
 		optAttrProcs["fix_gamma"] = [&](std::string strVal) {
-			if (strVal == "True" || strVal == "true" || strVal == "1" ) {
-				caffeLayer.add_param(); // just a tag for fix_gamma
+			if (!Str2Bool(strVal)) {
+				caffeLayer.clear_param();
 			}
 		};
 		optAttrProcs["axis"] = [&](std::string strVal) {
@@ -411,23 +412,48 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 		optAttrProcs["use_ignore"]; // ignored
 	} else if (mxnetNode.strOp == "reshape" || mxnetNode.strOp == "Reshape") {
 		caffeLayer.set_type("Reshape");
+		bool bInferred = !outShapes.empty() && !outShapes[0].empty();
+		std::string strReverse = mxnetNode.attrs.GetValue("reverse", false);
+		bool bReverse = !strReverse.empty() && Str2Bool(strReverse);
 		optAttrProcs["shape"] = [&](std::string strVal) {
+			auto *pShape = caffeLayer.mutable_reshape_param()->mutable_shape();
 			auto shape = Str2Tuple<int>(strVal);
 			CHECK_GT(shape.size(), 0);
-			CHECK_LE(shape.size(), 4);
-			auto *pShape = caffeLayer.mutable_reshape_param()->mutable_shape();
+			bool bSpecial = bReverse;
 			for (auto s : shape) {
-				//CHECK_GT(s, -2);
-				pShape->add_dim(s);
+				bSpecial = bSpecial || s < -1;
+			}
+			if (!bSpecial) {
+				for (auto s : shape) {
+					pShape->add_dim(s);
+				}
+				return;
+			}
+			// Special values of MxNet (-2, -3, -4) resolved by inference, the
+			//	batch axis is kept by 0 to leave the net free of the batch size
+			CHECK(bInferred) << "Unknown input shape of " << caffeLayer.name()
+					<< " to resolve reshape " << strVal;
+			auto &outShape = outShapes[0];
+			for (size_t i = 0; i < outShape.size(); ++i) {
+				bool bBatch = i == 0 && !inShape.empty() &&
+						inShape[0] == outShape[0];
+				pShape->add_dim(bBatch ? 0 : (int64_t)outShape[i]);
 			}
 		};
+		optAttrProcs["reverse"]; // resolved with shape
 	} else if (mxnetNode.strOp == "L2Normalization") {
 		caffeLayer.set_type("Normalization");
 		optAttrProcs["mode"] = [&](std::string strVal) {
 			CHECK(strVal == "instance");
 		};
 	} else if (mxnetNode.strOp == "broadcast_mul") {
-		caffeLayer.set_type("BroadcastMul");
+		caffeLayer.set_type("BroadcastMul"); // mapped by MapBroadcastLayers
+	} else if (mxnetNode.strOp == "broadcast_add" ||
+			mxnetNode.strOp == "broadcast_plus") {
+		caffeLayer.set_type("BroadcastAdd");
+	} else if (mxnetNode.strOp == "broadcast_sub" ||
+			mxnetNode.strOp == "broadcast_minus") {
+		caffeLayer.set_type("BroadcastSub");
 	} else if (mxnetNode.strOp == "_mul_scalar") {
 		caffeLayer.set_type("Power");
 		optAttrProcs["scalar"] = [&](std::string strVal) {
@@ -439,21 +465,18 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 	}
 
 	auto ProcAttrs = [&](const AttrProcMap &procMap, bool bRequired) {
-			for (auto attrProc : procMap) {
+			for (auto &attrProc : procMap) {
 				std::string strVal = mxnetNode.attrs.GetValue(
 						attrProc.first, bRequired);
 				if (!strVal.empty() && attrProc.second != nullptr) {
 					attrProc.second(strVal);
 				}
-				if (mxnetNode.attrs.HasValue(attrProc.first)) {
-					mxnetNode.attrs.RemoveValue(attrProc.first);
-				}
 			}
 		};
 
 	ProcAttrs(reqAttrProcs, true);
 	ProcAttrs(optAttrProcs, false);
-	std::set<std::string> hiddenKeys = {
+	static const std::set<std::string> hiddenKeys = {
 			"__ctx_group__",
 			"__lr_mult__",
 			"__wd_mult__",
@@ -461,91 +484,369 @@ ConvertInfo MxnetNode2CaffeLayer(MxnetNode mxnetNode,
 			"__mirror_stage__"
 		};
 	if (mxnetNode.strOp != "null") {
+		// Attributes are consumed by the procs, the others are unknown
 		for (auto &attr : mxnetNode.attrs) {
-			if (hiddenKeys.find(attr.first) == hiddenKeys.end()) {
+			if (reqAttrProcs.count(attr.first) == 0 &&
+					optAttrProcs.count(attr.first) == 0 &&
+					hiddenKeys.count(attr.first) == 0) {
 				LOG(FATAL) << "Unknown attr \"" << attr.first <<
 						"\" found in node \"" << mxnetNode.strName <<
 						"\" (" <<mxnetNode.strOp << ")";
 			}
 		}
 	}
+	if (caffeLayer.type() == "Pooling" && !inShape.empty() &&
+			!outShapes.empty() && !outShapes[0].empty()) {
+		CheckPoolingShape(mxnetNode.strName, caffeLayer.pooling_param(),
+				inShape, outShapes[0]);
+	}
 	return cvtInfo;
 }
 
-int GuessBlobIDFromInputName(std::string strInputName) {
-	using namespace std::placeholders;
-	using SuffixBlobID = std::pair<std::string, size_t>;
-	using SBAry = std::vector<SuffixBlobID>;
-	static SBAry sbAry = {
-			{"weight", 0}, {"gamma", 0}, {"moving_mean", 0},
-			{"bias", 1}, {"beta", 1}, {"moving_var", 1}
+// A parameter input of an op, by its argument position in the op schema of
+//	MxNet, and the blob it is bound to in the converted layer. Parameters of
+//	BatchNorm are split to the BatchNorm and the Scale layer following it.
+struct ParamArg {
+	size_t nInput;
+	bool bScaleLayer;
+	size_t nBlobID;
+};
+
+const std::map<std::string, std::vector<ParamArg>> &OpParamArgs() {
+	static const std::map<std::string, std::vector<ParamArg>> opParamArgs = {
+			{"Convolution", {{1, false, 0}, {2, false, 1}}},
+			{"FullyConnected", {{1, false, 0}, {2, false, 1}}},
+			{"LeakyReLU", {{1, false, 0}}}, // gamma of prelu
+			{"BatchNorm", {{1, true, 0}, {2, true, 1},
+					{3, false, 0}, {4, false, 1}}}
 		};
-	auto iSuffix = std::find_if(sbAry.begin(), sbAry.end(),
-			[&](const SuffixBlobID &sb) {
-				return IsEndWith(strInputName, sb.first);
-			}
-		);
-	if (iSuffix == sbAry.end()) {
-		return -1;
+	return opParamArgs;
+}
+
+std::string ScaleLayerName(const std::string &strBatchNorm) {
+	return strBatchNorm + "_scale";
+}
+
+// Rearranges the layers to the order, layers not in the order are deleted.
+//	Layers are swapped by pointers, no layer is copied.
+void ReorderLayers(Layers &layers,
+		const std::vector<caffe::LayerParameter*> &order) {
+	std::unordered_map<const caffe::LayerParameter*, int> positions;
+	for (int i = 0; i < layers.size(); ++i) {
+		positions[&layers.Get(i)] = i;
+	}
+	for (int i = 0; i < (int)order.size(); ++i) {
+		auto iPos = positions.find(order[i]);
+		CHECK(iPos != positions.end());
+		int j = iPos->second;
+		CHECK_GE(j, i) << "Duplicated layer in order";
+		if (j != i) {
+			positions[&layers.Get(i)] = j;
+			iPos->second = i;
+			layers.SwapElements(i, j);
+		}
 	}
-	return iSuffix->second;
+	layers.DeleteSubrange((int)order.size(), layers.size() - (int)order.size());
 }
 
-void ExpandOrMergeLayers(std::vector<caffe::LayerParameter> &layers) {
-	for (auto iLayer = layers.begin(); iLayer != layers.end(); ) {
-		if (iLayer->type() == "BatchNorm") {
-			CHECK_GE(iLayer->bottom_size(), 3);
-			CHECK_EQ(iLayer->top_size(), 1);
-			std::string strLayerName = iLayer->name();
-			std::string strOutputName = iLayer->top(0);
-			std::string strInputGamma = iLayer->bottom(1);
-			std::string strInputBeta = iLayer->bottom(2);
-			auto *pBottom = iLayer->mutable_bottom();
-			pBottom->DeleteSubrange(1, 2);
-			//pBottom->erase(pBottom->begin() + 1, pBottom->begin() + 3);
-			if (iLayer->bottom_size() == 1) {
-				CHECK(IsEndWith(strInputGamma, "_gamma"));
-				CHECK(IsEndWith(strInputBeta, "_beta"));
-				std::string strMean = strInputGamma.substr(0,
-						strInputGamma.size() - 6) + "_moving_mean";
-				std::string strVar = strInputGamma.substr(0,
-						strInputGamma.size() - 6) + "_moving_var";
-				iLayer->add_bottom(strMean);
-				iLayer->add_bottom(strVar);
-			} else {
-				CHECK(iLayer->bottom_size() == 3);
-			}
+// Expands BatchNorm to BatchNorm + Scale and removes Flatten, in a single
+//	pass building the new order of layers.
+void ExpandOrMergeLayers(Layers &layers) {
+	std::vector<caffe::LayerParameter*> order;
+	order.reserve(layers.size() * 2);
+	for (int i = 0, nNumLayers = layers.size(); i < nNumLayers; ++i) {
+		auto *pLayer = layers.Mutable(i);
+		if (pLayer->type() == "BatchNorm") {
+			order.push_back(pLayer);
+			CHECK_EQ(pLayer->bottom_size(), 1);
+			CHECK_EQ(pLayer->top_size(), 1);
+			std::string strLayerName = pLayer->name();
+			std::string strOutputName = pLayer->top(0);
 			bool bFixedGamma = false;
 			// If fix_gamma is set, a "param" should be added to the layer before
-			if (iLayer->param_size() > 0) {
-				CHECK_EQ(iLayer->param_size(), 1);
+			if (pLayer->param_size() > 0) {
+				CHECK_EQ(pLayer->param_size(), 1);
 				bFixedGamma = true;
-				iLayer->clear_param();
-			}
-			iLayer = layers.insert(++iLayer, caffe::LayerParameter());
-			iLayer->set_name(strLayerName + "_scale");
-			iLayer->set_type("Scale");
-			iLayer->add_bottom(strOutputName);
-			iLayer->add_bottom(strInputGamma);
-			iLayer->add_bottom(strInputBeta);
-			iLayer->add_top(strOutputName);
-			iLayer->mutable_scale_param()->set_bias_term(true);
+				pLayer->clear_param();
+			}
+			// The Scale layer follows the BatchNorm
+			auto *pScale = layers.Add();
+			order.push_back(pScale);
+			pScale->set_name(ScaleLayerName(strLayerName));
+			pScale->set_type("Scale");
+			pScale->add_bottom(strOutputName);
+			pScale->add_top(strOutputName);
+			pScale->mutable_scale_param()->set_bias_term(true);
 			if (bFixedGamma) {
-				auto *pParam = iLayer->add_param();
+				auto *pParam = pScale->add_param();
 				pParam->set_decay_mult(100.);
 				pParam->set_lr_mult(0.f);
-				auto *pFiller = iLayer->mutable_scale_param()->mutable_filler();
+				auto *pFiller = pScale->mutable_scale_param()->mutable_filler();
 				pFiller->set_type("constant");
 				pFiller->set_value(1.0f);
 			}
-			++iLayer;
-		} else if (iLayer->type() == "Flatten") {
-			iLayer = layers.erase(iLayer);
-		} else if (GuessBlobIDFromInputName(iLayer->name()) >= 0) {
-			iLayer = layers.erase(iLayer);
+		} else if (pLayer->type() != "Flatten") {
+			order.push_back(pLayer);
+		} // Flatten is in-place and dropped
+	}
+	ReorderLayers(layers, order);
+}
+
+// Map a broadcasting layer to Eltwise, Scale or Bias. The broadcasted input
+// is reshaped to the range of its non-singleton axes, from the batch axis if
+// it has one, and negated by a Power layer for subtractions.
+void MapBroadcastLayer(caffe::LayerParameter &layer, BlobShapes &blobShapes,
+		Layers &layers, std::vector<caffe::LayerParameter*> &order) {
+	CHECK_EQ(layer.bottom_size(), 2);
+	CHECK_EQ(layer.top_size(), 1);
+	auto GetShape = [&](const std::string &strBlob) -> const Shape& {
+			auto iShape = blobShapes.find(strBlob);
+			CHECK(iShape != blobShapes.end()) << "Unknown shape of \"" <<
+					strBlob << "\" broadcasted by \"" << layer.name() << "\"";
+			return iShape->second;
+		};
+	auto AddLayer = [&](const std::string &strSuffix,
+			const std::string &strType, const std::string &strBottom,
+			const Shape &shape) -> caffe::LayerParameter& {
+			auto &newLayer = *layers.Add();
+			order.push_back(&newLayer);
+			newLayer.set_name(layer.name() + strSuffix);
+			newLayer.set_type(strType);
+			newLayer.add_bottom(strBottom);
+			newLayer.add_top(newLayer.name());
+			blobShapes[newLayer.name()] = shape;
+			return newLayer;
+		};
+	const std::string strType = layer.type();
+	const Shape lhsShape = GetShape(layer.bottom(0));
+	const Shape rhsShape = GetShape(layer.bottom(1));
+	if (lhsShape == rhsShape) {
+		auto &eltParam = *layer.mutable_eltwise_param();
+		if (strType == "BroadcastMul") {
+			eltParam.set_operation(caffe::EltwiseParameter_EltwiseOp_PROD);
+		} else if (strType == "BroadcastSub") {
+			eltParam.add_coeff(1.f);
+			eltParam.add_coeff(-1.f);
+		}
+		layer.set_type("Eltwise");
+		order.push_back(&layer);
+		return;
+	}
+
+	Shape outShape = BroadcastShapes(lhsShape, rhsShape);
+	int nFull = (lhsShape == outShape) ? 0 : (rhsShape == outShape ? 1 : -1);
+	CHECK_GE(nFull, 0) << "Unsupported broadcasting of both inputs of \"" <<
+			layer.name() << "\": " << ShapeString(lhsShape) << " vs " <<
+			ShapeString(rhsShape);
+	std::string strFull = layer.bottom(nFull);
+	std::string strPart = layer.bottom(1 - nFull);
+	const Shape &partShape = (nFull == 0) ? rhsShape : lhsShape;
+
+	// The non-singleton axes of the broadcasted input must be contiguous and
+	// equal to the axes of the output in [nBeg, nEnd)
+	Shape aligned(outShape.size() - partShape.size(), 1);
+	aligned.insert(aligned.end(), partShape.begin(), partShape.end());
+	size_t nBeg = 0, nEnd = 0;
+	for (size_t i = 0; i < aligned.size(); ++i) {
+		if (aligned[i] != 1) {
+			nBeg = (nEnd == 0) ? i : nBeg;
+			nEnd = i + 1;
+		}
+	}
+	// An input of the full rank with the batch of the output is taken per
+	//	sample, even if the batch is 1 when the shapes are inferred
+	bool bBatched = partShape.size() == outShape.size() &&
+			partShape[0] == outShape[0];
+	if (bBatched) {
+		nBeg = 0;
+		nEnd = std::max(nEnd, (size_t)1);
+	}
+	for (size_t i = nBeg; i < nEnd; ++i) {
+		CHECK_EQ(aligned[i], outShape[i]) << "Broadcasting " <<
+				ShapeString(partShape) << " to " << ShapeString(outShape) <<
+				" in \"" << layer.name() << "\" is not supported by Caffe";
+	}
+	Shape partTarget(outShape.begin() + nBeg, outShape.begin() + nEnd);
+	if (partShape != partTarget) {
+		auto &reshape = AddLayer("_reshape", "Reshape", strPart, partTarget);
+		auto *pShape = reshape.mutable_reshape_param()->mutable_shape();
+		for (size_t i = 0; i < partTarget.size(); ++i) {
+			// The batch axis is kept by 0 and the rest follows by -1
+			if (bBatched && i == 0) {
+				pShape->add_dim(0);
+			} else if (bBatched && i + 1 == partTarget.size()) {
+				pShape->add_dim(-1);
+			} else {
+				pShape->add_dim((int64_t)partTarget[i]);
+			}
+		}
+		strPart = reshape.top(0);
+	}
+	if (strType == "BroadcastSub") {
+		// full - part = full + (-part), part - full = (-full) + part
+		std::string &strNeg = (nFull == 0) ? strPart : strFull;
+		auto &neg = AddLayer("_neg", "Power", strNeg,
+				(nFull == 0) ? partTarget : outShape);
+		neg.mutable_power_param()->set_scale(-1.f);
+		strNeg = neg.top(0);
+	}
+
+	layer.clear_bottom();
+	layer.add_bottom(strFull);
+	layer.add_bottom(strPart);
+	if (strType == "BroadcastMul") {
+		layer.set_type("Scale");
+		if (nBeg != 1) {
+			layer.mutable_scale_param()->set_axis((int)nBeg);
+		}
+	} else {
+		layer.set_type("Bias");
+		if (nBeg != 1) {
+			layer.mutable_bias_param()->set_axis((int)nBeg);
+		}
+	}
+	order.push_back(&layer);
+}
+
+void MapBroadcastLayers(Layers &layers, BlobShapes &blobShapes) {
+	auto IsBroadcast = [](const caffe::LayerParameter &layer) {
+			return layer.type() == "BroadcastMul" ||
+					layer.type() == "BroadcastAdd" ||
+					layer.type() == "BroadcastSub";
+		};
+	if (std::none_of(layers.begin(), layers.end(), IsBroadcast)) {
+		return;
+	}
+	std::vector<caffe::LayerParameter*> order;
+	order.reserve(layers.size());
+	for (int i = 0, nNumLayers = layers.size(); i < nNumLayers; ++i) {
+		auto *pLayer = layers.Mutable(i);
+		if (IsBroadcast(*pLayer)) {
+			MapBroadcastLayer(*pLayer, blobShapes, layers, order);
 		} else {
-			LOG(INFO) << iLayer->name();
-			++iLayer;
+			order.push_back(pLayer);
+		}
+	}
+	ReorderLayers(layers, order);
+}
+
+bool IsEltwiseSum(const caffe::LayerParameter &layer) {
+	return layer.type() == "Eltwise" && layer.eltwise_param().operation() ==
+			caffe::EltwiseParameter_EltwiseOp_SUM;
+}
+
+// Merge single-consumer chains of Eltwise SUM layers into one N-ary layer,
+// the coefficients of a merged producer are multiplied into the consumer.
+void MergeEltwiseSums(Layers &layers) {
+	std::map<std::string, size_t> nConsumers;
+	for (auto &layer : layers) {
+		for (auto &strBottom : layer.bottom()) {
+			++nConsumers[strBottom];
+		}
+	}
+	std::map<std::string, size_t> sumProducers; // top -> layer index
+	std::map<std::string, size_t> lastWriters; // blob -> layer index
+	std::vector<bool> merged(layers.size(), false);
+	for (int i = 0; i < layers.size(); ++i) {
+		auto &layer = *layers.Mutable(i);
+		if (IsEltwiseSum(layer)) {
+			auto &eltParam = *layer.mutable_eltwise_param();
+			std::vector<std::string> bottoms;
+			std::vector<float> coeffs;
+			for (int j = 0; j < layer.bottom_size(); ++j) {
+				const std::string &strBottom = layer.bottom(j);
+				float fCoeff = eltParam.coeff_size() ? eltParam.coeff(j) : 1.f;
+				auto iProducer = sumProducers.find(strBottom);
+				bool bMerge = (iProducer != sumProducers.end() &&
+						nConsumers[strBottom] == 1);
+				if (bMerge) {
+					// Inputs of the producer must not be overwritten in between
+					for (auto &strInput : layers.Get(iProducer->second).bottom()) {
+						if (lastWriters[strInput] > iProducer->second) {
+							bMerge = false;
+						}
+					}
+				}
+				if (!bMerge) {
+					bottoms.push_back(strBottom);
+					coeffs.push_back(fCoeff);
+					continue;
+				}
+				auto &producer = layers.Get(iProducer->second);
+				auto &prodParam = producer.eltwise_param();
+				for (int k = 0; k < producer.bottom_size(); ++k) {
+					bottoms.push_back(producer.bottom(k));
+					coeffs.push_back(fCoeff * (prodParam.coeff_size() ?
+							prodParam.coeff(k) : 1.f));
+				}
+				merged[iProducer->second] = true;
+				sumProducers.erase(iProducer);
+			}
+			if (bottoms.size() != (size_t)layer.bottom_size()) {
+				layer.clear_bottom();
+				for (auto &strBottom : bottoms) {
+					layer.add_bottom(strBottom);
+				}
+				eltParam.clear_coeff();
+				if (std::any_of(coeffs.begin(), coeffs.end(),
+						[](float fCoeff) { return fCoeff != 1.f; })) {
+					for (auto fCoeff : coeffs) {
+						eltParam.add_coeff(fCoeff);
+					}
+				}
+			}
+			if (layer.top_size() == 1) {
+				sumProducers[layer.top(0)] = i;
+			}
+		}
+		for (auto &strTop : layer.top()) {
+			lastWriters[strTop] = i;
+		}
+	}
+	std::vector<caffe::LayerParameter*> order;
+	for (int i = 0; i < layers.size(); ++i) {
+		if (!merged[i]) {
+			order.push_back(layers.Mutable(i));
+		}
+	}
+	ReorderLayers(layers, order);
+}
+
+// Names the blobs bound to MxNet parameters used by several layers, so that
+//	caffe shares one blob for each of them. The scale factor of a BatchNorm
+//	sharing the moving mean is shared too. Statistics of BatchNorm must not
+//	be learned, as caffe requires.
+void ShareParams(Layers &layers,
+		const std::map<std::string, std::vector<std::string>> &blobMapping) {
+	std::map<std::string, size_t> nUsers;
+	for (auto &blobNames : blobMapping) {
+		for (auto &strName : blobNames.second) {
+			++nUsers[strName];
+		}
+	}
+	for (auto &layer : layers) {
+		auto iBlobNames = blobMapping.find(layer.name());
+		if (iBlobNames == blobMapping.end()) {
+			continue;
+		}
+		auto &blobNames = iBlobNames->second;
+		std::vector<std::string> paramNames = blobNames;
+		bool bBatchNorm = (layer.type() == "BatchNorm");
+		if (bBatchNorm && !paramNames.empty()) {
+			paramNames.push_back(paramNames[0] + "_scale_factor");
+		}
+		for (size_t j = 0; j < paramNames.size(); ++j) {
+			// The scale factor follows the moving mean
+			if (nUsers[blobNames[j < blobNames.size() ? j : 0]] < 2) {
+				continue;
+			}
+			while (layer.param_size() <= (int)j) {
+				auto *pParam = layer.add_param();
+				if (bBatchNorm) {
+					pParam->set_lr_mult(0.f);
+				}
+			}
+			layer.mutable_param((int)j)->set_name(paramNames[j]);
 		}
 	}
 }
@@ -578,19 +879,97 @@ std::vector<size_t> SortIndicesByDependencies(
 	return std::move(results);
 }
 
-caffe::NetParameter MxnetNodes2CaffeNet(
+void MxnetNodes2CaffeNet(
 		const std::vector<MxnetNode> &mxnetNodes,
 		const std::vector<size_t> &headIndices,
 		const std::vector<InputInfo> &inputInfos,
-		std::map<std::string, std::vector<std::string>> &blobMapping) {
-	auto sortedIndices = SortIndicesByDependencies(mxnetNodes, headIndices);
-	std::vector<caffe::LayerParameter> caffeLayers;
+		std::map<std::string, std::vector<std::string>> &blobMapping,
+		BlobShapes &blobShapes,
+		std::vector<NodeBlobs> &nodeBlobs,
+		caffe::NetParameter &net) {
+	std::vector<size_t> sortedIndices;
+	NodeShapes nodeShapes;
+	{
+		ProfileScope scope("sort_and_infer_shapes");
+		sortedIndices = SortIndicesByDependencies(mxnetNodes, headIndices);
+		nodeShapes = InferMxnetShapes(mxnetNodes, inputInfos);
+	}
 
-	std::map<std::string, size_t> typeCnt; // for unamed layers
+	// Parameter inputs by the op schema, their null nodes are bound to blobs
+	//	of the consumers instead of being converted to layers
+	auto &opParamArgs = OpParamArgs();
+	std::vector<const std::vector<ParamArg>*> nodeParamArgs(mxnetNodes.size(),
+			nullptr);
+	std::vector<bool> isParam(mxnetNodes.size(), false);
+	for (auto &mxnetNode : mxnetNodes) {
+		auto iParamArgs = opParamArgs.find(mxnetNode.strOp);
+		if (iParamArgs == opParamArgs.end()) {
+			continue;
+		}
+		nodeParamArgs[&mxnetNode - mxnetNodes.data()] = &iParamArgs->second;
+		for (auto &paramArg : iParamArgs->second) {
+			if (paramArg.nInput < mxnetNode.inputs.size()) {
+				size_t iInput = mxnetNode.inputs[paramArg.nInput].first;
+				CHECK_LT(iInput, mxnetNodes.size());
+				CHECK(mxnetNodes[iInput].strOp == "null") << "Parameter " <<
+						paramArg.nInput << " of " << mxnetNode.strName <<
+						" is not a variable";
+				isParam[iInput] = true;
+			}
+		}
+	}
+
+	// An in-place layer must be the last consumer of its bottom. Flatten is
+	//	dropped and its output is the blob of its input, so consumers are
+	//	counted on the output the blob is created by
+	std::map<size_t, MxnetInput> flattenSources;
+	auto BlobSource = [&](const MxnetInput &input) {
+			auto iSource = flattenSources.find(input.first);
+			return iSource == flattenSources.end() ? input : iSource->second;
+		};
+	for (auto iNode : sortedIndices) {
+		auto &mxnetNode = mxnetNodes[iNode];
+		if (mxnetNode.strOp == "Flatten" && !mxnetNode.inputs.empty()) {
+			flattenSources[iNode] = BlobSource(mxnetNode.inputs[0]);
+		}
+	}
+	std::map<MxnetInput, size_t> lastConsumers;
 	for (size_t i = 0; i < sortedIndices.size(); ++i) {
-		auto &mxnetNode = mxnetNodes[sortedIndices[i]];
-		caffe::LayerParameter caffeLayer;
-		auto cvtInfo = MxnetNode2CaffeLayer(mxnetNode, caffeLayer);
+		for (auto &input : mxnetNodes[sortedIndices[i]].inputs) {
+			lastConsumers[BlobSource(input)] = i;
+		}
+	}
+
+	auto &caffeLayers = *net.mutable_layer();
+	caffeLayers.Reserve((int)sortedIndices.size());
+	// Position of the converted layer of each node
+	std::vector<int> layerIndices(mxnetNodes.size(), -1);
+
+	nodeBlobs.assign(mxnetNodes.size(), NodeBlobs());
+
+	std::map<std::string, size_t> typeCnt; // for unamed layers
+	std::vector<bool> paramInputs;
+	for (size_t nPos = 0; nPos < sortedIndices.size(); ++nPos) {
+		size_t iNode = sortedIndices[nPos];
+		auto &mxnetNode = mxnetNodes[iNode];
+		auto &outShapes = nodeShapes[iNode];
+		if (isParam[iNode]) {
+			if (!outShapes.empty() && !outShapes[0].empty()) {
+				blobShapes.emplace(mxnetNode.strName, outShapes[0]);
+			}
+			continue;
+		}
+		layerIndices[iNode] = caffeLayers.size();
+		auto &caffeLayer = *caffeLayers.Add();
+		Shape inShape;
+		if (!mxnetNode.inputs.empty()) {
+			auto &input = mxnetNode.inputs[0];
+			if (input.second < nodeShapes[input.first].size()) {
+				inShape = nodeShapes[input.first][input.second];
+			}
+		}
+		auto cvtInfo = MxnetNode2CaffeLayer(mxnetNode, inShape, outShapes,
+				caffeLayer);
 
 		// to give unamed layer a name
 		if (caffeLayer.name().empty()) {
@@ -599,18 +978,49 @@ caffe::NetParameter MxnetNodes2CaffeNet(
 					std::to_string(nTypeCnt));
 		}
 
+		// Bind parameters to blobs
+		paramInputs.assign(mxnetNode.inputs.size(), false);
+		if (nodeParamArgs[iNode] != nullptr) {
+			for (auto &paramArg : *nodeParamArgs[iNode]) {
+				if (paramArg.nInput >= mxnetNode.inputs.size()) {
+					continue;
+				}
+				paramInputs[paramArg.nInput] = true;
+				auto &blobVec = blobMapping[paramArg.bScaleLayer ?
+						ScaleLayerName(caffeLayer.name()) : caffeLayer.name()];
+				if (blobVec.size() <= paramArg.nBlobID) {
+					blobVec.resize(paramArg.nBlobID + 1);
+				}
+				blobVec[paramArg.nBlobID] = mxnetNodes[
+						mxnetNode.inputs[paramArg.nInput].first].strName;
+			}
+		}
+		if (mxnetNode.strOp == "BatchNorm" && mxnetNode.inputs.size() == 3) {
+			// Moving mean and var are not listed in inputs by old MxNet
+			blobMapping[caffeLayer.name()] = BatchNormStatNames(blobMapping[
+					ScaleLayerName(caffeLayer.name())][0]);
+		}
+
 		// convert inputs
-		for (auto mxnetIdx : mxnetNode.inputs) {
-			auto iCaffeIdx = std::find(sortedIndices.begin(),
-					sortedIndices.end(), mxnetIdx.first);
-			CHECK(iCaffeIdx != sortedIndices.end());
-			CHECK_LT(*iCaffeIdx, i);
-			auto &prevOutputs = caffeLayers[*iCaffeIdx].top();
+		for (size_t j = 0; j < mxnetNode.inputs.size(); ++j) {
+			if (paramInputs[j]) {
+				continue;
+			}
+			auto &mxnetIdx = mxnetNode.inputs[j];
+			CHECK_LT(mxnetIdx.first, layerIndices.size());
+			int nCaffeIdx = layerIndices[mxnetIdx.first];
+			CHECK_GE(nCaffeIdx, 0) << "Input of " << caffeLayer.name() <<
+					" is not converted before it";
+			auto &prevOutputs = caffeLayers.Get(nCaffeIdx).top();
 			CHECK_LT(mxnetIdx.second, prevOutputs.size());
 			caffeLayer.add_bottom(prevOutputs.Get(mxnetIdx.second));
 		}
 
-		// Convert outputs
+		// Convert outputs, Flatten is dropped so it never writes the bottom
+		if (cvtInfo.bInPlace && mxnetNode.strOp != "Flatten" &&
+				lastConsumers[BlobSource(mxnetNode.inputs[0])] != nPos) {
+			cvtInfo.bInPlace = false;
+		}
 		if (cvtInfo.bInPlace) {
 			CHECK_EQ(cvtInfo.nOutNum, 1);
 			caffeLayer.add_top(caffeLayer.bottom().Get(0));
@@ -626,12 +1036,42 @@ caffe::NetParameter MxnetNodes2CaffeNet(
 			}
 		}
 
-		// Put this layer to vector
-		caffeLayers.emplace_back(std::move(caffeLayer));
+		// Shapes of new blobs, in-place layers keep the shape of the bottom
+		for (int j = 0; j < caffeLayer.top_size(); ++j) {
+			if (j < (int)outShapes.size() && !outShapes[j].empty()) {
+				blobShapes.emplace(caffeLayer.top(j), outShapes[j]);
+			}
+		}
+
+		// BatchNorm is completed by its Scale layer, Flatten will be dropped
+		auto &blobs = nodeBlobs[iNode];
+		blobs.tops.assign(caffeLayer.top().begin(), caffeLayer.top().end());
+		if (mxnetNode.strOp == "BatchNorm") {
+			blobs.strLayer = ScaleLayerName(caffeLayer.name());
+		} else if (mxnetNode.strOp == "Flatten") {
+			blobs.strLayer = nodeBlobs[mxnetNode.inputs[0].first].strLayer;
+		} else {
+			blobs.strLayer = caffeLayer.name();
+		}
 	}
 
-	ExpandOrMergeLayers(caffeLayers);
-	caffe::NetParameter net;
+	{
+		ProfileScope scope("rewrite_layers");
+		MapBroadcastLayers(caffeLayers, blobShapes);
+		ExpandOrMergeLayers(caffeLayers);
+		MergeEltwiseSums(caffeLayers);
+		ShareParams(caffeLayers, blobMapping);
+	}
+
+	std::set<std::string> layerNames;
+	for (auto &layer : caffeLayers) {
+		layerNames.insert(layer.name());
+	}
+	for (auto &blobs : nodeBlobs) {
+		if (!blobs.strLayer.empty() && layerNames.count(blobs.strLayer) == 0) {
+			blobs = NodeBlobs(); // merged into the consumer
+		}
+	}
 	for (auto &layer : caffeLayers) {
 		auto iInputInfo = std::find_if(inputInfos.begin(), inputInfos.end(),
 				[&](const InputInfo &ii) {
@@ -647,23 +1087,7 @@ caffe::NetParameter MxnetNodes2CaffeNet(
 			CHECK_GT(layer.bottom_size(), 0) << "Unmarked input node: " <<
 					layer.name();
 		}
-		auto &bottoms = *layer.mutable_bottom();
-		for (auto iBottom = bottoms.begin(); iBottom != bottoms.end(); ) {
-			int nBlobID = GuessBlobIDFromInputName(*iBottom);
-			if (nBlobID >= 0) {
-				auto &blobVec = blobMapping[layer.name()];
-				blobVec.resize(nBlobID + 1);
-				blobVec[nBlobID] = std::move(*iBottom);
-				bottoms.DeleteSubrange(iBottom - bottoms.begin(), 1);
-			} else {
-				++iBottom;
-			}
-		}
-		net.add_layer()->CopyFrom(layer);
 	}
-	LOG(INFO) << caffeLayers[1].name();
-
-	return net;
 }
 
 bool IsEndWith(const std::string &strString, const std::string &strSuffix) {
@@ -673,3 +1097,10 @@ bool IsEndWith(const std::string &strString, const std::string &strSuffix) {
 	}
 	return false;
 }
+
+std::vector<std::string> BatchNormStatNames(const std::string &strGamma) {
+	CHECK(IsEndWith(strGamma, "_gamma")) << "Gamma of BatchNorm " <<
+			strGamma << " is not named *_gamma";
+	std::string strPrefix = strGamma.substr(0, strGamma.size() - 6);
+	return {strPrefix + "_moving_mean", strPrefix + "_moving_var"};
+}
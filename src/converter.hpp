@@ -20,18 +20,36 @@
 
 #include "mxnet_parser.hpp"
 
-using InputInfo = std::pair<std::string, Shape>;
+// The tops of a node hold its outputs right after the layer strLayer is
+//	forwarded, later in-place layers may overwrite them. A dropped Flatten
+//	shares the blob and the layer of its input. Both are empty if the outputs
+//	are not in the net at all (parameters, Eltwise sums merged into their
+//	consumers).
+struct NodeBlobs {
+	std::string strLayer;
+	std::vector<std::string> tops;
+};
 
 //blobMapping: mapping layername to input parameter names in mxnet node
 //eg. conv1 -> {conv1_weight, conv1_bias}
-caffe::NetParameter MxnetNodes2CaffeNet(
+//blobShapes: inferred shapes of blobs in the net and of parameters
+//eg. conv1 -> (1,64,111,111), conv1_weight -> (64,3,3,3)
+//nodeBlobs: caffe blobs holding the outputs of each mxnet node
+//eg. relu1 -> layer relu1, tops {conv1} (in place)
+//net: layers are built in place, it could be allocated on an arena
+void MxnetNodes2CaffeNet(
 		const std::vector<MxnetNode> &mxnetNodes,
 		const std::vector<size_t> &headIndices,
 		const std::vector<InputInfo> &inputInfos,
-		std::map<std::string, std::vector<std::string>> &blobMapping);
-
-int GuessBlobIDFromInputName(std::string strInputName);
+		std::map<std::string, std::vector<std::string>> &blobMapping,
+		BlobShapes &blobShapes,
+		std::vector<NodeBlobs> &nodeBlobs,
+		caffe::NetParameter &net);
 
 bool IsEndWith(const std::string &strString, const std::string &strSuffix);
 
+// Moving mean and var of a BatchNorm, named after its gamma as old MxNet does
+//	not list them in the inputs
+std::vector<std::string> BatchNormStatNames(const std::string &strGamma);
+
 #endif /* CONVERTER_HPP_ */
@@ -0,0 +1,264 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Analytical cost model of a converted caffe::NetParameter
+*/
+
+#include "cost_model.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <glog/logging.h>
+
+#include "json_helper.hpp"
+#include "shape_inference.hpp"
+
+// Product of the dimensions in [nBeg, nEnd)
+size_t DimsCount(const Shape &shape, size_t nBeg, size_t nEnd) {
+	size_t nCount = 1;
+	for (size_t i = nBeg; i < std::min(nEnd, shape.size()); ++i) {
+		nCount *= shape[i];
+	}
+	return nCount;
+}
+
+// (height, width) of a kernel given by kernel_size or kernel_h and kernel_w
+std::pair<size_t, size_t> KernelSize(
+		const caffe::ConvolutionParameter &param) {
+	if (param.has_kernel_h()) {
+		return std::make_pair(param.kernel_h(), param.kernel_w());
+	}
+	CHECK_GT(param.kernel_size_size(), 0);
+	size_t nKernelH = param.kernel_size(0);
+	return std::make_pair(nKernelH, param.kernel_size_size() > 1 ?
+			(size_t)param.kernel_size(1) : nKernelH);
+}
+
+std::pair<size_t, size_t> KernelSize(const caffe::PoolingParameter &param) {
+	if (param.has_kernel_h()) {
+		return std::make_pair(param.kernel_h(), param.kernel_w());
+	}
+	return std::make_pair(param.kernel_size(), param.kernel_size());
+}
+
+// Element counts of the parameter blobs of a layer, in the order of caffe
+std::vector<size_t> ParamCounts(const caffe::LayerParameter &layer,
+		const Shape &bottomShape) {
+	auto &strType = layer.type();
+	size_t nChannels = bottomShape.size() > 1 ? bottomShape[1] : 1;
+	if (strType == "Convolution") {
+		auto &convParam = layer.convolution_param();
+		auto kernel = KernelSize(convParam);
+		std::vector<size_t> counts = {convParam.num_output() * nChannels /
+				convParam.group() * kernel.first * kernel.second};
+		if (convParam.bias_term()) {
+			counts.push_back(convParam.num_output());
+		}
+		return counts;
+	} else if (strType == "InnerProduct") {
+		auto &ipParam = layer.inner_product_param();
+		size_t nAxis = CanonicalAxis(ipParam.axis(), bottomShape.size());
+		std::vector<size_t> counts = {ipParam.num_output() *
+				DimsCount(bottomShape, nAxis, bottomShape.size())};
+		if (ipParam.bias_term()) {
+			counts.push_back(ipParam.num_output());
+		}
+		return counts;
+	} else if (strType == "BatchNorm") {
+		return {nChannels, nChannels, 1};
+	} else if (strType == "PReLU") {
+		return {layer.prelu_param().channel_shared() ? 1 : nChannels};
+	} else if (strType == "Scale" && layer.bottom_size() == 1) {
+		auto &scaleParam = layer.scale_param();
+		size_t nAxis = CanonicalAxis(scaleParam.axis(), bottomShape.size());
+		size_t nEnd = scaleParam.num_axes() < 0 ? bottomShape.size() :
+				nAxis + scaleParam.num_axes();
+		size_t nCount = DimsCount(bottomShape, nAxis, nEnd);
+		if (scaleParam.bias_term()) {
+			return {nCount, nCount};
+		}
+		return {nCount};
+	} else if (strType == "Bias" && layer.bottom_size() == 1) {
+		auto &biasParam = layer.bias_param();
+		size_t nAxis = CanonicalAxis(biasParam.axis(), bottomShape.size());
+		size_t nEnd = biasParam.num_axes() < 0 ? bottomShape.size() :
+				nAxis + biasParam.num_axes();
+		return {DimsCount(bottomShape, nAxis, nEnd)};
+	}
+	return {};
+}
+
+uint64_t LayerMacs(const caffe::LayerParameter &layer,
+		const Shape &bottomShape, const Shape &topShape) {
+	static const std::set<std::string> dataMovers = {"Input", "Concat",
+			"Slice", "Split", "Flatten", "Reshape", "Dropout", "Silence"};
+	auto &strType = layer.type();
+	uint64_t nTopCount = ShapeCount(topShape);
+	if (dataMovers.count(strType) != 0) {
+		return 0;
+	} else if (strType == "Convolution") {
+		auto &convParam = layer.convolution_param();
+		auto kernel = KernelSize(convParam);
+		size_t nChannels = bottomShape.size() > 1 ? bottomShape[1] : 1;
+		return nTopCount * (nChannels / convParam.group()) * kernel.first *
+				kernel.second;
+	} else if (strType == "InnerProduct") {
+		size_t nAxis = CanonicalAxis(layer.inner_product_param().axis(),
+				bottomShape.size());
+		return nTopCount * DimsCount(bottomShape, nAxis, bottomShape.size());
+	} else if (strType == "Pooling") {
+		auto &poolParam = layer.pooling_param();
+		if (poolParam.global_pooling()) {
+			return ShapeCount(bottomShape);
+		}
+		auto kernel = KernelSize(poolParam);
+		return nTopCount * kernel.first * kernel.second;
+	} else if (strType == "Eltwise") {
+		return nTopCount * std::max(layer.bottom_size() - 1, 1);
+	}
+	return nTopCount;
+}
+
+double ArithmeticIntensity(const LayerCost &cost) {
+	size_t nBytes = cost.nParamBytes + cost.nActivationBytes;
+	return nBytes > 0 ? 2. * cost.nMacs / nBytes : 0.;
+}
+
+std::vector<LayerCost> EstimateLayerCosts(const caffe::NetParameter &net,
+		const BlobShapes &blobShapes) {
+	auto BlobShape = [&](const std::string &strBlob) -> const Shape& {
+			auto iShape = blobShapes.find(strBlob);
+			CHECK(iShape != blobShapes.end()) << "Unknown shape of blob \"" <<
+					strBlob << "\"";
+			return iShape->second;
+		};
+	std::set<std::string> sharedParams;
+	std::vector<LayerCost> costs;
+	for (auto &layer : net.layer()) {
+		LayerCost cost = {layer.name(), layer.type(), 0, 0, 0, 0};
+		if (layer.type() == "Input") {
+			costs.emplace_back(std::move(cost));
+			continue;
+		}
+		for (auto &strBottom : layer.bottom()) {
+			cost.nActivationBytes += ShapeCount(BlobShape(strBottom)) *
+					sizeof(float);
+		}
+		for (auto &strTop : layer.top()) {
+			cost.nActivationBytes += ShapeCount(BlobShape(strTop)) *
+					sizeof(float);
+		}
+		Shape bottomShape, topShape;
+		if (layer.bottom_size() > 0) {
+			bottomShape = BlobShape(layer.bottom(0));
+		}
+		if (layer.top_size() > 0) {
+			topShape = BlobShape(layer.top(0));
+		}
+		cost.nMacs = LayerMacs(layer, bottomShape, topShape);
+		auto paramCounts = ParamCounts(layer, bottomShape);
+		for (size_t i = 0; i < paramCounts.size(); ++i) {
+			size_t nBytes = paramCounts[i] * sizeof(float);
+			cost.nParamBytes += nBytes;
+			if ((int)i >= layer.param_size() || !layer.param(i).has_name() ||
+					sharedParams.insert(layer.param(i).name()).second) {
+				cost.nOwnParamBytes += nBytes;
+			}
+		}
+		costs.emplace_back(std::move(cost));
+	}
+	return costs;
+}
+
+std::string FormatLayerCosts(const std::vector<LayerCost> &costs) {
+	std::ostringstream oss;
+	oss << std::left << std::setw(32) << "layer" << std::setw(20) << "type" <<
+			std::right << std::setw(14) << "MMACs" << std::setw(12) <<
+			"param MB" << std::setw(12) << "act MB" << std::setw(12) <<
+			"FLOP/byte";
+	oss << std::fixed;
+	for (auto &cost : costs) {
+		oss << "\n" << std::left << std::setw(32) << cost.strLayer <<
+				std::setw(20) << cost.strType << std::right <<
+				std::setprecision(3) << std::setw(14) << cost.nMacs / 1e6 <<
+				std::setw(12) << cost.nParamBytes / 1048576. <<
+				std::setw(12) << cost.nActivationBytes / 1048576. <<
+				std::setprecision(2) << std::setw(12) <<
+				ArithmeticIntensity(cost);
+	}
+	return oss.str();
+}
+
+std::string FormatCostSummary(const std::vector<LayerCost> &costs) {
+	struct TypeCost {
+		size_t nNumLayers;
+		LayerCost cost;
+	};
+	std::map<std::string, TypeCost> typeCosts;
+	LayerCost total = {"total", "", 0, 0, 0, 0};
+	size_t nNumLayers = 0;
+	for (auto &cost : costs) {
+		auto &typeCost = typeCosts[cost.strType];
+		typeCost.cost.strType = cost.strType;
+		for (auto *pSum : {&typeCost.cost, &total}) {
+			pSum->nMacs += cost.nMacs;
+			pSum->nParamBytes += cost.nOwnParamBytes;
+			pSum->nActivationBytes += cost.nActivationBytes;
+		}
+		++typeCost.nNumLayers;
+		++nNumLayers;
+	}
+	std::ostringstream oss;
+	oss << std::left << std::setw(20) << "type" << std::right <<
+			std::setw(8) << "layers" << std::setw(14) << "MMACs" <<
+			std::setw(9) << "MACs %" << std::setw(12) << "param MB" <<
+			std::setw(12) << "act MB" << std::setw(12) << "FLOP/byte";
+	oss << std::fixed;
+	auto PrintLine = [&](const std::string &strName, size_t nLayers,
+			const LayerCost &cost) {
+			oss << "\n" << std::left << std::setw(20) << strName <<
+					std::right << std::setw(8) << nLayers <<
+					std::setprecision(3) << std::setw(14) << cost.nMacs / 1e6 <<
+					std::setprecision(1) << std::setw(9) << (total.nMacs > 0 ?
+					100. * cost.nMacs / total.nMacs : 0.) <<
+					std::setprecision(3) << std::setw(12) <<
+					cost.nParamBytes / 1048576. << std::setw(12) <<
+					cost.nActivationBytes / 1048576. << std::setprecision(2) <<
+					std::setw(12) << ArithmeticIntensity(cost);
+		};
+	for (auto &typeCost : typeCosts) {
+		PrintLine(typeCost.first, typeCost.second.nNumLayers,
+				typeCost.second.cost);
+	}
+	PrintLine("total", nNumLayers, total);
+	return oss.str();
+}
+
+void WriteCostReport(const std::vector<LayerCost> &costs,
+		const std::string &strFn) {
+	Json jLayers = Json::array();
+	uint64_t nTotalMacs = 0;
+	size_t nTotalParamBytes = 0, nTotalActivationBytes = 0;
+	for (auto &cost : costs) {
+		jLayers.push_back({{"name", cost.strLayer}, {"type", cost.strType},
+				{"macs", cost.nMacs}, {"param_bytes", cost.nParamBytes},
+				{"own_param_bytes", cost.nOwnParamBytes},
+				{"activation_bytes", cost.nActivationBytes},
+				{"flops_per_byte", ArithmeticIntensity(cost)}});
+		nTotalMacs += cost.nMacs;
+		nTotalParamBytes += cost.nOwnParamBytes;
+		nTotalActivationBytes += cost.nActivationBytes;
+	}
+	Json jTotal = {{"macs", nTotalMacs}, {"param_bytes", nTotalParamBytes},
+			{"activation_bytes", nTotalActivationBytes}};
+	std::ofstream reportFile(strFn);
+	CHECK(reportFile.is_open()) << strFn;
+	reportFile << Json({{"layers", std::move(jLayers)},
+			{"total", std::move(jTotal)}}).dump(1) << std::endl;
+}
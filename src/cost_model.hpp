@@ -0,0 +1,52 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Analytical cost model of a converted caffe::NetParameter.
+*	The multiply-accumulates, the parameter bytes and the activation bytes
+*	of every layer are computed from the inferred shapes without running
+*	anything. The arithmetic intensity (2 FLOPs per MAC over the bytes read
+*	and written) tells layers bound by the memory from those bound by the
+*	compute. Element-wise layers count one MAC per output element, layers
+*	only moving data (Concat, Slice, Split, Reshape, ...) count none.
+*/
+
+#ifndef COST_MODEL_HPP_
+#define COST_MODEL_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "common.hpp"
+
+struct LayerCost {
+	std::string strLayer;
+	std::string strType;
+	uint64_t nMacs;
+	size_t nParamBytes;		// all blobs of the layer, read by each forward
+	size_t nOwnParamBytes;	// blobs not shared with layers before it
+	size_t nActivationBytes;// bottoms read and tops written
+};
+
+// FLOPs per byte of parameters and activations
+double ArithmeticIntensity(const LayerCost &cost);
+
+// Costs of all layers in their order, float32 data are assumed
+std::vector<LayerCost> EstimateLayerCosts(const caffe::NetParameter &net,
+		const BlobShapes &blobShapes);
+
+// One line for each layer
+std::string FormatLayerCosts(const std::vector<LayerCost> &costs);
+
+// One line for each type of layers and the totals
+std::string FormatCostSummary(const std::vector<LayerCost> &costs);
+
+void WriteCostReport(const std::vector<LayerCost> &costs,
+		const std::string &strFn);
+
+#endif /* COST_MODEL_HPP_ */
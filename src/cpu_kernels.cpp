@@ -0,0 +1,191 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Float32 kernels of the reference executor on CPU
+*/
+
+#include "cpu_kernels.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+
+const size_t GEMM_TILE_M = 16;
+const size_t GEMM_TILE_N = 256;
+const size_t GEMM_TILE_K = 256;
+const size_t DOT_LANES = 8;
+
+// Dot product in independent lanes, the lanes are vectorized by the
+//	compiler without reassociating the sums.
+float Dot(const float *pA, const float *pB, size_t nCount) {
+	float lanes[DOT_LANES] = {0.f};
+	size_t i = 0;
+	for (; i + DOT_LANES <= nCount; i += DOT_LANES) {
+		for (size_t l = 0; l < DOT_LANES; ++l) {
+			lanes[l] += pA[i + l] * pB[i + l];
+		}
+	}
+	float fSum = 0.f;
+	for (size_t l = 0; l < DOT_LANES; ++l) {
+		fSum += lanes[l];
+	}
+	for (; i < nCount; ++i) {
+		fSum += pA[i] * pB[i];
+	}
+	return fSum;
+}
+
+// Accumulates rows [i0, i1) and columns [j0, j1) of A * B in C. Four rows
+//	of C are updated by each row of B, the inner loops are contiguous axpy.
+void GemmTile(size_t nN, size_t nK, const float *pA, const float *pB,
+		float *pC, size_t i0, size_t i1, size_t j0, size_t j1) {
+	size_t nCols = j1 - j0;
+	for (size_t k0 = 0; k0 < nK; k0 += GEMM_TILE_K) {
+		size_t k1 = std::min(k0 + GEMM_TILE_K, nK);
+		size_t i = i0;
+		for (; i + 4 <= i1; i += 4) {
+			float *pC0 = pC + i * nN + j0;
+			float *pC1 = pC0 + nN;
+			float *pC2 = pC1 + nN;
+			float *pC3 = pC2 + nN;
+			for (size_t k = k0; k < k1; ++k) {
+				const float *pRow = pB + k * nN + j0;
+				float a0 = pA[i * nK + k];
+				float a1 = pA[(i + 1) * nK + k];
+				float a2 = pA[(i + 2) * nK + k];
+				float a3 = pA[(i + 3) * nK + k];
+				for (size_t j = 0; j < nCols; ++j) {
+					float b = pRow[j];
+					pC0[j] += a0 * b;
+					pC1[j] += a1 * b;
+					pC2[j] += a2 * b;
+					pC3[j] += a3 * b;
+				}
+			}
+		}
+		for (; i < i1; ++i) {
+			float *pCi = pC + i * nN + j0;
+			for (size_t k = k0; k < k1; ++k) {
+				const float *pRow = pB + k * nN + j0;
+				float a = pA[i * nK + k];
+				for (size_t j = 0; j < nCols; ++j) {
+					pCi[j] += a * pRow[j];
+				}
+			}
+		}
+	}
+}
+
+void Gemm(size_t nM, size_t nN, size_t nK, const float *pA, const float *pB,
+		bool bTransB, float *pC, size_t nNumThreads) {
+	size_t nTileN = bTransB ? GEMM_TILE_M : GEMM_TILE_N;
+	size_t nTilesM = (nM + GEMM_TILE_M - 1) / GEMM_TILE_M;
+	size_t nTilesN = (nN + nTileN - 1) / nTileN;
+	ParallelFor(nTilesM * nTilesN, nNumThreads, [&](size_t iTile) {
+			size_t i0 = iTile / nTilesN * GEMM_TILE_M;
+			size_t i1 = std::min(i0 + GEMM_TILE_M, nM);
+			size_t j0 = iTile % nTilesN * nTileN;
+			size_t j1 = std::min(j0 + nTileN, nN);
+			if (bTransB) {
+				for (size_t i = i0; i < i1; ++i) {
+					for (size_t j = j0; j < j1; ++j) {
+						pC[i * nN + j] = Dot(pA + i * nK, pB + j * nK, nK);
+					}
+				}
+				return;
+			}
+			for (size_t i = i0; i < i1; ++i) {
+				std::fill(pC + i * nN + j0, pC + i * nN + j1, 0.f);
+			}
+			GemmTile(nN, nK, pA, pB, pC, i0, i1, j0, j1);
+		});
+}
+
+// Columns of the windows of the channels of an image, a row for each
+//	(channel, kernel row, kernel column) and a column for each output pixel
+void Im2Col(const ConvGeometry &geo, size_t nChannels, const float *pImage,
+		float *pCol) {
+	size_t nOutSize = geo.nOutHeight * geo.nOutWidth;
+	for (size_t c = 0; c < nChannels; ++c) {
+		const float *pPlane = pImage + c * geo.nHeight * geo.nWidth;
+		for (size_t kh = 0; kh < geo.nKernelH; ++kh) {
+			for (size_t kw = 0; kw < geo.nKernelW; ++kw) {
+				float *pRow = pCol + ((c * geo.nKernelH + kh) * geo.nKernelW +
+						kw) * nOutSize;
+				for (size_t oh = 0; oh < geo.nOutHeight; ++oh) {
+					int64_t y = (int64_t)(oh * geo.nStrideH + kh * geo.nDilateH)
+							- (int64_t)geo.nPadH;
+					float *pOut = pRow + oh * geo.nOutWidth;
+					if (y < 0 || y >= (int64_t)geo.nHeight) {
+						std::fill(pOut, pOut + geo.nOutWidth, 0.f);
+						continue;
+					}
+					const float *pIn = pPlane + y * geo.nWidth;
+					for (size_t ow = 0; ow < geo.nOutWidth; ++ow) {
+						int64_t x = (int64_t)(ow * geo.nStrideW +
+								kw * geo.nDilateW) - (int64_t)geo.nPadW;
+						pOut[ow] = (x < 0 || x >= (int64_t)geo.nWidth) ?
+								0.f : pIn[x];
+					}
+				}
+			}
+		}
+	}
+}
+
+void Convolution2D(const ConvGeometry &geo, size_t nBatch,
+		const float *pInput, const float *pWeight, const float *pBias,
+		float *pOutput, size_t nNumThreads) {
+	size_t nGroupChannels = geo.nChannels / geo.nNumGroup;
+	size_t nGroupFilters = geo.nNumFilter / geo.nNumGroup;
+	size_t nColRows = nGroupChannels * geo.nKernelH * geo.nKernelW;
+	size_t nOutSize = geo.nOutHeight * geo.nOutWidth;
+	size_t nInSize = geo.nHeight * geo.nWidth;
+	// A pointwise convolution multiplies the image directly
+	bool bPointwise = geo.nKernelH == 1 && geo.nKernelW == 1 &&
+			geo.nStrideH == 1 && geo.nStrideW == 1 &&
+			geo.nPadH == 0 && geo.nPadW == 0;
+	auto RunGroup = [&](size_t iJob, size_t nGemmThreads,
+			std::vector<float> &col) {
+			size_t n = iJob / geo.nNumGroup;
+			size_t g = iJob % geo.nNumGroup;
+			const float *pImage = pInput + (n * geo.nChannels +
+					g * nGroupChannels) * nInSize;
+			const float *pCol = pImage;
+			if (!bPointwise) {
+				col.resize(nColRows * nOutSize);
+				Im2Col(geo, nGroupChannels, pImage, col.data());
+				pCol = col.data();
+			}
+			float *pOut = pOutput + (n * geo.nNumFilter + g * nGroupFilters) *
+					nOutSize;
+			Gemm(nGroupFilters, nOutSize, nColRows,
+					pWeight + g * nGroupFilters * nColRows, pCol, false, pOut,
+					nGemmThreads);
+			if (pBias != nullptr) {
+				for (size_t f = 0; f < nGroupFilters; ++f) {
+					float fBias = pBias[g * nGroupFilters + f];
+					float *pPlane = pOut + f * nOutSize;
+					for (size_t i = 0; i < nOutSize; ++i) {
+						pPlane[i] += fBias;
+					}
+				}
+			}
+		};
+	size_t nNumJobs = nBatch * geo.nNumGroup;
+	if (nNumJobs >= NumWorkerThreads(nNumThreads)) {
+		ParallelFor(nNumJobs, nNumThreads, [&](size_t iJob) {
+				std::vector<float> col;
+				RunGroup(iJob, 1, col);
+			});
+	} else {
+		std::vector<float> col;
+		for (size_t iJob = 0; iJob < nNumJobs; ++iJob) {
+			RunGroup(iJob, nNumThreads, col);
+		}
+	}
+}
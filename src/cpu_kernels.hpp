@@ -0,0 +1,39 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Float32 kernels of the reference executor on CPU.
+*	Matrices are row-major. The loops are tiled for the caches and written
+*	in the shapes the compiler vectorizes (contiguous axpy and dot products
+*	of independent lanes), tiles are run in parallel by ParallelFor.
+*/
+
+#ifndef CPU_KERNELS_HPP_
+#define CPU_KERNELS_HPP_
+
+#include <cstddef>
+
+// C[M, N] = A[M, K] * B[K, N], or A[M, K] * B[N, K]^T if bTransB.
+//	C is overwritten.
+void Gemm(size_t nM, size_t nN, size_t nK, const float *pA, const float *pB,
+		bool bTransB, float *pC, size_t nNumThreads);
+
+struct ConvGeometry {
+	size_t nChannels, nHeight, nWidth;	// of the input
+	size_t nNumFilter, nOutHeight, nOutWidth;
+	size_t nKernelH, nKernelW;
+	size_t nStrideH, nStrideW;
+	size_t nPadH, nPadW;
+	size_t nDilateH, nDilateW;
+	size_t nNumGroup;
+};
+
+// 2D convolution of NCHW by im2col and Gemm, pBias could be null.
+//	Images and groups are run in parallel if there are enough of them,
+//	otherwise the Gemm of each one is parallel.
+void Convolution2D(const ConvGeometry &geo, size_t nBatch,
+		const float *pInput, const float *pWeight, const float *pBias,
+		float *pOutput, size_t nNumThreads);
+
+#endif /* CPU_KERNELS_HPP_ */
@@ -0,0 +1,98 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Messages between the conversion daemon and its clients
+*/
+
+#include "daemon_protocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+sockaddr_un UnixSocketAddress(const std::string &strSocketFn) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	CHECK_LT(strSocketFn.size(), sizeof(addr.sun_path)) <<
+			"Path of socket too long: " << strSocketFn;
+	memcpy(addr.sun_path, strSocketFn.c_str(), strSocketFn.size());
+	return addr;
+}
+
+int ListenUnixSocket(const std::string &strSocketFn) {
+	auto addr = UnixSocketAddress(strSocketFn);
+	struct stat fileStat;
+	if (lstat(strSocketFn.c_str(), &fileStat) == 0) {
+		CHECK(S_ISSOCK(fileStat.st_mode)) << strSocketFn <<
+				" exists and is not a socket";
+		CHECK_LT(ConnectUnixSocket(strSocketFn), 0) <<
+				"Another daemon listens on " << strSocketFn;
+		unlink(strSocketFn.c_str());
+	}
+	int nFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	CHECK_GE(nFd, 0) << strerror(errno);
+	CHECK_EQ(bind(nFd, (sockaddr*)&addr, sizeof(addr)), 0) << strSocketFn <<
+			": " << strerror(errno);
+	// Jobs read and write files as the daemon, only its user may connect
+	CHECK_EQ(chmod(strSocketFn.c_str(), S_IRUSR | S_IWUSR), 0) <<
+			strSocketFn << ": " << strerror(errno);
+	CHECK_EQ(listen(nFd, SOMAXCONN), 0) << strerror(errno);
+	return nFd;
+}
+
+int ConnectUnixSocket(const std::string &strSocketFn) {
+	auto addr = UnixSocketAddress(strSocketFn);
+	int nFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	CHECK_GE(nFd, 0) << strerror(errno);
+	if (connect(nFd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(nFd);
+		return -1;
+	}
+	return nFd;
+}
+
+bool SendJsonLine(int nFd, const Json &jMessage) {
+	std::string strLine = jMessage.dump() + "\n";
+	for (size_t nSent = 0; nSent < strLine.size(); ) {
+		ssize_t nRet = send(nFd, strLine.data() + nSent,
+				strLine.size() - nSent, MSG_NOSIGNAL);
+		if (nRet < 0 && errno == EINTR) {
+			continue;
+		} else if (nRet <= 0) {
+			return false;
+		}
+		nSent += nRet;
+	}
+	return true;
+}
+
+void LineBuffer::Append(const char *pData, size_t nBytes) {
+	m_strBuffer.append(pData, nBytes);
+}
+
+bool LineBuffer::PopLine(std::string &strLine) {
+	size_t nEnd = m_strBuffer.find('\n');
+	if (nEnd == std::string::npos) {
+		return false;
+	}
+	strLine = m_strBuffer.substr(0, nEnd);
+	m_strBuffer.erase(0, nEnd + 1);
+	return true;
+}
+
+std::string LineBuffer::PopRest() {
+	std::string strRest;
+	strRest.swap(m_strBuffer);
+	return strRest;
+}
+
+size_t LineBuffer::Size() const {
+	return m_strBuffer.size();
+}
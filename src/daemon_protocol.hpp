@@ -0,0 +1,53 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Messages between the conversion daemon and its clients, one json per
+*	line over a Unix domain socket.
+*	The client sends one job, a config json (see README) with two more keys:
+*	"work_path", the path the files of the config are relative to, and
+*	"args", the flags of the command line (--profile, --benchmark, ...).
+*	The daemon answers with events until the job is done:
+*		{"event": "queued", "position": <jobs waiting before it>}
+*		{"event": "started", "cached": <whether the MxNet files were loaded>}
+*		{"event": "log", "line": <a line of the output of the conversion>}
+*		{"event": "done", "succeeded": <bool>, "error": <fatal line>,
+*			"wall_seconds": ..., "cpu_seconds": ..., "peak_rss_bytes": ...}
+*	and closes the connection.
+*/
+
+#ifndef DAEMON_PROTOCOL_HPP_
+#define DAEMON_PROTOCOL_HPP_
+
+#include <string>
+
+#include "json_helper.hpp"
+
+// Socket of the daemon if none is given
+const char DEFAULT_DAEMON_SOCKET[] = "/tmp/mxnet2caffe.sock";
+
+// Socket listening on the path, a stale socket there is replaced. It is
+//	made accessible to the user only, before it listens.
+int ListenUnixSocket(const std::string &strSocketFn);
+
+// Socket connected to the path, -1 if nothing listens there
+int ConnectUnixSocket(const std::string &strSocketFn);
+
+// Sends the json in one line on a blocking socket, false if the peer is gone
+bool SendJsonLine(int nFd, const Json &jMessage);
+
+// Splits the bytes received into lines
+class LineBuffer {
+public:
+	void Append(const char *pData, size_t nBytes);
+	// Takes the first complete line without its '\n', false if none
+	bool PopLine(std::string &strLine);
+	// Takes what is left after the last complete line
+	std::string PopRest();
+	size_t Size() const;
+private:
+	std::string m_strBuffer;
+};
+
+#endif /* DAEMON_PROTOCOL_HPP_ */
@@ -0,0 +1,104 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Loading a caffe::Net from a caffemodel with external weights
+*/
+
+#include "external_weights.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <google/protobuf/unknown_field_set.h>
+#include <glog/logging.h>
+
+namespace proto = google::protobuf;
+
+// Offset of the blob data in the weights file
+size_t ExternalOffset(const caffe::BlobProto &blobProto) {
+	auto &unknownFields = blobProto.GetReflection()->GetUnknownFields(
+			blobProto);
+	for (int i = 0; i < unknownFields.field_count(); ++i) {
+		auto &field = unknownFields.field(i);
+		if (field.number() == EXTERNAL_OFFSET_FIELD &&
+				field.type() == proto::UnknownField::TYPE_VARINT) {
+			return (size_t)field.varint();
+		}
+	}
+	LOG(FATAL) << "Blob without external offset";
+	return 0;
+}
+
+std::shared_ptr<const void> LoadExternalWeights(caffe::Net<float> &net,
+		const std::string &strModelFn, const std::string &strWeightsFn) {
+	caffe::NetParameter model;
+	CHECK(caffe::ReadProtoFromBinaryFile(strModelFn.c_str(), &model)) <<
+			strModelFn;
+
+	int fd = open(strWeightsFn.c_str(), O_RDONLY);
+	CHECK_GE(fd, 0) << strWeightsFn << ": " << strerror(errno);
+	struct stat fileStat;
+	CHECK_EQ(fstat(fd, &fileStat), 0) << strWeightsFn << ": " << strerror(errno);
+	size_t nFileBytes = fileStat.st_size;
+	CHECK_GE(nFileBytes, sizeof(ExternalWeightsHeader)) << strWeightsFn;
+	// Private and writable, so that blobs of the net are still mutable
+	void *pMap = mmap(nullptr, nFileBytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	CHECK(pMap != MAP_FAILED) << strWeightsFn << ": " << strerror(errno);
+	close(fd);
+	std::shared_ptr<const void> pFile(pMap, [nFileBytes](const void *p) {
+			munmap((void*)p, nFileBytes);
+		});
+
+	ExternalWeightsHeader header;
+	memcpy(&header, pMap, sizeof(header));
+	CHECK_EQ(memcmp(header.magic, EXTERNAL_MAGIC, sizeof(header.magic)), 0) <<
+			strWeightsFn << " is not a weights file";
+	CHECK_EQ(header.nVersion, 1);
+	CHECK_EQ(header.nFileBytes, nFileBytes) << strWeightsFn << " is truncated";
+
+	std::map<std::string, size_t> layerIndices;
+	for (size_t i = 0; i < net.layer_names().size(); ++i) {
+		layerIndices[net.layer_names()[i]] = i;
+	}
+	size_t nNumBlobs = 0;
+	for (auto &layerProto : model.layer()) {
+		if (layerProto.blobs_size() == 0) {
+			continue;
+		}
+		auto iLayer = layerIndices.find(layerProto.name());
+		if (iLayer == layerIndices.end()) {
+			LOG(INFO) << "Ignoring layer " << layerProto.name();
+			continue;
+		}
+		auto &netBlobs = net.layers()[iLayer->second]->blobs();
+		CHECK_EQ(netBlobs.size(), layerProto.blobs_size()) << "Number of " <<
+				"blobs mismatch for layer " << layerProto.name();
+		for (int j = 0; j < layerProto.blobs_size(); ++j) {
+			auto &blobProto = layerProto.blobs(j);
+			auto &pNetBlob = netBlobs[j];
+			CHECK_EQ(pNetBlob->num_axes(), blobProto.shape().dim_size()) <<
+					layerProto.name();
+			for (int k = 0; k < pNetBlob->num_axes(); ++k) {
+				CHECK_EQ(pNetBlob->shape(k), blobProto.shape().dim(k)) <<
+						"Shape of blob " << j << " mismatch for layer " <<
+						layerProto.name();
+			}
+			size_t nOffset = ExternalOffset(blobProto);
+			CHECK_EQ(nOffset % EXTERNAL_ALIGNMENT, 0);
+			CHECK_LE(nOffset + pNetBlob->count() * sizeof(float), nFileBytes) <<
+					"Blob " << j << " of layer " << layerProto.name() <<
+					" is out of " << strWeightsFn;
+			pNetBlob->set_cpu_data((float*)((char*)pMap + nOffset));
+			++nNumBlobs;
+		}
+	}
+	LOG(INFO) << "Mapped " << nNumBlobs << " blobs from " << strWeightsFn;
+	return pFile;
+}
@@ -0,0 +1,48 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* External weights of a caffemodel, for models beyond the 2GB limit of
+*	protobuf. The caffemodel keeps the structure and the shapes of blobs,
+*	each blob has the offset of its data in a raw weights file instead of
+*	the data field. Data of blobs are float32 aligned to 64 bytes, so the
+*	weights file can be memory mapped and used in place.
+*/
+
+#ifndef EXTERNAL_WEIGHTS_HPP_
+#define EXTERNAL_WEIGHTS_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+// Field number of the data offset in BlobProto, an unknown field to Caffe
+const int EXTERNAL_OFFSET_FIELD = 100;
+const size_t EXTERNAL_ALIGNMENT = 64;
+const char EXTERNAL_MAGIC[8] = {'C', 'A', 'F', 'F', 'E', 'W', 'T', 'S'};
+
+// The first 64 bytes of a weights file
+struct ExternalWeightsHeader {
+	char magic[8];
+	uint64_t nVersion;		// 1
+	uint64_t nNumBlobs;
+	uint64_t nFileBytes;
+	uint8_t reserved[32];
+};
+
+inline size_t AlignExternalOffset(size_t nOffset) {
+	return (nOffset + EXTERNAL_ALIGNMENT - 1) / EXTERNAL_ALIGNMENT *
+			EXTERNAL_ALIGNMENT;
+}
+
+// Fills blobs of the net by the caffemodel and the weights file written in
+//	external mode. Blobs use the mapped file directly (copy-on-write), the
+//	returned handle keeps the file mapped and must outlive the net.
+std::shared_ptr<const void> LoadExternalWeights(caffe::Net<float> &net,
+		const std::string &strModelFn, const std::string &strWeightsFn);
+
+#endif /* EXTERNAL_WEIGHTS_HPP_ */
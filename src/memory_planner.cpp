@@ -0,0 +1,198 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Activation memory planning of a converted caffe::NetParameter.
+*/
+
+#include "memory_planner.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <glog/logging.h>
+
+struct BlobLife {
+	size_t nDef;		// index of the first layer writing the blob
+	size_t nLastUse;	// index of the last layer reading or writing it
+	size_t nBytes;
+	bool bOutput;		// not consumed after its last write
+};
+
+size_t ShapeBytes(const Shape &shape) {
+	return std::accumulate(shape.begin(), shape.end(), sizeof(float),
+			std::multiplies<size_t>());
+}
+
+std::map<std::string, BlobLife> ComputeLiveness(
+		const caffe::NetParameter &net, const BlobShapes &blobShapes) {
+	std::map<std::string, BlobLife> lives;
+	for (int i = 0; i < net.layer_size(); ++i) {
+		auto &layer = net.layer(i);
+		for (auto &strBottom : layer.bottom()) {
+			auto iLife = lives.find(strBottom);
+			CHECK(iLife != lives.end()) << "Blob \"" << strBottom <<
+					"\" used by \"" << layer.name() << "\" before defined";
+			iLife->second.nLastUse = i;
+			iLife->second.bOutput = false;
+		}
+		for (auto &strTop : layer.top()) {
+			auto iLife = lives.find(strTop);
+			if (iLife == lives.end()) {
+				auto iShape = blobShapes.find(strTop);
+				CHECK(iShape != blobShapes.end()) << "Unknown shape of blob \""
+						<< strTop << "\"";
+				BlobLife life = {(size_t)i, (size_t)i,
+						ShapeBytes(iShape->second), true};
+				lives.emplace(strTop, life);
+			} else {
+				iLife->second.nLastUse = i;
+				iLife->second.bOutput = true;
+			}
+		}
+	}
+	// Outputs of the net are kept alive until the end
+	for (auto &life : lives) {
+		if (life.second.bOutput) {
+			life.second.nLastUse = net.layer_size();
+		}
+	}
+	return lives;
+}
+
+MemoryReport PlanActivationMemory(const caffe::NetParameter &net,
+		const BlobShapes &blobShapes) {
+	auto lives = ComputeLiveness(net, blobShapes);
+	MemoryReport report = {lives.size(), 0, 0, 0, 0};
+
+	// Peak of live bytes by sweeping the def/free events along the layers
+	std::vector<int64_t> deltas(net.layer_size() + 2, 0);
+	for (auto &life : lives) {
+		report.nAllocBytes += life.second.nBytes;
+		deltas[life.second.nDef] += life.second.nBytes;
+		deltas[life.second.nLastUse + 1] -= life.second.nBytes;
+	}
+	int64_t nLiveBytes = 0;
+	for (auto nDelta : deltas) {
+		nLiveBytes += nDelta;
+		report.nPeakBytes = std::max(report.nPeakBytes, (size_t)nLiveBytes);
+	}
+
+	// Best-fit assignment of blobs to buffers in the order of definition
+	std::vector<const BlobLife*> blobsByDef;
+	for (auto &life : lives) {
+		blobsByDef.push_back(&life.second);
+	}
+	std::stable_sort(blobsByDef.begin(), blobsByDef.end(),
+			[](const BlobLife *p1, const BlobLife *p2) {
+				return p1->nDef < p2->nDef;
+			}
+		);
+	using ActiveBuffer = std::pair<size_t, size_t>; // last use, buffer id
+	std::priority_queue<ActiveBuffer, std::vector<ActiveBuffer>,
+			std::greater<ActiveBuffer>> activeBuffers;
+	std::multimap<size_t, size_t> freeBuffers; // size, buffer id
+	std::vector<size_t> bufferSizes;
+	for (auto pLife : blobsByDef) {
+		while (!activeBuffers.empty() &&
+				activeBuffers.top().first < pLife->nDef) {
+			size_t nBufId = activeBuffers.top().second;
+			freeBuffers.emplace(bufferSizes[nBufId], nBufId);
+			activeBuffers.pop();
+		}
+		size_t nBufId = bufferSizes.size();
+		auto iFree = freeBuffers.lower_bound(pLife->nBytes);
+		if (iFree == freeBuffers.end() && !freeBuffers.empty()) {
+			--iFree; // the largest one, grows to fit the blob
+		}
+		if (iFree != freeBuffers.end()) {
+			nBufId = iFree->second;
+			bufferSizes[nBufId] = std::max(bufferSizes[nBufId], pLife->nBytes);
+			freeBuffers.erase(iFree);
+		} else {
+			bufferSizes.push_back(pLife->nBytes);
+		}
+		activeBuffers.emplace(pLife->nLastUse, nBufId);
+	}
+	report.nNumBuffers = bufferSizes.size();
+	report.nPlanBytes = std::accumulate(bufferSizes.begin(),
+			bufferSizes.end(), size_t(0));
+	return report;
+}
+
+// Caffe layers supporting the in-place computation of top(0) on bottom(0)
+bool IsInPlaceCapable(const std::string &strType) {
+	static std::set<std::string> inPlaceTypes = {
+			"ReLU", "PReLU", "ELU", "Sigmoid", "TanH", "AbsVal", "Power",
+			"Dropout", "BatchNorm", "Scale", "Bias"
+		};
+	return inPlaceTypes.find(strType) != inPlaceTypes.end();
+}
+
+void RenameLayerBlobs(caffe::LayerParameter &layer,
+		const BlobRenames &renames) {
+	auto Rename = [&](std::string &strBlob) {
+			auto iRename = renames.find(strBlob);
+			if (iRename != renames.end()) {
+				strBlob = iRename->second;
+			}
+		};
+	std::for_each(layer.mutable_bottom()->begin(),
+			layer.mutable_bottom()->end(), Rename);
+	std::for_each(layer.mutable_top()->begin(),
+			layer.mutable_top()->end(), Rename);
+}
+
+BlobRenames ReuseDeadBlobs(caffe::NetParameter &net,
+		const BlobShapes &blobShapes) {
+	auto lives = ComputeLiveness(net, blobShapes);
+	std::set<std::string> netInputs;
+	BlobRenames renames;
+	for (int i = 0; i < net.layer_size(); ++i) {
+		auto &layer = *net.mutable_layer(i);
+		RenameLayerBlobs(layer, renames);
+		if (layer.type() == "Input") {
+			netInputs.insert(layer.top().begin(), layer.top().end());
+		}
+		if (!IsInPlaceCapable(layer.type()) || layer.bottom_size() == 0 ||
+				layer.top_size() != 1 || layer.top(0) == layer.bottom(0)) {
+			continue;
+		}
+		const std::string strBottom = layer.bottom(0);
+		const std::string strTop = layer.top(0);
+		auto &bottomLife = lives.at(strBottom);
+		auto &topLife = lives.at(strTop);
+		// The bottom must be dead after this layer, and the input of the net
+		// or the outputs should keep their own names.
+		if (bottomLife.nLastUse != (size_t)i || topLife.bOutput ||
+				netInputs.count(strBottom) ||
+				bottomLife.nBytes != topLife.nBytes ||
+				std::count(layer.bottom().begin(), layer.bottom().end(),
+						strBottom) != 1) {
+			continue;
+		}
+		renames[strTop] = strBottom;
+		*layer.mutable_top(0) = strBottom;
+		bottomLife.nLastUse = topLife.nLastUse;
+	}
+	return renames;
+}
+
+std::string FormatMemoryReport(const MemoryReport &report) {
+	auto MiB = [](size_t nBytes) {
+			std::ostringstream oss;
+			oss << std::fixed << std::setprecision(2) <<
+					nBytes / (1024. * 1024.) << " MiB";
+			return oss.str();
+		};
+	std::ostringstream oss;
+	oss << report.nNumBlobs << " blobs, " << MiB(report.nAllocBytes) <<
+			" allocated, " << MiB(report.nPeakBytes) << " peak live, " <<
+			MiB(report.nPlanBytes) << " in " << report.nNumBuffers <<
+			" best-fit buffers";
+	return oss.str();
+}
@@ -0,0 +1,42 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Activation memory planning of a converted caffe::NetParameter.
+*	Computes the liveness of every blob, the peak of live activations and
+*	a best-fit buffer assignment, and renames tops to reuse dead bottoms
+*	where Caffe allows it (in-place computation).
+*/
+
+#ifndef MEMORY_PLANNER_HPP_
+#define MEMORY_PLANNER_HPP_
+
+#include <map>
+#include <string>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "common.hpp"
+
+using BlobRenames = std::map<std::string, std::string>;
+
+struct MemoryReport {
+	size_t nNumBlobs;	// distinct blobs, each one allocated by caffe
+	size_t nNumBuffers;	// buffers of the best-fit assignment
+	size_t nAllocBytes;	// sum of all distinct blobs
+	size_t nPeakBytes;	// maximum of the simultaneously live blobs
+	size_t nPlanBytes;	// sum of buffers of the best-fit assignment
+};
+
+MemoryReport PlanActivationMemory(const caffe::NetParameter &net,
+		const BlobShapes &blobShapes);
+
+// Returns the renamed tops, the net is modified in place
+BlobRenames ReuseDeadBlobs(caffe::NetParameter &net,
+		const BlobShapes &blobShapes);
+
+std::string FormatMemoryReport(const MemoryReport &report);
+
+#endif /* MEMORY_PLANNER_HPP_ */
@@ -0,0 +1,450 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Writing the caffemodel directly from the loaded MxNet parameters.
+*/
+
+#include "model_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <set>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <glog/logging.h>
+
+#include "external_weights.hpp"
+#include "parallel.hpp"
+#include "shape_inference.hpp"
+
+namespace proto = google::protobuf;
+using WireFormat = proto::internal::WireFormatLite;
+
+// Number of blobs created by caffe for a layer
+size_t NumCaffeBlobs(const caffe::LayerParameter &layer) {
+	auto &strType = layer.type();
+	if (strType == "Convolution") {
+		return 1 + layer.convolution_param().bias_term();
+	} else if (strType == "InnerProduct") {
+		return 1 + layer.inner_product_param().bias_term();
+	} else if (strType == "BatchNorm") {
+		return 3; // mean, var and the scale factor of moving average
+	} else if (strType == "Scale") {
+		return (layer.bottom_size() == 1) + layer.scale_param().bias_term();
+	} else if (strType == "Bias") {
+		return (layer.bottom_size() == 1);
+	} else if (strType == "PReLU") {
+		return 1;
+	}
+	return 0;
+}
+
+// The gamma of a BatchNorm with fix_gamma is tagged by ExpandOrMergeLayers,
+// it's not learned by MxNet and filled by the constant filler of the layer.
+bool IsFixedGammaScale(const caffe::LayerParameter &layer) {
+	return layer.type() == "Scale" && layer.param_size() >= 1 &&
+			layer.param(0).decay_mult() == 100.f;
+}
+
+CaffeWeights BindCaffeWeights(const caffe::NetParameter &net,
+		const std::map<std::string, std::vector<std::string>> &blobMapping,
+		const std::vector<MxnetParam> &mxnetParams,
+		const BlobShapes &blobShapes) {
+	std::map<std::string, const MxnetParam*> paramsByName;
+	for (auto &param : mxnetParams) {
+		paramsByName[param.strName] = &param;
+	}
+	std::set<std::string> sharedNames; // ParamSpec names of bound blobs
+	CaffeWeights weights;
+	for (int i = 0; i < net.layer_size(); ++i) {
+		auto &layer = net.layer(i);
+		size_t nNumBlobs = NumCaffeBlobs(layer);
+		auto iBlobMap = blobMapping.find(layer.name());
+		if (iBlobMap == blobMapping.end()) {
+			CHECK_EQ(nNumBlobs, 0) << "No parameter for layer " << layer.name();
+			continue;
+		}
+		auto &blobNames = iBlobMap->second;
+		bool bShared = ((int)nNumBlobs <= layer.param_size());
+		for (int j = 0; j < layer.param_size(); ++j) {
+			auto &strName = layer.param(j).name();
+			bool bBound = !strName.empty() && !sharedNames.insert(strName).second;
+			bShared = bShared && (j >= (int)nNumBlobs || bBound);
+		}
+		LayerWeights layerWeights = {i, {}, bShared};
+		for (size_t j = 0; j < blobNames.size(); ++j) {
+			CHECK(!blobNames[j].empty()) << "Parameter " << j <<
+					" of layer " << layer.name() << " is missing";
+			auto iParam = paramsByName.find(blobNames[j]);
+			auto iShape = blobShapes.find(blobNames[j]);
+			bool bFixedGamma = (j == 0 && IsFixedGammaScale(layer));
+			WeightBlob blob;
+			if (iShape != blobShapes.end()) {
+				blob.shape = iShape->second;
+			} else {
+				CHECK(iParam != paramsByName.end()) << "Parameter " <<
+						blobNames[j] << " not found";
+				blob.shape = iParam->second->shape;
+			}
+			if (bFixedGamma) {
+				weights.constants.emplace_back(ShapeCount(blob.shape),
+						layer.scale_param().filler().value());
+				blob.pData = weights.constants.back().data();
+			} else {
+				CHECK(iParam != paramsByName.end()) << "Parameter " <<
+						blobNames[j] << " not found";
+				CHECK_EQ(ShapeCount(blob.shape), iParam->second->nCount) <<
+						"Parameter " << blobNames[j] << " of shape " <<
+						ShapeString(iParam->second->shape) << " mismatches " <<
+						ShapeString(blob.shape) << " of layer " << layer.name();
+				blob.pData = iParam->second->pData;
+			}
+			layerWeights.blobs.emplace_back(std::move(blob));
+		}
+		if (layer.type() == "BatchNorm") {
+			// Caffe divides mean and var by the scale factor
+			weights.constants.emplace_back(1, 1.f);
+			layerWeights.blobs.push_back(
+					{Shape{1}, weights.constants.back().data()});
+		}
+		CHECK_EQ(layerWeights.blobs.size(), nNumBlobs) <<
+				"Number of blobs mismatch for layer " << layer.name();
+		weights.layers.emplace_back(std::move(layerWeights));
+	}
+	return weights;
+}
+
+caffe::NetParameter InferenceNet(const caffe::NetParameter &net) {
+	caffe::NetParameter inferenceNet(net);
+	inferenceNet.mutable_state()->set_phase(caffe::TEST);
+	for (auto &layer : *inferenceNet.mutable_layer()) {
+		if (layer.type() == "BatchNorm") {
+			layer.mutable_batch_norm_param()->set_use_global_stats(true);
+		}
+	}
+	return inferenceNet;
+}
+
+void BindNetWeights(caffe::Net<float> &caffeNet,
+		const caffe::NetParameter &net, const CaffeWeights &weights) {
+	std::map<std::string, size_t> layerIndices;
+	for (size_t i = 0; i < caffeNet.layer_names().size(); ++i) {
+		layerIndices[caffeNet.layer_names()[i]] = i;
+	}
+	for (auto &layerWeights : weights.layers) {
+		if (layerWeights.bShared) {
+			continue;
+		}
+		auto &layer = net.layer(layerWeights.nLayerIdx);
+		auto &strName = layer.name();
+		// The weights may be read-only and shared by other nets
+		CHECK(layer.type() != "BatchNorm" ||
+				layer.batch_norm_param().use_global_stats()) << strName <<
+				" would update its weights, the net is not an InferenceNet";
+		auto iLayer = layerIndices.find(strName);
+		CHECK(iLayer != layerIndices.end()) << "Layer " << strName <<
+				" not found in the caffe::Net";
+		auto &netBlobs = caffeNet.layers()[iLayer->second]->blobs();
+		CHECK_EQ(netBlobs.size(), layerWeights.blobs.size()) << "Number of " <<
+				"blobs mismatch for layer " << strName;
+		for (size_t j = 0; j < netBlobs.size(); ++j) {
+			auto &blob = layerWeights.blobs[j];
+			CHECK_EQ((size_t)netBlobs[j]->count(), ShapeCount(blob.shape)) <<
+					"Shape of blob " << j << " mismatch for layer " << strName;
+			// Caffe does not write to weights in forward of an InferenceNet
+			netBlobs[j]->set_cpu_data(const_cast<float*>(blob.pData));
+		}
+	}
+}
+
+caffe::NetParameter BuildCaffeModel(const caffe::NetParameter &net,
+		const CaffeWeights &weights) {
+	std::vector<const LayerWeights*> layerWeights(net.layer_size(), nullptr);
+	for (auto &lw : weights.layers) {
+		layerWeights[lw.nLayerIdx] = &lw;
+	}
+	caffe::NetParameter model(net);
+	model.clear_layer();
+	for (int i = 0; i < net.layer_size(); ++i) {
+		if (layerWeights[i] != nullptr && layerWeights[i]->bShared) {
+			continue;
+		}
+		auto &layer = *model.add_layer();
+		layer = net.layer(i);
+		if (layerWeights[i] == nullptr) {
+			continue;
+		}
+		for (auto &blob : layerWeights[i]->blobs) {
+			auto &blobProto = *layer.add_blobs();
+			auto &blobShape = *blobProto.mutable_shape();
+			for (auto d : blob.shape) {
+				blobShape.add_dim((int64_t)d);
+			}
+			size_t nCount = ShapeCount(blob.shape);
+			auto &data = *blobProto.mutable_data();
+			data.Resize((int)nCount, 0.f);
+			std::memcpy(data.mutable_data(), blob.pData,
+					nCount * sizeof(float));
+		}
+	}
+	return model;
+}
+
+// A piece of the serialized caffemodel, either owned bytes or the referenced
+//	data of a blob
+struct WireChunk {
+	std::string strBytes;
+	const void *pData;	// nullptr if the bytes are owned
+	size_t nBytes;
+};
+
+void AppendBytes(std::vector<WireChunk> &chunks, const std::string &strBytes) {
+	if (chunks.empty() || chunks.back().pData != nullptr) {
+		chunks.push_back({std::string(), nullptr, 0});
+	}
+	chunks.back().strBytes.append(strBytes);
+	chunks.back().nBytes = chunks.back().strBytes.size();
+}
+
+void AppendPayload(std::vector<WireChunk> &chunks,
+		const void *pData, size_t nBytes) {
+	if (nBytes > 0) {
+		chunks.push_back({std::string(), pData, nBytes});
+	}
+}
+
+std::string EncodeVarint(uint64_t nValue) {
+	uint8_t buf[10]; // at most 10 bytes for 64-bit varint
+	uint8_t *pEnd = proto::io::CodedOutputStream::WriteVarint64ToArray(
+			nValue, buf);
+	return std::string((const char*)buf, pEnd - buf);
+}
+
+// Tag and length of a length-delimited field
+std::string EncodeFieldHeader(int nField, uint64_t nLength) {
+	return EncodeVarint(WireFormat::MakeTag(nField,
+			WireFormat::WIRETYPE_LENGTH_DELIMITED)) + EncodeVarint(nLength);
+}
+
+// Position of the first field numbered after nField in a serialized message.
+//	Protobuf serializes known fields in the order of their numbers.
+size_t FindFieldsAfter(const std::string &strMsg, int nField) {
+	proto::io::CodedInputStream input((const uint8_t*)strMsg.data(),
+			(int)strMsg.size());
+	for (; ; ) {
+		size_t nPos = input.CurrentPosition();
+		uint32_t nTag = input.ReadTag();
+		if (nTag == 0 || (int)WireFormat::GetTagFieldNumber(nTag) > nField) {
+			return nPos;
+		}
+		CHECK(WireFormat::SkipField(&input, nTag));
+	}
+}
+
+// Appends the blobs field of a layer, returns the number of bytes. With
+//	pOffsets the data are replaced by their offsets in the weights file.
+size_t AppendBlobs(std::vector<WireChunk> &chunks,
+		const LayerWeights &layerWeights, const std::vector<size_t> *pOffsets) {
+	size_t nTotalBytes = 0;
+	for (size_t i = 0; i < layerWeights.blobs.size(); ++i) {
+		auto &blob = layerWeights.blobs[i];
+		caffe::BlobShape blobShape;
+		for (auto d : blob.shape) {
+			blobShape.add_dim((int64_t)d);
+		}
+		std::string strShape = blobShape.SerializeAsString();
+		strShape = EncodeFieldHeader(caffe::BlobProto::kShapeFieldNumber,
+				strShape.size()) + strShape;
+		size_t nDataBytes = ShapeCount(blob.shape) * sizeof(float);
+		std::string strData; // empty packed field is omitted
+		if (pOffsets != nullptr) {
+			strShape += EncodeVarint(WireFormat::MakeTag(EXTERNAL_OFFSET_FIELD,
+					WireFormat::WIRETYPE_VARINT)) + EncodeVarint((*pOffsets)[i]);
+			nDataBytes = 0;
+		} else if (nDataBytes > 0) {
+			strData = EncodeFieldHeader(caffe::BlobProto::kDataFieldNumber,
+					nDataBytes);
+		}
+		size_t nBlobBytes = strData.size() + nDataBytes + strShape.size();
+		std::string strBlob = EncodeFieldHeader(
+				caffe::LayerParameter::kBlobsFieldNumber, nBlobBytes);
+		nTotalBytes += strBlob.size() + nBlobBytes;
+		// data (5) goes before shape (7), floats are little-endian as on wire
+		AppendBytes(chunks, strBlob + strData);
+		AppendPayload(chunks, blob.pData, nDataBytes);
+		AppendBytes(chunks, strShape);
+	}
+	return nTotalBytes;
+}
+
+// Encodes a layer with its blobs as an element of NetParameter::layer
+void EncodeLayer(const caffe::LayerParameter &layer,
+		const LayerWeights *pLayerWeights, const std::vector<size_t> *pOffsets,
+		std::vector<WireChunk> &chunks) {
+	CHECK_EQ(layer.blobs_size(), 0) << layer.name();
+	std::string strLayer = layer.SerializeAsString();
+	size_t nSplit = FindFieldsAfter(strLayer,
+			caffe::LayerParameter::kBlobsFieldNumber);
+	std::vector<WireChunk> blobChunks;
+	size_t nBlobBytes = 0;
+	if (pLayerWeights != nullptr) {
+		nBlobBytes = AppendBlobs(blobChunks, *pLayerWeights, pOffsets);
+	}
+	AppendBytes(chunks, EncodeFieldHeader(
+			caffe::NetParameter::kLayerFieldNumber,
+			strLayer.size() + nBlobBytes) + strLayer.substr(0, nSplit));
+	for (auto &chunk : blobChunks) {
+		if (chunk.pData == nullptr) {
+			AppendBytes(chunks, chunk.strBytes);
+		} else {
+			AppendPayload(chunks, chunk.pData, chunk.nBytes);
+		}
+	}
+	AppendBytes(chunks, strLayer.substr(nSplit));
+}
+
+size_t ChunksBytes(const std::vector<WireChunk> &chunks) {
+	size_t nBytes = 0;
+	for (auto &chunk : chunks) {
+		nBytes += chunk.nBytes;
+	}
+	return nBytes;
+}
+
+// Writes the chunks at nOffset of the file
+void WriteChunksAt(int fd, const std::vector<WireChunk> &chunks,
+		size_t nOffset, const std::string &strModelFn) {
+	std::vector<iovec> iovecs;
+	for (auto &chunk : chunks) {
+		const void *pBytes = chunk.pData ? chunk.pData : chunk.strBytes.data();
+		iovecs.push_back({(void*)pBytes, chunk.nBytes});
+	}
+	for (size_t i = 0; i < iovecs.size(); ) {
+		int nNumVecs = (int)std::min(iovecs.size() - i, (size_t)IOV_MAX);
+		ssize_t nWritten = pwritev(fd, &iovecs[i], nNumVecs, (off_t)nOffset);
+		if (nWritten < 0 && errno == EINTR) {
+			continue;
+		}
+		CHECK_GE(nWritten, 0) << strModelFn << ": " << strerror(errno);
+		nOffset += nWritten;
+		// Skip the written vectors and advance a partially written one
+		for (; i < iovecs.size() && (size_t)nWritten >= iovecs[i].iov_len; ++i) {
+			nWritten -= iovecs[i].iov_len;
+		}
+		if (nWritten > 0) {
+			iovecs[i].iov_base = (char*)iovecs[i].iov_base + nWritten;
+			iovecs[i].iov_len -= nWritten;
+		}
+	}
+}
+
+// Creates the file of nBytes for writing at offsets
+int OpenForWriting(const std::string &strFn, size_t nBytes) {
+	int fd = open(strFn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CHECK_GE(fd, 0) << strFn << ": " << strerror(errno);
+	CHECK_EQ(ftruncate(fd, (off_t)nBytes), 0) << strFn << ": " <<
+			strerror(errno);
+	return fd;
+}
+
+// Offsets of blobs in the weights file, returns the size of the file
+size_t LayoutExternalWeights(const CaffeWeights &weights,
+		std::vector<std::vector<size_t>> &blobOffsets) {
+	size_t nOffset = sizeof(ExternalWeightsHeader);
+	blobOffsets.clear();
+	for (auto &layerWeights : weights.layers) {
+		blobOffsets.emplace_back();
+		if (layerWeights.bShared) {
+			continue;
+		}
+		for (auto &blob : layerWeights.blobs) {
+			nOffset = AlignExternalOffset(nOffset);
+			blobOffsets.back().push_back(nOffset);
+			nOffset += ShapeCount(blob.shape) * sizeof(float);
+		}
+	}
+	return nOffset;
+}
+
+void WriteExternalWeights(const CaffeWeights &weights,
+		const std::vector<std::vector<size_t>> &blobOffsets,
+		size_t nFileBytes, const std::string &strWeightsFn,
+		size_t nNumThreads) {
+	ExternalWeightsHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, EXTERNAL_MAGIC, sizeof(header.magic));
+	header.nVersion = 1;
+	header.nFileBytes = nFileBytes;
+	for (auto &offsets : blobOffsets) {
+		header.nNumBlobs += offsets.size();
+	}
+	int fd = OpenForWriting(strWeightsFn, nFileBytes);
+	WriteChunksAt(fd, {{std::string(), &header, sizeof(header)}}, 0,
+			strWeightsFn);
+	ParallelFor(weights.layers.size(), nNumThreads, [&](size_t i) {
+			auto &blobs = weights.layers[i].blobs;
+			for (size_t j = 0; j < blobOffsets[i].size(); ++j) {
+				size_t nBytes = ShapeCount(blobs[j].shape) * sizeof(float);
+				WriteChunksAt(fd, {{std::string(), blobs[j].pData, nBytes}},
+						blobOffsets[i][j], strWeightsFn);
+			}
+		});
+	CHECK_EQ(close(fd), 0) << strWeightsFn << ": " << strerror(errno);
+}
+
+void WriteCaffeModel(const caffe::NetParameter &net,
+		const CaffeWeights &weights, const std::string &strModelFn,
+		const std::string &strWeightsFn, size_t nNumThreads) {
+	bool bExternal = !strWeightsFn.empty();
+	std::vector<std::vector<size_t>> blobOffsets;
+	size_t nWeightsBytes = 0;
+	if (bExternal) {
+		nWeightsBytes = LayoutExternalWeights(weights, blobOffsets);
+	}
+	std::vector<const LayerWeights*> layerWeights(net.layer_size(), nullptr);
+	std::vector<const std::vector<size_t>*> layerOffsets(
+			net.layer_size(), nullptr);
+	for (size_t i = 0; i < weights.layers.size(); ++i) {
+		layerWeights[weights.layers[i].nLayerIdx] = &weights.layers[i];
+		if (bExternal) {
+			layerOffsets[weights.layers[i].nLayerIdx] = &blobOffsets[i];
+		}
+	}
+
+	// Layers are the last field of NetParameter, so the net is the header
+	//	followed by the layers, each of them is encoded independently. Layers
+	//	of only shared blobs are left out as empty pieces.
+	std::vector<std::vector<WireChunk>> pieces(net.layer_size() + 1);
+	caffe::NetParameter netHeader(net);
+	netHeader.clear_layer();
+	AppendBytes(pieces[0], netHeader.SerializeAsString());
+	ParallelFor(net.layer_size(), nNumThreads, [&](size_t i) {
+			if (layerWeights[i] != nullptr && layerWeights[i]->bShared) {
+				return;
+			}
+			EncodeLayer(net.layer(i), layerWeights[i], layerOffsets[i],
+					pieces[i + 1]);
+		});
+
+	std::vector<size_t> offsets(pieces.size() + 1, 0);
+	for (size_t i = 0; i < pieces.size(); ++i) {
+		offsets[i + 1] = offsets[i] + ChunksBytes(pieces[i]);
+	}
+	int fd = OpenForWriting(strModelFn, offsets.back());
+	ParallelFor(pieces.size(), nNumThreads, [&](size_t i) {
+			WriteChunksAt(fd, pieces[i], offsets[i], strModelFn);
+		});
+	CHECK_EQ(close(fd), 0) << strModelFn << ": " << strerror(errno);
+
+	if (bExternal) {
+		WriteExternalWeights(weights, blobOffsets, nWeightsBytes,
+				strWeightsFn, nNumThreads);
+	}
+}
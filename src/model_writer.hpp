@@ -0,0 +1,75 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Writing the caffemodel directly from the loaded MxNet parameters.
+*	Blobs of every layer are bound to the parameters by the inferred shapes,
+*	no caffe::Net (and none of its activations) is instantiated. The wire
+*	format writer streams the float payload from the mapped params file.
+*/
+
+#ifndef MODEL_WRITER_HPP_
+#define MODEL_WRITER_HPP_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "common.hpp"
+#include "mxnet_parser.hpp"
+
+struct WeightBlob {
+	Shape shape;
+	const float *pData; // points to a MxnetParam or to CaffeWeights::constants
+};
+
+struct LayerWeights {
+	int nLayerIdx; // index of the layer in the caffe::NetParameter
+	std::vector<WeightBlob> blobs;
+	// All blobs are shared with layers before by ParamSpec names, the layer
+	//	is omitted from the caffemodel and caffe loads the blobs of the owners
+	bool bShared;
+};
+
+struct CaffeWeights {
+	std::vector<LayerWeights> layers;
+	std::list<std::vector<float>> constants; // blobs not from MxNet
+};
+
+CaffeWeights BindCaffeWeights(const caffe::NetParameter &net,
+		const std::map<std::string, std::vector<std::string>> &blobMapping,
+		const std::vector<MxnetParam> &mxnetParams,
+		const BlobShapes &blobShapes);
+
+// A copy of the net for the forward with bound weights, in the TEST phase
+//	and with BatchNorm using the global statistics, which it would update in
+//	the weights otherwise
+caffe::NetParameter InferenceNet(const caffe::NetParameter &net);
+
+// Points blobs of a caffe::Net created from net to the weights without
+//	copying, the weights must outlive caffeNet. Blobs of shared layers are
+//	shared by caffe from their owners. The net must be an InferenceNet.
+void BindNetWeights(caffe::Net<float> &caffeNet,
+		const caffe::NetParameter &net, const CaffeWeights &weights);
+
+// A copy of the net with blobs filled, ready for WriteProtoToBinaryFile
+caffe::NetParameter BuildCaffeModel(const caffe::NetParameter &net,
+		const CaffeWeights &weights);
+
+// Writes the caffemodel in protobuf wire format, byte-identical to
+//	WriteProtoToBinaryFile(BuildCaffeModel(net, weights)). Headers and shapes
+//	are encoded by protobuf, the data of blobs are written by pwritev from
+//	the weights without being copied. Layers are encoded and written at
+//	their offsets in parallel by nNumThreads (0 for all hardware threads).
+//	With strWeightsFn the data of blobs are written to that weights file
+//	instead, see external_weights.hpp.
+void WriteCaffeModel(const caffe::NetParameter &net,
+		const CaffeWeights &weights, const std::string &strModelFn,
+		const std::string &strWeightsFn, size_t nNumThreads);
+
+#endif /* MODEL_WRITER_HPP_ */
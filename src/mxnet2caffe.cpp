@@ -8,158 +8,136 @@
 * Written by Devymex <yumengwang@deepglint.com>, Jan. 2019
 */
 
-#include <functional>
-#include <iostream>
-#include <fstream>
-#include <map>
-#include <google/protobuf/text_format.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
-#include "common.hpp"
-#include "json_helper.hpp"
-#include "mxnet_parser.hpp"
-#include "converter.hpp"
-
-namespace proto = google::protobuf;
-using InputInfo = std::pair<std::string, Shape>;
-
-struct ProgramOptions {
-	std::string strMxnetJson;
-	std::string strMxnetParams;
-	std::string strCaffeProto;
-	std::string strCaffeModel;
-	std::vector<InputInfo> inputInfos;
-};
-
-StringPair SplitString(std::string str, size_t nPos) {
-	if (nPos == 0) {
-		return std::make_pair(std::string(), std::move(str));
-	} else if (nPos >= str.size()) {
-		return std::make_pair(std::move(str), std::string());
+#include "batch_conversion.hpp"
+#include "conversion.hpp"
+#include "conversion_daemon.hpp"
+#include "daemon_protocol.hpp"
+#include "str_helper.hpp"
+
+DEFINE_bool(profile, false, "Profile the stages of the conversion, the json "
+		"report and the Chrome trace are written next to the prototxt as "
+		"<name>.profile.json and <name>.trace.json");
+DEFINE_bool(cost_model, false, "Print the MACs, parameter bytes, activation "
+		"bytes and arithmetic intensity of layers, the json report is written "
+		"next to the prototxt as <name>.cost.json");
+DEFINE_bool(benchmark, false, "Benchmark the forward of the converted net on "
+		"CPU, the report is written next to the prototxt as "
+		"<name>.benchmark.json");
+DEFINE_string(benchmark_batch_sizes, "1", "Batch sizes to benchmark, comma "
+		"separated");
+DEFINE_string(benchmark_threads, "1", "Numbers of nets forwarded "
+		"concurrently by their own threads, comma separated, 0 for all "
+		"hardware threads");
+DEFINE_int32(benchmark_warmup, 5, "Forwards before timing, per thread");
+DEFINE_int32(benchmark_iterations, 50, "Timed forwards, per thread");
+DEFINE_double(roofline_threshold, 0.25, "Layers of the benchmark below this "
+		"fraction of the time predicted by the roofline are flagged");
+DEFINE_double(peak_gflops, 0., "Peak compute of the roofline, 0 for the best "
+		"achieved by a layer");
+DEFINE_double(peak_gbps, 0., "Peak memory bandwidth of the roofline, 0 for "
+		"the best achieved by a layer");
+DEFINE_string(manifest, "", "Convert a batch of models instead of one "
+		"config: a json file of a list of configs, or a glob pattern of "
+		"config files");
+DEFINE_int32(batch_jobs, 0, "Models of the batch or jobs of the daemon "
+		"converted concurrently, 0 for all hardware threads");
+DEFINE_int32(batch_memory_mb, 0, "Memory budget of the models converted "
+		"concurrently, 0 for 3/4 of the physical memory");
+DEFINE_string(batch_report, "batch_report.json", "Outcomes and timings of "
+		"the models of the batch");
+DEFINE_bool(daemon, false, "Serve the conversion jobs of local clients "
+		"(mxnet2caffe_client) until killed");
+DEFINE_string(daemon_socket, DEFAULT_DAEMON_SOCKET, "Unix domain socket of "
+		"the daemon");
+DEFINE_int32(daemon_cached_models, 8, "Models whose parsed json and mapped "
+		"params are kept by the daemon for the next jobs of the same files");
+
+// Reports enabled by the flags
+AnalysisOptions ParseAnalysisFlags() {
+	AnalysisOptions analysis = AnalysisOptions();
+	analysis.bProfile = FLAGS_profile;
+	analysis.bCostModel = FLAGS_cost_model;
+	analysis.bBenchmark = FLAGS_benchmark;
+	if (FLAGS_benchmark) {
+		auto &options = analysis.benchOptions;
+		options.batchSizes = Str2Tuple<size_t>(
+				"(" + FLAGS_benchmark_batch_sizes + ")");
+		options.threadCounts = Str2Tuple<size_t>(
+				"(" + FLAGS_benchmark_threads + ")");
+		CHECK_GE(FLAGS_benchmark_warmup, 0);
+		CHECK_GT(FLAGS_benchmark_iterations, 0);
+		options.nNumWarmup = FLAGS_benchmark_warmup;
+		options.nNumIterations = FLAGS_benchmark_iterations;
 	}
-	return std::make_pair(str.substr(0, nPos),
-			str.substr(nPos, str.size() - nPos));
+	analysis.rooflinePeaks = {FLAGS_peak_gflops, FLAGS_peak_gbps};
+	analysis.dRooflineThreshold = FLAGS_roofline_threshold;
+	return analysis;
 }
 
-bool ParseArgument(int nArgCnt, char **ppArgs, ProgramOptions &po) {
-	if (nArgCnt < 2) {
-		return false;
-	}
-	std::string strConfFn = ppArgs[1];
-	std::string strWorkPath;
-	auto pathAndName = SplitString(strConfFn,
-			strConfFn.find_last_of("\\/") + 1);
-	if (!pathAndName.second.empty()) {
-		strWorkPath = pathAndName.first;
+// Flags of a job of the daemon, over those of the daemon. Parsed in the
+//	worker of the job, which has its own copy of the flags.
+AnalysisOptions ParseJobFlags(const std::vector<std::string> &args) {
+	std::vector<char*> argv = {(char*)"mxnet2caffe"};
+	for (auto &strArg : args) {
+		argv.push_back((char*)strArg.c_str());
 	}
-
-	std::ifstream configFile(strConfFn);
-	CHECK(configFile.is_open());
-	Json jConfig;
-	configFile >> jConfig;
-	configFile.close();
-
-	po.strMxnetJson = strWorkPath + std::string(jConfig["mxnet_json"]);
-	po.strMxnetParams = strWorkPath + std::string(jConfig["mxnet_params"]);
-	po.strCaffeProto = strWorkPath + std::string(jConfig["caffe_prototxt"]);
-	po.strCaffeModel = strWorkPath + std::string(jConfig["caffe_caffemodel"]);
-
-	Json::iterator jInputs = jConfig.find("inputs");
-	po.inputInfos = ParseArray<InputInfo>(jInputs,
-			[](Json::iterator iInput) -> InputInfo {
-				std::string strName = (*iInput)["name"];
-				CHECK(!strName.empty());
-				Json::iterator jShape = iInput->find("shape");
-				CHECK(jShape != iInput->end());
-				auto intShape = ParseArray<int>(jShape);
-				CHECK(!intShape.empty());
-				Shape shape;
-				for (auto s : intShape) {
-					CHECK_GT(s, 0);
-					shape.emplace_back(s);
-				}
-				return std::make_pair(strName, shape);
-			}
-		);
-	CHECK(!po.inputInfos.empty());
-	return true;
-}
-
-std::string GenerateModelName(std::string strProtoFn) {
-	auto pathAndName = SplitString(strProtoFn,
-			strProtoFn.find_last_of("\\/") + 1);
-	if (pathAndName.second.empty()) {
-		std::swap(pathAndName.first, pathAndName.second);
-	}
-	strProtoFn = pathAndName.second;
-	auto nameAndExt = SplitString(strProtoFn, strProtoFn.find_last_of("."));
-	if (nameAndExt.first.empty()) {
-		std::swap(nameAndExt.first, nameAndExt.second);
-	}
-	return nameAndExt.first;
+	int nArgCnt = (int)argv.size();
+	char **ppArgs = argv.data();
+	gflags::ParseCommandLineFlags(&nArgCnt, &ppArgs, false);
+	return ParseAnalysisFlags();
 }
 
 int main(int nArgCnt, char *ppArgs[]) {
-	ProgramOptions po;
-	if (!ParseArgument(nArgCnt, ppArgs, po)) {
-		return -1;
+	gflags::SetUsageMessage("mxnet2caffe [flags] config.json\n"
+			"  mxnet2caffe [flags] --manifest=<configs.json|pattern>\n"
+			"  mxnet2caffe [flags] --daemon [--daemon_socket=<path>]");
+	gflags::ParseCommandLineFlags(&nArgCnt, &ppArgs, true);
+	if (FLAGS_daemon) {
+		CHECK_GE(FLAGS_batch_jobs, 0);
+		CHECK_GE(FLAGS_batch_memory_mb, 0);
+		CHECK_GE(FLAGS_daemon_cached_models, 0);
+		DaemonOptions options;
+		options.strSocketFn = FLAGS_daemon_socket;
+		options.nNumJobs = FLAGS_batch_jobs;
+		options.nMemoryBudget = (size_t)FLAGS_batch_memory_mb << 20;
+		options.nNumCachedModels = FLAGS_daemon_cached_models;
+		RunConversionDaemon(options, ParseJobFlags);
+		return 0;
 	}
-
-	auto mxnetParseResult = ParseMxnetJson(po.strMxnetJson);
-	auto mxnetParams = LoadMxnetParam(po.strMxnetParams);
-	std::map<std::string, std::vector<std::string>> blobMapping;
-	auto protoNet = MxnetNodes2CaffeNet(
-			mxnetParseResult.first, mxnetParseResult.second,
-			po.inputInfos, blobMapping);
-	protoNet.set_name(GenerateModelName(po.strCaffeProto));
-
-	std::string strProtoBuf;
-	proto::TextFormat::PrintToString(protoNet, &strProtoBuf);
-	std::ofstream protoFile(po.strCaffeProto);
-	protoFile.write(strProtoBuf.data(), strProtoBuf.size());
-	protoFile.close();
-
-	caffe::Net<float> net(protoNet);
-	auto &layers = net.layers();
-	for (auto &netLayer : layers) {
-		auto iBlobMap = blobMapping.find(netLayer->layer_param().name());
-		if (iBlobMap != blobMapping.end()) {
-			auto &blobNames = iBlobMap->second;
-			auto &netBlobs = netLayer->blobs();
-			if (std::string(netLayer->type()) == "BatchNorm") {
-				CHECK_EQ(netBlobs.size(), 3);
-				CHECK_EQ(blobNames.size(), 2);
-				CHECK_EQ(netBlobs[2]->count(), 1);
-				*(netBlobs[2]->mutable_cpu_data()) = 1.0f;
-			} else {
-				CHECK_EQ(netBlobs.size(), blobNames.size());
-			}
-			for (size_t i = 0; i < blobNames.size(); ++i) {
-				// Param won't be copy to caffemodel if learning rate is 0
-				if (netLayer->layer_param().param_size() == 1) {
-					auto &paramSpec = netLayer->layer_param().param(0);
-					bool b1 = paramSpec.decay_mult() == 100.f;
-					bool b2 = blobNames[i].find("gamma") != std::string::npos;
-					if (b1 && b2) {
-						continue;
-					}
-				}
-				auto iMxnetParam = std::find_if(mxnetParams.begin(),
-						mxnetParams.end(), [&](const MxnetParam &param) {
-							return param.strName == blobNames[i];
-						}
-					);
-				CHECK(iMxnetParam != mxnetParams.end());
-				auto &pNetBlob = netBlobs[i];
-				CHECK_EQ(pNetBlob->count(), iMxnetParam->data.size()) << netLayer->layer_param().name();
-				memcpy(pNetBlob->mutable_cpu_data(), iMxnetParam->data.data(),
-						pNetBlob->count() * sizeof(float));
+	if (!FLAGS_manifest.empty()) {
+		CHECK_GE(FLAGS_batch_jobs, 0);
+		CHECK_GE(FLAGS_batch_memory_mb, 0);
+		auto tBeg = std::chrono::steady_clock::now();
+		auto jobs = LoadManifest(FLAGS_manifest);
+		BatchOptions options;
+		options.nNumJobs = FLAGS_batch_jobs;
+		options.nMemoryBudget = (size_t)FLAGS_batch_memory_mb << 20;
+		options.analysis = ParseAnalysisFlags();
+		auto outcomes = ConvertBatch(jobs, options);
+		double dWallSeconds = std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - tBeg).count();
+		WriteBatchReport(outcomes, dWallSeconds, FLAGS_batch_report);
+		LOG(INFO) << "Batch conversion, written to " << FLAGS_batch_report <<
+				":\n" << FormatBatchReport(outcomes, dWallSeconds);
+		for (auto &outcome : outcomes) {
+			if (!outcome.bSucceeded) {
+				return 1;
 			}
 		}
+		return 0;
 	}
-	net.ToProto(&protoNet, false);
-	caffe::WriteProtoToBinaryFile(protoNet, po.strCaffeModel.c_str());
-
+	if (nArgCnt < 2) {
+		gflags::ShowUsageWithFlags(ppArgs[0]);
+		return -1;
+	}
+	ProgramOptions po = LoadConfig(ppArgs[1]);
+	po.analysis = ParseAnalysisFlags();
+	ConvertModel(po);
 	return 0;
 }
-
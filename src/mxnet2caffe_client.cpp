@@ -0,0 +1,116 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Mxnet2Caffe client: converts a config by the daemon (mxnet2caffe --daemon)
+*	with the same arguments as mxnet2caffe, without loading caffe
+*/
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "daemon_protocol.hpp"
+
+// Absolute path of the directory of the file, with the trailing slash
+std::string AbsoluteDirectoryOf(const std::string &strFn) {
+	size_t nSlash = strFn.find_last_of('/');
+	std::string strDir = nSlash == std::string::npos ? "." :
+			strFn.substr(0, nSlash + 1);
+	char absPath[PATH_MAX];
+	CHECK(realpath(strDir.c_str(), absPath) != nullptr) << strDir << ": " <<
+			strerror(errno);
+	std::string strAbsDir = absPath;
+	if (strAbsDir.back() != '/') {
+		strAbsDir += "/";
+	}
+	return strAbsDir;
+}
+
+int main(int nArgCnt, char *ppArgs[]) {
+	// Flags are passed to the daemon, except for the socket
+	const std::string strSocketFlag = "--daemon_socket=";
+	std::string strSocketFn = DEFAULT_DAEMON_SOCKET;
+	std::string strConfFn;
+	Json jArgs = Json::array();
+	for (int i = 1; i < nArgCnt; ++i) {
+		std::string strArg = ppArgs[i];
+		if (strArg.compare(0, strSocketFlag.size(), strSocketFlag) == 0) {
+			strSocketFn = strArg.substr(strSocketFlag.size());
+		} else if (strArg.size() > 1 && strArg[0] == '-') {
+			jArgs.push_back(strArg);
+		} else if (strConfFn.empty()) {
+			strConfFn = strArg;
+		}
+	}
+	if (strConfFn.empty()) {
+		std::cerr << "Usage: " << ppArgs[0] << " [--daemon_socket=<path>] " <<
+				"[--flag=value ...] config.json" << std::endl;
+		return -1;
+	}
+
+	std::ifstream configFile(strConfFn);
+	CHECK(configFile.is_open()) << strConfFn;
+	Json jJob;
+	configFile >> jJob;
+	configFile.close();
+	CHECK(jJob.is_object()) << strConfFn << " is not a config";
+	jJob["work_path"] = AbsoluteDirectoryOf(strConfFn);
+	jJob["args"] = std::move(jArgs);
+
+	int nFd = ConnectUnixSocket(strSocketFn);
+	if (nFd < 0) {
+		LOG(ERROR) << "No daemon listens on " << strSocketFn << ", start " <<
+				"one by mxnet2caffe --daemon --daemon_socket=" << strSocketFn;
+		return 2;
+	}
+	CHECK(SendJsonLine(nFd, jJob)) << "Failed to send the job: " <<
+			strerror(errno);
+
+	// The output of the conversion goes to stderr, as with mxnet2caffe
+	LineBuffer received;
+	char buf[65536];
+	for (;;) {
+		ssize_t nRead = recv(nFd, buf, sizeof(buf), 0);
+		if (nRead < 0 && errno == EINTR) {
+			continue;
+		} else if (nRead <= 0) {
+			break;
+		}
+		received.Append(buf, nRead);
+		std::string strLine;
+		while (received.PopLine(strLine)) {
+			Json jEvent = Json::parse(strLine, nullptr, false);
+			if (!jEvent.is_object()) {
+				continue;
+			}
+			std::string strEvent = jEvent.value("event", "");
+			if (strEvent == "log") {
+				std::cerr << jEvent.value("line", "") << std::endl;
+			} else if (strEvent == "queued" &&
+					jEvent.value("position", 0) > 0) {
+				LOG(INFO) << "Queued after " << jEvent["position"] <<
+						" jobs";
+			} else if (strEvent == "done") {
+				close(nFd);
+				bool bSucceeded = jEvent.value("succeeded", false);
+				if (!bSucceeded) {
+					LOG(ERROR) << "Conversion failed: " <<
+							jEvent.value("error", "");
+				}
+				return bSucceeded ? 0 : 1;
+			}
+		}
+	}
+	close(nFd);
+	LOG(ERROR) << "The daemon closed the connection before the job is done";
+	return 1;
+}
@@ -0,0 +1,676 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Reference executor of the MxNet nodes on CPU
+*/
+
+#include "mxnet_executor.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <glog/logging.h>
+
+#include "converter.hpp"
+#include "cpu_kernels.hpp"
+#include "parallel.hpp"
+#include "shape_inference.hpp"
+#include "str_helper.hpp"
+
+// An input of a node, the data is null for an absent label
+struct TensorRef {
+	const float *pData;
+	Shape shape;
+};
+
+using OpKernel = std::function<void(const MxnetNode&,
+		const std::vector<TensorRef>&, std::vector<Tensor>&, size_t)>;
+
+// Attributes with the defaults of MxNet
+std::string AttrString(const Attributes &attrs, const std::string &strKey,
+		const std::string &strDefault) {
+	std::string strVal = attrs.GetValue(strKey, false);
+	return strVal.empty() ? strDefault : strVal;
+}
+
+float AttrFloat(const Attributes &attrs, const std::string &strKey,
+		float fDefault) {
+	std::string strVal = attrs.GetValue(strKey, false);
+	if (strVal.empty() || strVal == "None") {
+		return fDefault;
+	}
+	return Str2Num<float>(strVal, -FLT_MAX, FLT_MAX);
+}
+
+int AttrInt(const Attributes &attrs, const std::string &strKey,
+		int nDefault) {
+	std::string strVal = attrs.GetValue(strKey, false);
+	return strVal.empty() ? nDefault : Str2Num<int>(strVal);
+}
+
+bool AttrBool(const Attributes &attrs, const std::string &strKey,
+		bool bDefault) {
+	std::string strVal = attrs.GetValue(strKey, false);
+	return strVal.empty() ? bDefault : Str2Bool(strVal);
+}
+
+std::pair<size_t, size_t> AttrPair(const Attributes &attrs,
+		const std::string &strKey, size_t nDefault) {
+	std::string strVal = attrs.GetValue(strKey, false);
+	if (strVal.empty()) {
+		return std::make_pair(nDefault, nDefault);
+	}
+	auto pair = Str2Pair<int>(strVal, 0);
+	return std::make_pair((size_t)pair.first, (size_t)pair.second);
+}
+
+// A tensor viewed as (outer, axis, inner)
+struct AxisSplit {
+	size_t nOuter;
+	size_t nAxis;
+	size_t nInner;
+};
+
+AxisSplit SplitAtAxis(const Shape &shape, size_t nAxis) {
+	CHECK_LT(nAxis, shape.size());
+	AxisSplit split = {1, shape[nAxis], 1};
+	for (size_t i = 0; i < nAxis; ++i) {
+		split.nOuter *= shape[i];
+	}
+	for (size_t i = nAxis + 1; i < shape.size(); ++i) {
+		split.nInner *= shape[i];
+	}
+	return split;
+}
+
+// The first axis against all the others
+AxisSplit SplitBatch(const Shape &shape) {
+	return {shape[0], ShapeCount(shape) / shape[0], 1};
+}
+
+template<typename _Fn>
+void MapElements(const TensorRef &input, Tensor &output, _Fn fn) {
+	float *pOut = output.data.data();
+	for (size_t i = 0; i < output.data.size(); ++i) {
+		pOut[i] = fn(input.pData[i]);
+	}
+}
+
+void CopyKernel(const MxnetNode &node, const std::vector<TensorRef> &inputs,
+		std::vector<Tensor> &outputs, size_t nNumThreads) {
+	CHECK_EQ(ShapeCount(inputs[0].shape), outputs[0].data.size());
+	std::memcpy(outputs[0].data.data(), inputs[0].pData,
+			outputs[0].data.size() * sizeof(float));
+}
+
+void ActivationKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	std::string strType = node.attrs.GetValue("act_type", true);
+	if (strType == "relu") {
+		MapElements(inputs[0], outputs[0], [](float x) {
+				return x > 0.f ? x : 0.f;
+			});
+	} else if (strType == "sigmoid" || strType == "Sigmoid") {
+		MapElements(inputs[0], outputs[0], [](float x) {
+				return 1.f / (1.f + std::exp(-x));
+			});
+	} else if (strType == "tanh") {
+		MapElements(inputs[0], outputs[0], [](float x) {
+				return std::tanh(x);
+			});
+	} else {
+		LOG(FATAL) << "Unsupported act_type \"" << strType << "\" of " <<
+				node.strName;
+	}
+}
+
+void LeakyReLUKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	std::string strType = AttrString(node.attrs, "act_type", "leaky");
+	float fSlope = AttrFloat(node.attrs, "slope", 0.25f);
+	if (strType == "leaky") {
+		MapElements(inputs[0], outputs[0], [fSlope](float x) {
+				return x > 0.f ? x : x * fSlope;
+			});
+	} else if (strType == "elu") {
+		MapElements(inputs[0], outputs[0], [fSlope](float x) {
+				return x > 0.f ? x : fSlope * std::expm1(x);
+			});
+	} else if (strType == "prelu") {
+		CHECK_GE(inputs.size(), 2U);
+		auto split = SplitAtAxis(inputs[0].shape, 1);
+		size_t nNumGamma = ShapeCount(inputs[1].shape);
+		CHECK(nNumGamma == 1 || nNumGamma == split.nAxis);
+		const float *pIn = inputs[0].pData;
+		float *pOut = outputs[0].data.data();
+		for (size_t o = 0; o < split.nOuter; ++o) {
+			for (size_t c = 0; c < split.nAxis; ++c) {
+				float fGamma = inputs[1].pData[nNumGamma == 1 ? 0 : c];
+				size_t nBase = (o * split.nAxis + c) * split.nInner;
+				for (size_t i = nBase; i < nBase + split.nInner; ++i) {
+					pOut[i] = pIn[i] > 0.f ? pIn[i] : pIn[i] * fGamma;
+				}
+			}
+		}
+	} else {
+		LOG(FATAL) << "Unsupported act_type \"" << strType << "\" of " <<
+				node.strName;
+	}
+}
+
+void AbsKernel(const MxnetNode &node, const std::vector<TensorRef> &inputs,
+		std::vector<Tensor> &outputs, size_t nNumThreads) {
+	MapElements(inputs[0], outputs[0], [](float x) { return std::fabs(x); });
+}
+
+void MulScalarKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	float fScalar = Str2Num<float>(node.attrs.GetValue("scalar", true),
+			-FLT_MAX, FLT_MAX);
+	MapElements(inputs[0], outputs[0], [fScalar](float x) {
+			return x * fScalar;
+		});
+}
+
+// Softmax along the axis of the split, in parallel over the outer axes
+void Softmax(const float *pIn, float *pOut, const AxisSplit &split,
+		float fTemperature, size_t nNumThreads) {
+	ParallelFor(split.nOuter, nNumThreads, [&](size_t o) {
+			for (size_t i = 0; i < split.nInner; ++i) {
+				size_t nBase = o * split.nAxis * split.nInner + i;
+				float fMax = -FLT_MAX;
+				for (size_t a = 0; a < split.nAxis; ++a) {
+					fMax = std::max(fMax, pIn[nBase + a * split.nInner]);
+				}
+				float fSum = 0.f;
+				for (size_t a = 0; a < split.nAxis; ++a) {
+					size_t j = nBase + a * split.nInner;
+					pOut[j] = std::exp((pIn[j] - fMax) / fTemperature);
+					fSum += pOut[j];
+				}
+				for (size_t a = 0; a < split.nAxis; ++a) {
+					pOut[nBase + a * split.nInner] /= fSum;
+				}
+			}
+		});
+}
+
+void SoftmaxActivationKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &shape = inputs[0].shape;
+	std::string strMode = AttrString(node.attrs, "mode", "instance");
+	AxisSplit split;
+	if (strMode == "channel") {
+		split = SplitAtAxis(shape, 1);
+	} else {
+		CHECK(strMode == "instance") << "Unknown mode of " << node.strName;
+		split = SplitBatch(shape);
+	}
+	Softmax(inputs[0].pData, outputs[0].data.data(), split, 1.f, nNumThreads);
+}
+
+void SoftmaxKernel(const MxnetNode &node, const std::vector<TensorRef> &inputs,
+		std::vector<Tensor> &outputs, size_t nNumThreads) {
+	auto &shape = inputs[0].shape;
+	size_t nAxis = CanonicalAxis(AttrInt(node.attrs, "axis", -1),
+			shape.size());
+	float fTemperature = AttrFloat(node.attrs, "temperature", 1.f);
+	Softmax(inputs[0].pData, outputs[0].data.data(), SplitAtAxis(shape, nAxis),
+			fTemperature, nNumThreads);
+}
+
+// The probabilities of the forward in inference, the label is not used
+void SoftmaxOutputKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &shape = inputs[0].shape;
+	AxisSplit split;
+	if (AttrBool(node.attrs, "preserve_shape", false)) {
+		split = SplitAtAxis(shape, shape.size() - 1);
+	} else if (AttrBool(node.attrs, "multi_output", false)) {
+		split = SplitAtAxis(shape, 1);
+	} else {
+		split = SplitBatch(shape);
+	}
+	Softmax(inputs[0].pData, outputs[0].data.data(), split, 1.f, nNumThreads);
+}
+
+void SliceChannelKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &shape = inputs[0].shape;
+	auto split = SplitAtAxis(shape, CanonicalAxis(
+			AttrInt(node.attrs, "axis", 1), shape.size()));
+	size_t nPart = split.nAxis / outputs.size() * split.nInner;
+	for (size_t o = 0; o < split.nOuter; ++o) {
+		const float *pIn = inputs[0].pData + o * split.nAxis * split.nInner;
+		for (size_t k = 0; k < outputs.size(); ++k) {
+			std::memcpy(outputs[k].data.data() + o * nPart, pIn + k * nPart,
+					nPart * sizeof(float));
+		}
+	}
+}
+
+void ConcatKernel(const MxnetNode &node, const std::vector<TensorRef> &inputs,
+		std::vector<Tensor> &outputs, size_t nNumThreads) {
+	auto &outShape = outputs[0].shape;
+	size_t nAxis = CanonicalAxis(AttrInt(node.attrs, "dim", 1),
+			outShape.size());
+	auto outSplit = SplitAtAxis(outShape, nAxis);
+	float *pOut = outputs[0].data.data();
+	for (size_t o = 0; o < outSplit.nOuter; ++o) {
+		for (auto &input : inputs) {
+			size_t nPart = input.shape[nAxis] * outSplit.nInner;
+			std::memcpy(pOut, input.pData + o * nPart, nPart * sizeof(float));
+			pOut += nPart;
+		}
+	}
+}
+
+void ElemwiseKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &strOp = node.strOp;
+	float *pOut = outputs[0].data.data();
+	size_t nCount = outputs[0].data.size();
+	for (auto &input : inputs) {
+		CHECK_EQ(ShapeCount(input.shape), nCount) << node.strName;
+	}
+	if (strOp == "elemwise_sub" || strOp == "_Minus") {
+		CHECK_EQ(inputs.size(), 2U);
+		for (size_t i = 0; i < nCount; ++i) {
+			pOut[i] = inputs[0].pData[i] - inputs[1].pData[i];
+		}
+	} else if (strOp == "elemwise_mul") {
+		CHECK_EQ(inputs.size(), 2U);
+		for (size_t i = 0; i < nCount; ++i) {
+			pOut[i] = inputs[0].pData[i] * inputs[1].pData[i];
+		}
+	} else {
+		std::memcpy(pOut, inputs[0].pData, nCount * sizeof(float));
+		for (size_t j = 1; j < inputs.size(); ++j) {
+			for (size_t i = 0; i < nCount; ++i) {
+				pOut[i] += inputs[j].pData[i];
+			}
+		}
+	}
+}
+
+// Strides of an input in the broadcasted output, 0 for broadcasted axes
+std::vector<size_t> BroadcastStrides(const Shape &inShape,
+		const Shape &outShape) {
+	std::vector<size_t> strides(outShape.size(), 0);
+	size_t nStride = 1;
+	for (size_t i = 0; i < inShape.size(); ++i) {
+		size_t d = inShape.size() - 1 - i;
+		size_t o = outShape.size() - 1 - i;
+		strides[o] = (inShape[d] == 1) ? 0 : nStride;
+		nStride *= inShape[d];
+	}
+	return strides;
+}
+
+void BroadcastKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	CHECK_EQ(inputs.size(), 2U);
+	auto &strOp = node.strOp;
+	auto &outShape = outputs[0].shape;
+	CHECK(BroadcastShapes(inputs[0].shape, inputs[1].shape) == outShape);
+	auto lhsStrides = BroadcastStrides(inputs[0].shape, outShape);
+	auto rhsStrides = BroadcastStrides(inputs[1].shape, outShape);
+	int nOp = (strOp == "broadcast_mul") ? 0 : ((strOp == "broadcast_add" ||
+			strOp == "broadcast_plus") ? 1 : 2);
+	size_t nLast = outShape.back();
+	size_t nLhsStep = lhsStrides.back(), nRhsStep = rhsStrides.back();
+	// Rows of the last axis, the offsets of the inputs are carried
+	std::vector<size_t> index(outShape.size(), 0);
+	size_t nLhs = 0, nRhs = 0;
+	float *pOut = outputs[0].data.data();
+	for (size_t nRow = 0; nRow < ShapeCount(outShape) / nLast; ++nRow) {
+		const float *pLhs = inputs[0].pData + nLhs;
+		const float *pRhs = inputs[1].pData + nRhs;
+		for (size_t i = 0; i < nLast; ++i) {
+			float a = pLhs[i * nLhsStep], b = pRhs[i * nRhsStep];
+			pOut[i] = (nOp == 0) ? a * b : ((nOp == 1) ? a + b : a - b);
+		}
+		pOut += nLast;
+		for (size_t d = outShape.size() - 1; d-- > 0; ) {
+			nLhs += lhsStrides[d];
+			nRhs += rhsStrides[d];
+			if (++index[d] < outShape[d]) {
+				break;
+			}
+			nLhs -= lhsStrides[d] * outShape[d];
+			nRhs -= rhsStrides[d] * outShape[d];
+			index[d] = 0;
+		}
+	}
+}
+
+// Inference with the moving statistics, gamma is 1 if fixed (by default)
+void BatchNormKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	CHECK_EQ(inputs.size(), 5U) << node.strName;
+	CHECK_EQ(AttrInt(node.attrs, "axis", 1), 1);
+	float fEps = AttrFloat(node.attrs, "eps", 1e-3f);
+	bool bFixGamma = AttrBool(node.attrs, "fix_gamma", true);
+	auto split = SplitAtAxis(inputs[0].shape, 1);
+	for (size_t j = 1; j < inputs.size(); ++j) {
+		CHECK_EQ(ShapeCount(inputs[j].shape), split.nAxis) << node.strName;
+	}
+	std::vector<float> scales(split.nAxis), shifts(split.nAxis);
+	for (size_t c = 0; c < split.nAxis; ++c) {
+		float fGamma = bFixGamma ? 1.f : inputs[1].pData[c];
+		scales[c] = fGamma / std::sqrt(inputs[4].pData[c] + fEps);
+		shifts[c] = inputs[2].pData[c] - inputs[3].pData[c] * scales[c];
+	}
+	const float *pIn = inputs[0].pData;
+	float *pOut = outputs[0].data.data();
+	for (size_t o = 0; o < split.nOuter; ++o) {
+		for (size_t c = 0; c < split.nAxis; ++c) {
+			size_t nBase = (o * split.nAxis + c) * split.nInner;
+			for (size_t i = nBase; i < nBase + split.nInner; ++i) {
+				pOut[i] = pIn[i] * scales[c] + shifts[c];
+			}
+		}
+	}
+}
+
+void FullyConnectedKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &inShape = inputs[0].shape;
+	size_t nK = AttrBool(node.attrs, "flatten", true) ?
+			ShapeCount(inShape) / inShape[0] : inShape.back();
+	size_t nM = ShapeCount(inShape) / nK;
+	size_t nN = Str2Num<size_t>(node.attrs.GetValue("num_hidden", true), 1);
+	CHECK_EQ(ShapeCount(inputs[1].shape), nN * nK) << node.strName;
+	float *pOut = outputs[0].data.data();
+	Gemm(nM, nN, nK, inputs[0].pData, inputs[1].pData, true, pOut,
+			nNumThreads);
+	if (inputs.size() > 2 && !AttrBool(node.attrs, "no_bias", false)) {
+		const float *pBias = inputs[2].pData;
+		for (size_t i = 0; i < nM; ++i) {
+			for (size_t j = 0; j < nN; ++j) {
+				pOut[i * nN + j] += pBias[j];
+			}
+		}
+	}
+}
+
+void ConvolutionKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &inShape = inputs[0].shape;
+	auto &outShape = outputs[0].shape;
+	CHECK_EQ(inShape.size(), 4U) << "Only 2D Convolution is supported";
+	auto kernel = AttrPair(node.attrs, "kernel", 1);
+	auto stride = AttrPair(node.attrs, "stride", 1);
+	auto pad = AttrPair(node.attrs, "pad", 0);
+	auto dilate = AttrPair(node.attrs, "dilate", 1);
+	ConvGeometry geo = {inShape[1], inShape[2], inShape[3],
+			outShape[1], outShape[2], outShape[3],
+			kernel.first, kernel.second, stride.first, stride.second,
+			pad.first, pad.second, dilate.first, dilate.second,
+			(size_t)AttrInt(node.attrs, "num_group", 1)};
+	CHECK_EQ(ShapeCount(inputs[1].shape), geo.nNumFilter * geo.nChannels /
+			geo.nNumGroup * geo.nKernelH * geo.nKernelW) << node.strName;
+	const float *pBias = nullptr;
+	if (inputs.size() > 2 && !AttrBool(node.attrs, "no_bias", false)) {
+		pBias = inputs[2].pData;
+	}
+	Convolution2D(geo, inShape[0], inputs[0].pData, inputs[1].pData, pBias,
+			outputs[0].data.data(), nNumThreads);
+}
+
+// Windows are clipped to the input. Averages include the padding by
+//	default, as the window before clipping to the padded input.
+void PoolingKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &inShape = inputs[0].shape;
+	auto &outShape = outputs[0].shape;
+	CHECK_EQ(inShape.size(), 4U) << "Only 2D Pooling is supported";
+	std::string strType = AttrString(node.attrs, "pool_type", "max");
+	CHECK(strType == "max" || strType == "avg" || strType == "sum") <<
+			"Unsupported pool_type \"" << strType << "\" of " << node.strName;
+	bool bMax = (strType == "max");
+	bool bIncludePad = AttrBool(node.attrs, "count_include_pad", true);
+	int64_t nHeight = inShape[2], nWidth = inShape[3];
+	std::pair<size_t, size_t> kernel(nHeight, nWidth), stride(1, 1), pad(0, 0);
+	if (!AttrBool(node.attrs, "global_pool", false)) {
+		kernel = AttrPair(node.attrs, "kernel", 1);
+		stride = AttrPair(node.attrs, "stride", 1);
+		pad = AttrPair(node.attrs, "pad", 0);
+	}
+	int64_t nPadH = pad.first, nPadW = pad.second;
+	size_t nOutH = outShape[2], nOutW = outShape[3];
+	ParallelFor(inShape[0] * inShape[1], nNumThreads, [&](size_t iPlane) {
+			const float *pIn = inputs[0].pData + iPlane * nHeight * nWidth;
+			float *pOut = outputs[0].data.data() + iPlane * nOutH * nOutW;
+			for (size_t oh = 0; oh < nOutH; ++oh) {
+				int64_t hs = (int64_t)(oh * stride.first) - nPadH;
+				int64_t he = std::min(hs + (int64_t)kernel.first,
+						nHeight + nPadH);
+				for (size_t ow = 0; ow < nOutW; ++ow) {
+					int64_t ws = (int64_t)(ow * stride.second) - nPadW;
+					int64_t we = std::min(ws + (int64_t)kernel.second,
+							nWidth + nPadW);
+					int64_t nPoolSize = (he - hs) * (we - ws);
+					int64_t h0 = std::max(hs, int64_t(0));
+					int64_t h1 = std::min(he, nHeight);
+					int64_t w0 = std::max(ws, int64_t(0));
+					int64_t w1 = std::min(we, nWidth);
+					float fVal = bMax ? -FLT_MAX : 0.f;
+					for (int64_t y = h0; y < h1; ++y) {
+						for (int64_t x = w0; x < w1; ++x) {
+							float v = pIn[y * nWidth + x];
+							fVal = bMax ? std::max(fVal, v) : fVal + v;
+						}
+					}
+					if (strType == "avg") {
+						if (!bIncludePad) {
+							nPoolSize = (h1 - h0) * (w1 - w0);
+						}
+						fVal = nPoolSize > 0 ? fVal / nPoolSize : 0.f;
+					}
+					pOut[oh * nOutW + ow] = fVal;
+				}
+			}
+		});
+}
+
+void L2NormalizationKernel(const MxnetNode &node,
+		const std::vector<TensorRef> &inputs, std::vector<Tensor> &outputs,
+		size_t nNumThreads) {
+	auto &shape = inputs[0].shape;
+	std::string strMode = AttrString(node.attrs, "mode", "instance");
+	float fEps = AttrFloat(node.attrs, "eps", 1e-10f);
+	AxisSplit split;
+	if (strMode == "channel") {
+		split = SplitAtAxis(shape, 1);
+	} else if (strMode == "spatial") {
+		CHECK_GE(shape.size(), 2U);
+		split = {shape[0] * shape[1], ShapeCount(shape) /
+				(shape[0] * shape[1]), 1};
+	} else {
+		CHECK(strMode == "instance") << "Unknown mode of " << node.strName;
+		split = SplitBatch(shape);
+	}
+	const float *pIn = inputs[0].pData;
+	float *pOut = outputs[0].data.data();
+	for (size_t o = 0; o < split.nOuter; ++o) {
+		for (size_t i = 0; i < split.nInner; ++i) {
+			size_t nBase = o * split.nAxis * split.nInner + i;
+			float fSqSum = 0.f;
+			for (size_t a = 0; a < split.nAxis; ++a) {
+				float v = pIn[nBase + a * split.nInner];
+				fSqSum += v * v;
+			}
+			float fInvNorm = 1.f / std::sqrt(fSqSum + fEps);
+			for (size_t a = 0; a < split.nAxis; ++a) {
+				size_t j = nBase + a * split.nInner;
+				pOut[j] = pIn[j] * fInvNorm;
+			}
+		}
+	}
+}
+
+const std::map<std::string, OpKernel> &OpKernels() {
+	static const std::map<std::string, OpKernel> opKernels = {
+			{"Flatten", CopyKernel},
+			{"Dropout", CopyKernel},
+			{"Reshape", CopyKernel},
+			{"reshape", CopyKernel},
+			{"Activation", ActivationKernel},
+			{"LeakyReLU", LeakyReLUKernel},
+			{"abs", AbsKernel},
+			{"_mul_scalar", MulScalarKernel},
+			{"SoftmaxActivation", SoftmaxActivationKernel},
+			{"softmax", SoftmaxKernel},
+			{"SoftmaxOutput", SoftmaxOutputKernel},
+			{"SliceChannel", SliceChannelKernel},
+			{"Concat", ConcatKernel},
+			{"concat", ConcatKernel},
+			{"elemwise_add", ElemwiseKernel},
+			{"_Plus", ElemwiseKernel},
+			{"add_n", ElemwiseKernel},
+			{"ElementWiseSum", ElemwiseKernel},
+			{"elemwise_sub", ElemwiseKernel},
+			{"_Minus", ElemwiseKernel},
+			{"elemwise_mul", ElemwiseKernel},
+			{"broadcast_mul", BroadcastKernel},
+			{"broadcast_add", BroadcastKernel},
+			{"broadcast_plus", BroadcastKernel},
+			{"broadcast_sub", BroadcastKernel},
+			{"broadcast_minus", BroadcastKernel},
+			{"BatchNorm", BatchNormKernel},
+			{"FullyConnected", FullyConnectedKernel},
+			{"Convolution", ConvolutionKernel},
+			{"Pooling", PoolingKernel},
+			{"L2Normalization", L2NormalizationKernel}
+		};
+	return opKernels;
+}
+
+NodeTensors RunMxnetGraph(const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<MxnetParam> &mxnetParams,
+		const std::map<std::string, Tensor> &inputs, size_t nNumThreads) {
+	std::vector<InputInfo> inputInfos;
+	for (auto &input : inputs) {
+		CHECK_EQ(ShapeCount(input.second.shape), input.second.data.size()) <<
+				"Size of input " << input.first << " mismatch";
+		inputInfos.emplace_back(input.first, input.second.shape);
+	}
+	auto nodeShapes = InferMxnetShapes(mxnetNodes, inputInfos);
+	std::unordered_map<std::string, const MxnetParam*> paramsByName;
+	for (auto &param : mxnetParams) {
+		paramsByName[param.strName] = &param;
+	}
+	auto FindParam = [&](const std::string &strName) -> const MxnetParam* {
+			auto iParam = paramsByName.find(strName);
+			return iParam == paramsByName.end() ? nullptr : iParam->second;
+		};
+
+	auto &opKernels = OpKernels();
+	NodeTensors nodeTensors(mxnetNodes.size());
+	std::vector<TensorRef> variables(mxnetNodes.size());
+	for (size_t i = 0; i < mxnetNodes.size(); ++i) {
+		auto &node = mxnetNodes[i];
+		if (node.strOp == "null") {
+			const Shape &shape = nodeShapes[i][0];
+			auto iInput = inputs.find(node.strName);
+			const MxnetParam *pParam = FindParam(node.strName);
+			if (iInput != inputs.end()) {
+				variables[i] = {iInput->second.data.data(), shape};
+			} else if (pParam != nullptr) {
+				CHECK(shape.empty() || ShapeCount(shape) == pParam->nCount) <<
+						"Shape of parameter " << node.strName << " mismatch: "
+						<< ShapeString(pParam->shape) << " vs " <<
+						ShapeString(shape);
+				variables[i] = {pParam->pData,
+						shape.empty() ? pParam->shape : shape};
+			} else {
+				variables[i] = {nullptr, shape};
+			}
+			continue;
+		}
+		auto iKernel = opKernels.find(node.strOp);
+		CHECK(iKernel != opKernels.end()) << "Unsupported op: " << node.strOp;
+
+		std::vector<TensorRef> inRefs;
+		for (size_t j = 0; j < node.inputs.size(); ++j) {
+			auto &input = node.inputs[j];
+			CHECK_LT(input.first, i);
+			auto &inNode = mxnetNodes[input.first];
+			if (inNode.strOp == "null") {
+				inRefs.push_back(variables[input.first]);
+				CHECK(inRefs.back().pData != nullptr ||
+						(node.strOp == "SoftmaxOutput" && j == 1)) <<
+						"Variable " << inNode.strName << " of " <<
+						node.strName << " is neither an input nor a parameter";
+			} else {
+				auto &tensor = nodeTensors[input.first][input.second];
+				inRefs.push_back({tensor.data.data(), tensor.shape});
+			}
+		}
+		if (node.strOp == "BatchNorm" && node.inputs.size() == 3) {
+			// Moving mean and var are not listed in inputs by old MxNet
+			auto statNames = BatchNormStatNames(mxnetNodes[
+					node.inputs[1].first].strName);
+			for (auto &strStat : statNames) {
+				const MxnetParam *pParam = FindParam(strStat);
+				CHECK(pParam != nullptr) << "Parameter " << strStat <<
+						" of " << node.strName << " not found";
+				inRefs.push_back({pParam->pData, pParam->shape});
+			}
+		}
+
+		auto &outputs = nodeTensors[i];
+		for (auto &shape : nodeShapes[i]) {
+			CHECK(!shape.empty()) << "Unknown output shape of " << node.strName;
+			outputs.push_back({shape, std::vector<float>(ShapeCount(shape))});
+		}
+		iKernel->second(node, inRefs, outputs, nNumThreads);
+	}
+	return nodeTensors;
+}
+
+std::vector<MxnetInput> MxnetGraphOutputs(
+		const std::vector<MxnetNode> &mxnetNodes) {
+	std::set<MxnetInput> usedOutputs;
+	for (auto &node : mxnetNodes) {
+		usedOutputs.insert(node.inputs.begin(), node.inputs.end());
+	}
+	std::vector<MxnetInput> outputs;
+	for (size_t i = 0; i < mxnetNodes.size(); ++i) {
+		auto &node = mxnetNodes[i];
+		if (node.strOp == "null") {
+			continue;
+		}
+		size_t nNumOutputs = 1;
+		if (node.strOp == "SliceChannel") {
+			nNumOutputs = Str2Num<size_t>(
+					node.attrs.GetValue("num_outputs", true), 1);
+		}
+		for (size_t j = 0; j < nNumOutputs; ++j) {
+			if (usedOutputs.count(MxnetInput(i, j)) == 0) {
+				outputs.emplace_back(i, j);
+			}
+		}
+	}
+	return outputs;
+}
@@ -0,0 +1,45 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Reference executor of the MxNet nodes on CPU.
+*	The nodes are run in their order by the semantics of MxNet in inference
+*	mode, independently of the conversion, so the outputs of the converted
+*	net can be checked against them. Every op supported by the converter is
+*	implemented, also where caffe behaves differently (pooling convention,
+*	axes of softmax, fix_gamma of BatchNorm).
+*/
+
+#ifndef MXNET_EXECUTOR_HPP_
+#define MXNET_EXECUTOR_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "mxnet_parser.hpp"
+
+struct Tensor {
+	Shape shape;
+	std::vector<float> data;
+};
+
+// Output tensors of each node, indexed like NodeShapes. Variables have no
+//	tensors, they are read from the inputs or from the parameters.
+using NodeTensors = std::vector<std::vector<Tensor>>;
+
+// Runs all nodes with convolutions and matrix products in parallel by
+//	nNumThreads (0 for all hardware threads). Variables not given in inputs
+//	are looked up in mxnetParams, the labels of SoftmaxOutput may be absent.
+NodeTensors RunMxnetGraph(const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<MxnetParam> &mxnetParams,
+		const std::map<std::string, Tensor> &inputs, size_t nNumThreads);
+
+// Outputs of nodes not used by any other node, which are the outputs of the
+//	symbol
+std::vector<MxnetInput> MxnetGraphOutputs(
+		const std::vector<MxnetNode> &mxnetNodes);
+
+#endif /* MXNET_EXECUTOR_HPP_ */
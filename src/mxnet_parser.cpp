@@ -9,7 +9,15 @@
 */
 
 #include "mxnet_parser.hpp"
+#include <cerrno>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <numeric>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <glog/logging.h>
 
 #include "json_helper.hpp"
@@ -42,7 +50,7 @@ MxnetNode ParseMxnetNode(Json::iterator jNode) {
 	return std::move(node);
 }
 
-std::pair<std::vector<MxnetNode>, std::vector<size_t>> ParseMxnetJson(
+std::pair<std::vector<MxnetNode>, std::vector<MxnetInput>> ParseMxnetJson(
 		const std::string &strFile) {
 	std::ifstream jsonFile(strFile);
 	CHECK(jsonFile.is_open()) << strFile;
@@ -51,14 +59,19 @@ std::pair<std::vector<MxnetNode>, std::vector<size_t>> ParseMxnetJson(
 	jsonFile.close();
 
 	std::vector<MxnetNode> nodes;
-	std::vector<size_t> headIndices;
+	std::vector<MxnetInput> heads;
 	std::vector<size_t> argIndices;
 	for (Json::iterator jField = jModel.begin();
 			jField != jModel.end(); ++jField) {
 		if (jField.key() == "nodes") {
 			nodes = ParseArray<MxnetNode>(jField, ParseMxnetNode);
-		} else if (jField.key() == "headIndices") {
-			headIndices = ParseArray<size_t>(jField);
+		} else if (jField.key() == "heads") {
+			// [node, index, version] of each output
+			for (auto &jHead : *jField) {
+				CHECK(jHead.is_array() && jHead.size() >= 2U);
+				heads.emplace_back(jHead[0].get<size_t>(),
+						jHead[1].get<size_t>());
+			}
 		} else if (jField.key() == "arg_nodes") {
 			argIndices = ParseArray<size_t>(jField);
 		} else if (jField.key() == "attrs") {
@@ -68,81 +81,99 @@ std::pair<std::vector<MxnetNode>, std::vector<size_t>> ParseMxnetJson(
 	for (auto iArgIdx : argIndices) {
 		CHECK(nodes[iArgIdx].strOp == "null");
 	}
+	for (auto &head : heads) {
+		CHECK_LT(head.first, nodes.size()) << "Head out of the nodes";
+	}
 
-	return std::make_pair(std::move(nodes), std::move(headIndices));
+	return std::make_pair(std::move(nodes), std::move(heads));
 }
 
 
+// Reads a value from the mapped params file
+template<typename _Ty>
+_Ty ReadValue(const char *&pCur, const char *pEnd) {
+	CHECK_LE(sizeof(_Ty), size_t(pEnd - pCur)) << "Unexpected end of params";
+	_Ty val;
+	memcpy(&val, pCur, sizeof(_Ty));
+	pCur += sizeof(_Ty);
+	return val;
+}
+
 std::vector<MxnetParam> LoadMxnetParam(std::string strModelFn) {
-	FILE* fp = fopen(strModelFn.c_str(), "rb");
-	CHECK(fp != 0) << strModelFn;
+	int fd = open(strModelFn.c_str(), O_RDONLY);
+	CHECK_GE(fd, 0) << strModelFn << ": " << strerror(errno);
+	struct stat fileStat;
+	CHECK_EQ(fstat(fd, &fileStat), 0) << strModelFn << ": " << strerror(errno);
+	size_t nFileSize = fileStat.st_size;
+	CHECK_GT(nFileSize, 0) << strModelFn;
+	void *pMap = mmap(nullptr, nFileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	CHECK(pMap != MAP_FAILED) << strModelFn << ": " << strerror(errno);
+	close(fd);
+	std::shared_ptr<const char> pFile((const char*)pMap,
+			[nFileSize](const char *p) {
+				munmap((void*)p, nFileSize);
+			}
+		);
+	const char *pCur = pFile.get();
+	const char *pEnd = pCur + nFileSize;
 
 	std::vector<MxnetParam> params;
 
-	uint64_t header;
-	uint64_t reserved;
-	fread(&header, 1, sizeof(uint64_t), fp);
-	fread(&reserved, 1, sizeof(uint64_t), fp);
-
-	uint64_t data_count;
-	fread(&data_count, 1, sizeof(uint64_t), fp);
+	ReadValue<uint64_t>(pCur, pEnd); // header
+	ReadValue<uint64_t>(pCur, pEnd); // reserved
+	uint64_t data_count = ReadValue<uint64_t>(pCur, pEnd);
 
 	for (int i = 0; i < (int)data_count; i++) {
-		uint32_t magic;// 0xF993FAC9
-		fread(&magic, 1, sizeof(uint32_t), fp);
+		uint32_t magic = ReadValue<uint32_t>(pCur, pEnd); // 0xF993FAC9
 		// shape
 		uint32_t ndim;
 		std::vector<int64_t> shape;
 		if (magic == 0xF993FAC9) {
-			int32_t stype;
-			fread(&stype, 1, sizeof(int32_t), fp);
-			fread(&ndim, 1, sizeof(uint32_t), fp);
-			shape.resize(ndim);
-			fread(&shape[0], 1, ndim * sizeof(int64_t), fp);
+			ReadValue<int32_t>(pCur, pEnd); // stype
+			ndim = ReadValue<uint32_t>(pCur, pEnd);
+			for (int j = 0; j < (int)ndim; j++) {
+				shape.push_back(ReadValue<int64_t>(pCur, pEnd));
+			}
 		} else if (magic == 0xF993FAC8)	{
-			fread(&ndim, 1, sizeof(uint32_t), fp);
-			shape.resize(ndim);
-			fread(&shape[0], 1, ndim * sizeof(int64_t), fp);
+			ndim = ReadValue<uint32_t>(pCur, pEnd);
+			for (int j = 0; j < (int)ndim; j++) {
+				shape.push_back(ReadValue<int64_t>(pCur, pEnd));
+			}
 		} else {
 			ndim = magic;
-			shape.resize(ndim);
-			std::vector<uint32_t> shape32;
-			shape32.resize(ndim);
-			fread(&shape32[0], 1, ndim * sizeof(uint32_t), fp);
-			for (int j=0; j<(int)ndim; j++) {
-				shape[j] = shape32[j];
+			for (int j = 0; j < (int)ndim; j++) {
+				shape.push_back(ReadValue<uint32_t>(pCur, pEnd));
 			}
 		}
 
 		// context
-		int32_t dev_type;
-		int32_t dev_id;
-		fread(&dev_type, 1, sizeof(int32_t), fp);
-		fread(&dev_id, 1, sizeof(int32_t), fp);
-
-		int32_t type_flag;
-		fread(&type_flag, 1, sizeof(int32_t), fp);
+		ReadValue<int32_t>(pCur, pEnd); // dev_type
+		ReadValue<int32_t>(pCur, pEnd); // dev_id
 
-		// data
-		size_t len = 0;
-		if (shape.size() == 1) len = shape[0];
-		if (shape.size() == 2) len = shape[0] * shape[1];
-		if (shape.size() == 3) len = shape[0] * shape[1] * shape[2];
-		if (shape.size() == 4) len = shape[0] * shape[1] * shape[2] * shape[3];
+		int32_t type_flag = ReadValue<int32_t>(pCur, pEnd);
+		CHECK_EQ(type_flag, 0) << "Only float32 parameters are supported";
 
+		// data, referenced in place
 		MxnetParam p;
-		p.data.resize(len);
-		fread(&p.data[0], 1, len * sizeof(float), fp);
+		p.shape.assign(shape.begin(), shape.end());
+		p.nCount = shape.empty() ? 0 : std::accumulate(shape.begin(),
+				shape.end(), size_t(1), std::multiplies<size_t>());
+		CHECK_LE(p.nCount * sizeof(float), size_t(pEnd - pCur)) <<
+				"Unexpected end of params";
+		CHECK_EQ((uintptr_t)pCur % alignof(float), 0);
+		p.pData = (const float*)pCur;
+		p.pFile = pFile;
+		pCur += p.nCount * sizeof(float);
 		params.emplace_back(std::move(p));
 	}
-	uint64_t name_count;
-	fread(&name_count, 1, sizeof(uint64_t), fp);
+	uint64_t name_count = ReadValue<uint64_t>(pCur, pEnd);
+	CHECK_EQ(name_count, data_count);
 	for (int i = 0; i < (int)name_count; i++) {
-		uint64_t len;
-		fread(&len, 1, sizeof(uint64_t), fp);
+		uint64_t len = ReadValue<uint64_t>(pCur, pEnd);
+		CHECK_LE(len, uint64_t(pEnd - pCur)) << "Unexpected end of params";
 		MxnetParam& p = params[i];
-		p.strName.resize(len);
-		fread((char*)p.strName.data(), 1, len, fp);
+		p.strName.assign(pCur, len);
+		pCur += len;
 		if (memcmp(p.strName.c_str(), "arg:", 4) == 0) {
 			p.strName = std::string(p.strName.c_str() + 4);
 		}
@@ -150,9 +181,5 @@ std::vector<MxnetParam> LoadMxnetParam(std::string strModelFn) {
 			p.strName = std::string(p.strName.c_str() + 4);
 		}
 	}
-
-	fclose(fp);
-	return std::move(params);
+	return params;
 }
-
-
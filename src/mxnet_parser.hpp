@@ -11,6 +11,7 @@
 #ifndef _MXNET_PARSER_HPP
 #define _MXNET_PARSER_HPP
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
@@ -27,10 +28,14 @@ struct MxnetNode {
 
 struct MxnetParam {
 	std::string strName;
-	std::vector<float> data;
+	Shape shape;
+	const float *pData;	// points into the memory mapped params file
+	size_t nCount;
+	std::shared_ptr<const char> pFile; // keeps the file mapped
 };
 
-std::pair<std::vector<MxnetNode>, std::vector<size_t>> ParseMxnetJson(
+// The nodes and the heads, which are the outputs of the graph
+std::pair<std::vector<MxnetNode>, std::vector<MxnetInput>> ParseMxnetJson(
 		const std::string &strFile);
 
 std::vector<MxnetParam> LoadMxnetParam(std::string strModelFn);
@@ -0,0 +1,53 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Running independent jobs on a pool of threads
+*/
+
+#ifndef PARALLEL_HPP_
+#define PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Number of threads to use, 0 means the number of hardware threads
+inline size_t NumWorkerThreads(size_t nNumThreads) {
+	if (nNumThreads == 0) {
+		nNumThreads = std::thread::hardware_concurrency();
+	}
+	return std::max(nNumThreads, size_t(1));
+}
+
+// Calls job(i) for each i in [0, nNumJobs), jobs are taken in order by the
+//	first idle thread. The calling thread works as one of the threads.
+inline void ParallelFor(size_t nNumJobs, size_t nNumThreads,
+		const std::function<void(size_t)> &job) {
+	nNumThreads = std::min(NumWorkerThreads(nNumThreads), nNumJobs);
+	if (nNumThreads <= 1) {
+		for (size_t i = 0; i < nNumJobs; ++i) {
+			job(i);
+		}
+		return;
+	}
+	std::atomic<size_t> nNextJob(0);
+	auto worker = [&]() {
+		for (size_t i = nNextJob++; i < nNumJobs; i = nNextJob++) {
+			job(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < nNumThreads; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+#endif /* PARALLEL_HPP_ */
@@ -0,0 +1,235 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Profiling of the stages of a conversion
+*/
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "json_helper.hpp"
+#include "resource_usage.hpp"
+
+// Allocations are only counted while profiling
+std::atomic<bool> g_bProfiling(false);
+std::atomic<size_t> g_nNumAllocs(0);
+std::atomic<size_t> g_nAllocBytes(0);
+
+void* CountedAlloc(size_t nBytes) {
+	if (g_bProfiling.load(std::memory_order_relaxed)) {
+		g_nNumAllocs.fetch_add(1, std::memory_order_relaxed);
+		g_nAllocBytes.fetch_add(nBytes, std::memory_order_relaxed);
+	}
+	return std::malloc(nBytes == 0 ? 1 : nBytes);
+}
+
+void* ThrowingAlloc(size_t nBytes) {
+	void *p = CountedAlloc(nBytes);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(size_t nBytes) {
+	return ThrowingAlloc(nBytes);
+}
+
+void* operator new[](size_t nBytes) {
+	return ThrowingAlloc(nBytes);
+}
+
+void* operator new(size_t nBytes, const std::nothrow_t&) noexcept {
+	return CountedAlloc(nBytes);
+}
+
+void* operator new[](size_t nBytes, const std::nothrow_t&) noexcept {
+	return CountedAlloc(nBytes);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	std::free(p);
+}
+
+struct ProfileCounters {
+	std::chrono::steady_clock::time_point tWall;
+	double dCpuSeconds;
+	size_t nReadBytes;
+	size_t nWrittenBytes;
+	size_t nNumAllocs;
+	size_t nAllocBytes;
+};
+
+ProfileCounters ReadCounters() {
+	ProfileCounters counters;
+	counters.tWall = std::chrono::steady_clock::now();
+	counters.dCpuSeconds = ProcessCpuSeconds();
+	ReadIoBytes(counters.nReadBytes, counters.nWrittenBytes);
+	counters.nNumAllocs = g_nNumAllocs.load();
+	counters.nAllocBytes = g_nAllocBytes.load();
+	return counters;
+}
+
+struct OpenStage {
+	size_t iStage;
+	ProfileCounters begin;
+	size_t nPeakRss; // the peak of nested stages, whose begin reset the peak
+};
+
+struct ProfilerState {
+	std::chrono::steady_clock::time_point tStart;
+	std::vector<ProfileStage> stages;
+	std::vector<OpenStage> openStages;
+};
+
+ProfilerState& Profiler() {
+	static ProfilerState state;
+	return state;
+}
+
+double Milliseconds(std::chrono::steady_clock::duration d) {
+	return std::chrono::duration<double, std::milli>(d).count();
+}
+
+ProfileScope::ProfileScope(const char *pName)
+		: m_bRecording(IsProfiling()) {
+	if (!m_bRecording) {
+		return;
+	}
+	auto &profiler = Profiler();
+	size_t nPeakRss = PeakRssBytes();
+	if (!profiler.openStages.empty()) {
+		auto &parent = profiler.openStages.back();
+		parent.nPeakRss = std::max(parent.nPeakRss, nPeakRss);
+	}
+	ResetPeakRss();
+	auto counters = ReadCounters();
+	ProfileStage stage = {pName, profiler.openStages.size(),
+			Milliseconds(counters.tWall - profiler.tStart), 0., 0., 0, 0, 0,
+			0, 0};
+	profiler.stages.emplace_back(std::move(stage));
+	profiler.openStages.push_back({profiler.stages.size() - 1, counters, 0});
+}
+
+ProfileScope::~ProfileScope() {
+	if (!m_bRecording) {
+		return;
+	}
+	auto &profiler = Profiler();
+	auto counters = ReadCounters();
+	auto &open = profiler.openStages.back();
+	auto &stage = profiler.stages[open.iStage];
+	stage.dWallMs = Milliseconds(counters.tWall - open.begin.tWall);
+	stage.dCpuMs = (counters.dCpuSeconds - open.begin.dCpuSeconds) * 1000.;
+	stage.nReadBytes = counters.nReadBytes - open.begin.nReadBytes;
+	stage.nWrittenBytes = counters.nWrittenBytes - open.begin.nWrittenBytes;
+	stage.nNumAllocs = counters.nNumAllocs - open.begin.nNumAllocs;
+	stage.nAllocBytes = counters.nAllocBytes - open.begin.nAllocBytes;
+	stage.nPeakRss = std::max(open.nPeakRss, PeakRssBytes());
+	profiler.openStages.pop_back();
+	if (!profiler.openStages.empty()) {
+		auto &parent = profiler.openStages.back();
+		parent.nPeakRss = std::max(parent.nPeakRss, stage.nPeakRss);
+	}
+}
+
+void StartProfiling() {
+	Profiler().tStart = std::chrono::steady_clock::now();
+	g_bProfiling = true;
+}
+
+bool IsProfiling() {
+	return g_bProfiling.load(std::memory_order_relaxed);
+}
+
+const std::vector<ProfileStage>& ProfiledStages() {
+	return Profiler().stages;
+}
+
+std::string FormatProfileReport() {
+	std::ostringstream oss;
+	oss << std::left << std::setw(28) << "stage" << std::right <<
+			std::setw(12) << "wall ms" << std::setw(12) << "cpu ms" <<
+			std::setw(12) << "read MB" << std::setw(12) << "write MB" <<
+			std::setw(12) << "allocs" << std::setw(12) << "alloc MB" <<
+			std::setw(12) << "peak RSS MB";
+	oss << std::fixed << std::setprecision(1);
+	for (auto &stage : ProfiledStages()) {
+		oss << "\n" << std::left << std::setw(28) <<
+				(std::string(stage.nDepth * 2, ' ') + stage.strName) <<
+				std::right << std::setw(12) << stage.dWallMs << std::setw(12) <<
+				stage.dCpuMs << std::setw(12) << stage.nReadBytes / 1048576. <<
+				std::setw(12) << stage.nWrittenBytes / 1048576. <<
+				std::setw(12) << stage.nNumAllocs << std::setw(12) <<
+				stage.nAllocBytes / 1048576. << std::setw(12) <<
+				stage.nPeakRss / 1048576.;
+	}
+	return oss.str();
+}
+
+Json StageMetrics(const ProfileStage &stage) {
+	return {{"wall_ms", stage.dWallMs}, {"cpu_ms", stage.dCpuMs},
+			{"read_bytes", stage.nReadBytes},
+			{"written_bytes", stage.nWrittenBytes},
+			{"allocations", stage.nNumAllocs},
+			{"allocated_bytes", stage.nAllocBytes},
+			{"peak_rss_bytes", stage.nPeakRss}};
+}
+
+void WriteProfileReport(const std::string &strFn) {
+	Json jStages = Json::array();
+	for (auto &stage : ProfiledStages()) {
+		Json jStage = StageMetrics(stage);
+		jStage["name"] = stage.strName;
+		jStage["depth"] = stage.nDepth;
+		jStage["begin_ms"] = stage.dBeginMs;
+		jStages.push_back(std::move(jStage));
+	}
+	std::ofstream reportFile(strFn);
+	CHECK(reportFile.is_open()) << strFn;
+	reportFile << Json({{"stages", std::move(jStages)}}).dump(1) << std::endl;
+}
+
+void WriteChromeTrace(const std::string &strFn) {
+	int nPid = (int)getpid();
+	Json jEvents = Json::array();
+	jEvents.push_back({{"name", "process_name"}, {"ph", "M"}, {"pid", nPid},
+			{"tid", 0}, {"args", {{"name", "mxnet2caffe"}}}});
+	for (auto &stage : ProfiledStages()) {
+		jEvents.push_back({{"name", stage.strName}, {"cat", "stage"},
+				{"ph", "X"}, {"pid", nPid}, {"tid", 0},
+				{"ts", stage.dBeginMs * 1000.}, {"dur", stage.dWallMs * 1000.},
+				{"args", StageMetrics(stage)}});
+		jEvents.push_back({{"name", "peak RSS MB"}, {"ph", "C"},
+				{"pid", nPid}, {"ts", (stage.dBeginMs + stage.dWallMs) * 1000.},
+				{"args", {{"peak", stage.nPeakRss / 1048576.}}}});
+	}
+	std::ofstream traceFile(strFn);
+	CHECK(traceFile.is_open()) << strFn;
+	traceFile << Json({{"traceEvents", std::move(jEvents)},
+			{"displayTimeUnit", "ms"}}).dump() << std::endl;
+}
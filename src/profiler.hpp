@@ -0,0 +1,59 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Profiling of the stages of a conversion.
+*	A stage is the lifetime of a ProfileScope. The wall and CPU time, the
+*	bytes read and written, the allocations by operator new and the peak
+*	RSS of each stage are recorded once StartProfiling is called, and are
+*	written as a json report and as a Chrome trace (chrome://tracing or
+*	ui.perfetto.dev). Scopes may be nested, and are to be opened by one
+*	thread; the counters include the work of all threads.
+*/
+
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <string>
+#include <vector>
+
+struct ProfileStage {
+	std::string strName;
+	size_t nDepth;			// number of stages enclosing it
+	double dBeginMs;		// from StartProfiling
+	double dWallMs;
+	double dCpuMs;
+	size_t nReadBytes;		// by system calls, mapped files are not counted
+	size_t nWrittenBytes;
+	size_t nNumAllocs;
+	size_t nAllocBytes;
+	size_t nPeakRss;
+};
+
+class ProfileScope {
+public:
+	explicit ProfileScope(const char *pName);
+	~ProfileScope();
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+private:
+	bool m_bRecording;
+};
+
+void StartProfiling();
+
+bool IsProfiling();
+
+// Completed stages in the order they began
+const std::vector<ProfileStage>& ProfiledStages();
+
+// One line for each stage, indented by its depth
+std::string FormatProfileReport();
+
+void WriteProfileReport(const std::string &strFn);
+
+// Trace event format of Chrome, one complete event for each stage
+void WriteChromeTrace(const std::string &strFn);
+
+#endif /* PROFILER_HPP_ */
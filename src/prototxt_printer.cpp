@@ -0,0 +1,510 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Streaming printer of the prototxt
+*/
+
+#include "prototxt_printer.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <glog/logging.h>
+
+namespace proto = google::protobuf;
+
+using FieldList = std::vector<const proto::FieldDescriptor*>;
+
+// Size of the buffer to be flushed to the stream
+const size_t PRINT_BUFFER_BYTES = 1 << 20;
+
+void PrintIndent(int nIndent, std::string &out) {
+	out.append(nIndent * 2, ' ');
+}
+
+void PrintValue(bool bVal, std::string &out) {
+	out += bVal ? "true" : "false";
+}
+
+void PrintValue(uint64_t nVal, std::string &out) {
+	char szBuf[24];
+	char *pEnd = szBuf + sizeof(szBuf), *pBeg = pEnd;
+	do {
+		*--pBeg = char('0' + nVal % 10);
+		nVal /= 10;
+	} while (nVal != 0);
+	out.append(pBeg, pEnd);
+}
+
+void PrintValue(int64_t nVal, std::string &out) {
+	if (nVal < 0) {
+		out += '-';
+		PrintValue(uint64_t(0) - uint64_t(nVal), out);
+	} else {
+		PrintValue(uint64_t(nVal), out);
+	}
+}
+
+void PrintValue(int32_t nVal, std::string &out) {
+	PrintValue(int64_t(nVal), out);
+}
+
+void PrintValue(uint32_t nVal, std::string &out) {
+	PrintValue(uint64_t(nVal), out);
+}
+
+// Same as SimpleFtoa of protobuf: shortest of %.6g and %.9g to round trip
+void PrintValue(float fVal, std::string &out) {
+	if (std::isnan(fVal)) {
+		out += "nan";
+	} else if (std::isinf(fVal)) {
+		out += fVal > 0 ? "inf" : "-inf";
+	} else if (std::fabs(fVal) < 1e6f && fVal == (float)(int32_t)fVal &&
+			!std::signbit(fVal)) {
+		// Small integers are exactly what %.6g gives
+		PrintValue((int32_t)fVal, out);
+	} else {
+		char szBuf[32];
+		snprintf(szBuf, sizeof(szBuf), "%.*g", FLT_DIG, fVal);
+		if (strtof(szBuf, nullptr) != fVal) {
+			snprintf(szBuf, sizeof(szBuf), "%.*g", FLT_DIG + 3, fVal);
+		}
+		out += szBuf;
+	}
+}
+
+// Quoted and escaped as CEscape of protobuf
+void PrintValue(const std::string &strVal, std::string &out) {
+	out += '"';
+	size_t nPlain = 0; // beginning of the unescaped characters
+	for (size_t i = 0; i < strVal.size(); ++i) {
+		unsigned char c = strVal[i];
+		if (c >= 0x20 && c < 0x7F && c != '\"' && c != '\'' && c != '\\') {
+			continue;
+		}
+		out.append(strVal, nPlain, i - nPlain);
+		nPlain = i + 1;
+		switch (c) {
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		case '\"': out += "\\\""; break;
+		case '\'': out += "\\\'"; break;
+		case '\\': out += "\\\\"; break;
+		default:
+			char szOct[5];
+			snprintf(szOct, sizeof(szOct), "\\%03o", c);
+			out += szOct;
+		}
+	}
+	out.append(strVal, nPlain, strVal.size() - nPlain);
+	out += '"';
+}
+
+template<typename _Ty>
+void PrintScalar(const char *pName, const _Ty &val, int nIndent,
+		std::string &out) {
+	PrintIndent(nIndent, out);
+	out += pName;
+	out += ": ";
+	PrintValue(val, out);
+	out += '\n';
+}
+
+// Enums are printed by the name of the value
+void PrintEnum(const char *pName, const std::string &strValName, int nIndent,
+		std::string &out) {
+	PrintIndent(nIndent, out);
+	out += pName;
+	out += ": ";
+	out += strValName;
+	out += '\n';
+}
+
+template<typename _Container>
+void PrintRepeated(const char *pName, const _Container &values, int nIndent,
+		std::string &out) {
+	for (auto &val : values) {
+		PrintScalar(pName, val, nIndent, out);
+	}
+}
+
+void PrintReflective(const proto::Message &msg, int nIndent,
+		std::string &out) {
+	proto::TextFormat::Printer printer;
+	printer.SetInitialIndentLevel(nIndent);
+	std::string strMsg;
+	CHECK(printer.PrintToString(msg, &strMsg));
+	out += strMsg;
+}
+
+template<typename _Msg>
+void PrintMessage(const _Msg &msg, int nIndent, std::string &out);
+
+template<typename _Msg>
+void PrintSubMessage(const char *pName, const _Msg &msg, int nIndent,
+		std::string &out) {
+	PrintIndent(nIndent, out);
+	out += pName;
+	out += " {\n";
+	PrintMessage(msg, nIndent + 1, out);
+	PrintIndent(nIndent, out);
+	out += "}\n";
+}
+
+template<typename _Container>
+void PrintSubMessages(const char *pName, const _Container &msgs,
+		int nIndent, std::string &out) {
+	for (auto &msg : msgs) {
+		PrintSubMessage(pName, msg, nIndent, out);
+	}
+}
+
+// Each PrintField prints a field by its number and returns false if the
+//	field isn't known, the message is then printed by reflection.
+
+bool PrintField(const caffe::BlobShape &shape, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintRepeated("dim", shape.dim(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::FillerParameter &filler, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("type", filler.type(), nIndent, out); return true;
+	case 2: PrintScalar("value", filler.value(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ParamSpec &spec, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("name", spec.name(), nIndent, out); return true;
+	case 3: PrintScalar("lr_mult", spec.lr_mult(), nIndent, out); return true;
+	case 4: PrintScalar("decay_mult", spec.decay_mult(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::LossParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("ignore_label", param.ignore_label(), nIndent, out);
+		return true;
+	case 2: PrintScalar("normalize", param.normalize(), nIndent, out);
+		return true;
+	case 3: PrintEnum("normalization", caffe::LossParameter::NormalizationMode_Name(
+			param.normalization()), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ConcatParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 2: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ConvolutionParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("num_output", param.num_output(), nIndent, out);
+		return true;
+	case 2: PrintScalar("bias_term", param.bias_term(), nIndent, out);
+		return true;
+	case 3: PrintRepeated("pad", param.pad(), nIndent, out); return true;
+	case 4: PrintRepeated("kernel_size", param.kernel_size(), nIndent, out);
+		return true;
+	case 5: PrintScalar("group", param.group(), nIndent, out); return true;
+	case 6: PrintRepeated("stride", param.stride(), nIndent, out); return true;
+	case 9: PrintScalar("pad_h", param.pad_h(), nIndent, out); return true;
+	case 10: PrintScalar("pad_w", param.pad_w(), nIndent, out); return true;
+	case 11: PrintScalar("kernel_h", param.kernel_h(), nIndent, out);
+		return true;
+	case 12: PrintScalar("kernel_w", param.kernel_w(), nIndent, out);
+		return true;
+	case 13: PrintScalar("stride_h", param.stride_h(), nIndent, out);
+		return true;
+	case 14: PrintScalar("stride_w", param.stride_w(), nIndent, out);
+		return true;
+	case 18: PrintRepeated("dilation", param.dilation(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::DropoutParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("dropout_ratio", param.dropout_ratio(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::EltwiseParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintEnum("operation", caffe::EltwiseParameter::EltwiseOp_Name(
+			param.operation()), nIndent, out); return true;
+	case 2: PrintRepeated("coeff", param.coeff(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::InnerProductParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("num_output", param.num_output(), nIndent, out);
+		return true;
+	case 2: PrintScalar("bias_term", param.bias_term(), nIndent, out);
+		return true;
+	case 5: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	case 6: PrintScalar("transpose", param.transpose(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::PoolingParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintEnum("pool", caffe::PoolingParameter::PoolMethod_Name(
+			param.pool()), nIndent, out); return true;
+	case 2: PrintScalar("kernel_size", param.kernel_size(), nIndent, out);
+		return true;
+	case 3: PrintScalar("stride", param.stride(), nIndent, out); return true;
+	case 4: PrintScalar("pad", param.pad(), nIndent, out); return true;
+	case 5: PrintScalar("kernel_h", param.kernel_h(), nIndent, out);
+		return true;
+	case 6: PrintScalar("kernel_w", param.kernel_w(), nIndent, out);
+		return true;
+	case 7: PrintScalar("stride_h", param.stride_h(), nIndent, out);
+		return true;
+	case 8: PrintScalar("stride_w", param.stride_w(), nIndent, out);
+		return true;
+	case 9: PrintScalar("pad_h", param.pad_h(), nIndent, out); return true;
+	case 10: PrintScalar("pad_w", param.pad_w(), nIndent, out); return true;
+	case 12: PrintScalar("global_pooling", param.global_pooling(), nIndent,
+			out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::PowerParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("power", param.power(), nIndent, out); return true;
+	case 2: PrintScalar("scale", param.scale(), nIndent, out); return true;
+	case 3: PrintScalar("shift", param.shift(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ReLUParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("negative_slope", param.negative_slope(), nIndent,
+			out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::SoftmaxParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 2: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::SliceParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 2: PrintRepeated("slice_point", param.slice_point(), nIndent, out);
+		return true;
+	case 3: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ReshapeParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintSubMessage("shape", param.shape(), nIndent, out); return true;
+	case 2: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	case 3: PrintScalar("num_axes", param.num_axes(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::BatchNormParameter &param, int nField,
+		int nIndent, std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("use_global_stats", param.use_global_stats(),
+			nIndent, out); return true;
+	case 2: PrintScalar("moving_average_fraction",
+			param.moving_average_fraction(), nIndent, out); return true;
+	case 3: PrintScalar("eps", param.eps(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ELUParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("alpha", param.alpha(), nIndent, out); return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::BiasParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	case 2: PrintScalar("num_axes", param.num_axes(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::ScaleParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("axis", param.axis(), nIndent, out); return true;
+	case 2: PrintScalar("num_axes", param.num_axes(), nIndent, out);
+		return true;
+	case 3: PrintSubMessage("filler", param.filler(), nIndent, out);
+		return true;
+	case 4: PrintScalar("bias_term", param.bias_term(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::InputParameter &param, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintSubMessages("shape", param.shape(), nIndent, out);
+		return true;
+	}
+	return false;
+}
+
+bool PrintField(const caffe::LayerParameter &layer, int nField, int nIndent,
+		std::string &out) {
+	switch (nField) {
+	case 1: PrintScalar("name", layer.name(), nIndent, out); return true;
+	case 2: PrintScalar("type", layer.type(), nIndent, out); return true;
+	case 3: PrintRepeated("bottom", layer.bottom(), nIndent, out);
+		return true;
+	case 4: PrintRepeated("top", layer.top(), nIndent, out); return true;
+	case 5: PrintRepeated("loss_weight", layer.loss_weight(), nIndent, out);
+		return true;
+	case 6: PrintSubMessages("param", layer.param(), nIndent, out);
+		return true;
+	case 10: PrintEnum("phase", caffe::Phase_Name(layer.phase()), nIndent,
+			out); return true;
+	case 101: PrintSubMessage("loss_param", layer.loss_param(), nIndent, out);
+		return true;
+	case 104: PrintSubMessage("concat_param", layer.concat_param(), nIndent,
+			out); return true;
+	case 106: PrintSubMessage("convolution_param", layer.convolution_param(),
+			nIndent, out); return true;
+	case 108: PrintSubMessage("dropout_param", layer.dropout_param(),
+			nIndent, out); return true;
+	case 110: PrintSubMessage("eltwise_param", layer.eltwise_param(),
+			nIndent, out); return true;
+	case 117: PrintSubMessage("inner_product_param",
+			layer.inner_product_param(), nIndent, out); return true;
+	case 121: PrintSubMessage("pooling_param", layer.pooling_param(),
+			nIndent, out); return true;
+	case 122: PrintSubMessage("power_param", layer.power_param(), nIndent,
+			out); return true;
+	case 123: PrintSubMessage("relu_param", layer.relu_param(), nIndent, out);
+		return true;
+	case 125: PrintSubMessage("softmax_param", layer.softmax_param(),
+			nIndent, out); return true;
+	case 126: PrintSubMessage("slice_param", layer.slice_param(), nIndent,
+			out); return true;
+	case 133: PrintSubMessage("reshape_param", layer.reshape_param(),
+			nIndent, out); return true;
+	case 139: PrintSubMessage("batch_norm_param", layer.batch_norm_param(),
+			nIndent, out); return true;
+	case 140: PrintSubMessage("elu_param", layer.elu_param(), nIndent, out);
+		return true;
+	case 141: PrintSubMessage("bias_param", layer.bias_param(), nIndent, out);
+		return true;
+	case 142: PrintSubMessage("scale_param", layer.scale_param(), nIndent,
+			out); return true;
+	case 143: PrintSubMessage("input_param", layer.input_param(), nIndent,
+			out); return true;
+	}
+	return false;
+}
+
+// Fields are listed in the order of their numbers, as TextFormat prints
+template<typename _Msg>
+void PrintMessage(const _Msg &msg, int nIndent, std::string &out) {
+	size_t nMark = out.size();
+	auto *pReflection = msg.GetReflection();
+	if (pReflection->GetUnknownFields(msg).empty()) {
+		// Own list of each call, nested messages are printed while iterating
+		FieldList fields;
+		pReflection->ListFields(msg, &fields);
+		bool bKnown = true;
+		for (auto *pField : fields) {
+			if (!(bKnown = PrintField(msg, pField->number(), nIndent, out))) {
+				break;
+			}
+		}
+		if (bKnown) {
+			return;
+		}
+	}
+	out.resize(nMark);
+	PrintReflective(msg, nIndent, out);
+}
+
+void PrintNetPrototxt(const caffe::NetParameter &net, std::ostream &os) {
+	auto *pReflection = net.GetReflection();
+	std::vector<const proto::FieldDescriptor*> fields;
+	pReflection->ListFields(net, &fields);
+	bool bKnown = pReflection->GetUnknownFields(net).empty();
+	for (auto *pField : fields) {
+		int nField = pField->number();
+		bKnown = bKnown && (nField == 1 || nField == 100);
+	}
+	if (!bKnown) {
+		proto::io::OstreamOutputStream outStream(&os);
+		CHECK(proto::TextFormat::Print(net, &outStream));
+		return;
+	}
+	std::string out;
+	if (net.has_name()) {
+		PrintScalar("name", net.name(), 0, out);
+	}
+	for (auto &layer : net.layer()) {
+		PrintSubMessage("layer", layer, 0, out);
+		if (out.size() >= PRINT_BUFFER_BYTES) {
+			os.write(out.data(), out.size());
+			out.clear();
+		}
+	}
+	os.write(out.data(), out.size());
+}
@@ -0,0 +1,22 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Streaming printer of the prototxt.
+*	Fields generated by the converter are printed by specialized code without
+*	reflection, messages with any other field fall back to TextFormat. The
+*	output is identical to TextFormat::Print.
+*/
+
+#ifndef PROTOTXT_PRINTER_HPP_
+#define PROTOTXT_PRINTER_HPP_
+
+#include <ostream>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+void PrintNetPrototxt(const caffe::NetParameter &net, std::ostream &os);
+
+#endif /* PROTOTXT_PRINTER_HPP_ */
@@ -0,0 +1,218 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Post-training INT8 quantization of weights
+*/
+
+#include "quantization.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <glog/logging.h>
+
+#include "parallel.hpp"
+#include "shape_inference.hpp"
+
+// Max of absolute values. Bits of non-negative floats are ordered as the
+//	values, so the reduction is done on integers and vectorized by the
+//	compiler without relaxing floating point semantics.
+float MaxAbs(const float *pData, size_t nCount) {
+	uint32_t nMaxBits = 0;
+	for (size_t i = 0; i < nCount; ++i) {
+		uint32_t nBits;
+		std::memcpy(&nBits, pData + i, sizeof(nBits));
+		nBits &= 0x7fffffffu;
+		nMaxBits = nBits > nMaxBits ? nBits : nMaxBits;
+	}
+	float fMaxAbs;
+	std::memcpy(&fMaxAbs, &nMaxBits, sizeof(fMaxAbs));
+	return fMaxAbs;
+}
+
+// Quantizes a channel by the scale, accumulates the squared values and
+//	errors, and updates the max absolute error
+void QuantizeChannel(const float *pData, size_t nCount, float fScale,
+		int8_t *pOut, float &fMaxAbsError, double &dSqSignal,
+		double &dSqError) {
+	float fInvScale = fScale > 0.f ? 1.f / fScale : 0.f;
+	for (size_t i = 0; i < nCount; ++i) {
+		float fVal = pData[i];
+		float fQ = std::min(std::max(fVal * fInvScale, -127.f), 127.f);
+		int8_t q = (int8_t)(fQ + (fQ >= 0.f ? .5f : -.5f));
+		pOut[i] = q;
+		float fErr = std::fabs(fVal - q * fScale);
+		fMaxAbsError = std::max(fMaxAbsError, fErr);
+		dSqSignal += (double)fVal * fVal;
+		dSqError += (double)fErr * fErr;
+	}
+}
+
+QuantizedBlob QuantizeBlob(const caffe::NetParameter &net, int nLayerIdx,
+		size_t nBlobIdx, const WeightBlob &blob) {
+	CHECK(!blob.shape.empty());
+	QuantizedBlob quantized = {nLayerIdx, nBlobIdx, blob.shape, {}, {},
+			0.f, 0.};
+	size_t nNumChannels = blob.shape[0];
+	size_t nChannelSize = ShapeCount(blob.shape) / nNumChannels;
+	quantized.scales.resize(nNumChannels);
+	quantized.data.resize(nNumChannels * nChannelSize);
+	double dSqSignal = 0., dSqError = 0.;
+	for (size_t c = 0; c < nNumChannels; ++c) {
+		const float *pChannel = blob.pData + c * nChannelSize;
+		float fMaxAbs = MaxAbs(pChannel, nChannelSize);
+		CHECK(std::isfinite(fMaxAbs)) << "Non-finite weights in channel " <<
+				c << " of layer " << net.layer(nLayerIdx).name();
+		float fScale = fMaxAbs / 127.f;
+		quantized.scales[c] = fScale;
+		QuantizeChannel(pChannel, nChannelSize, fScale,
+				quantized.data.data() + c * nChannelSize,
+				quantized.fMaxAbsError, dSqSignal, dSqError);
+	}
+	quantized.dSqnr = dSqError > 0. ? 10. * std::log10(dSqSignal / dSqError) :
+			std::numeric_limits<double>::infinity();
+	return quantized;
+}
+
+bool IsQuantizedLayer(const caffe::LayerParameter &layer) {
+	return layer.type() == "Convolution" || layer.type() == "InnerProduct";
+}
+
+std::vector<QuantizedBlob> QuantizeWeights(const caffe::NetParameter &net,
+		const CaffeWeights &weights, size_t nNumThreads) {
+	std::vector<const LayerWeights*> jobs;
+	for (auto &layerWeights : weights.layers) {
+		if (!layerWeights.bShared && !layerWeights.blobs.empty() &&
+				IsQuantizedLayer(net.layer(layerWeights.nLayerIdx))) {
+			jobs.push_back(&layerWeights);
+		}
+	}
+	std::vector<QuantizedBlob> quantized(jobs.size());
+	ParallelFor(jobs.size(), nNumThreads, [&](size_t i) {
+			quantized[i] = QuantizeBlob(net, jobs[i]->nLayerIdx, 0,
+					jobs[i]->blobs[0]);
+		});
+	return quantized;
+}
+
+void WriteInt8Weights(const caffe::NetParameter &net,
+		const CaffeWeights &weights,
+		const std::vector<QuantizedBlob> &quantized,
+		const std::string &strFn) {
+	std::map<std::pair<int, size_t>, const QuantizedBlob*> quantizedBlobs;
+	for (auto &blob : quantized) {
+		quantizedBlobs[std::make_pair(blob.nLayerIdx, blob.nBlobIdx)] = &blob;
+	}
+
+	// Entries and names, then the data of blobs in the order of entries
+	struct Payload {
+		const void *pData;
+		size_t nBytes;
+		size_t nOffset;
+	};
+	std::vector<Int8BlobEntry> entries;
+	std::vector<Payload> payloads;
+	std::string strNames;
+	for (auto &layerWeights : weights.layers) {
+		if (layerWeights.bShared) {
+			continue;
+		}
+		auto &strName = net.layer(layerWeights.nLayerIdx).name();
+		size_t nNameOffset = strNames.size();
+		strNames += strName;
+		for (size_t j = 0; j < layerWeights.blobs.size(); ++j) {
+			auto &blob = layerWeights.blobs[j];
+			CHECK_LE(blob.shape.size(), INT8_MAX_AXES) << strName;
+			Int8BlobEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			entry.nNameOffset = nNameOffset;
+			entry.nNameBytes = (uint32_t)strName.size();
+			entry.nBlobIdx = (uint32_t)j;
+			entry.nNumAxes = (uint32_t)blob.shape.size();
+			std::copy(blob.shape.begin(), blob.shape.end(), entry.dims);
+			auto iQuantized = quantizedBlobs.find(
+					std::make_pair(layerWeights.nLayerIdx, j));
+			if (iQuantized != quantizedBlobs.end()) {
+				auto &qBlob = *iQuantized->second;
+				entry.nType = INT8_BLOB_INT8;
+				payloads.push_back({qBlob.scales.data(),
+						qBlob.scales.size() * sizeof(float), 0});
+				payloads.push_back({qBlob.data.data(), qBlob.data.size(), 0});
+			} else {
+				entry.nType = INT8_BLOB_FLOAT32;
+				payloads.push_back({nullptr, 0, 0});
+				payloads.push_back({blob.pData,
+						ShapeCount(blob.shape) * sizeof(float), 0});
+			}
+			entries.push_back(entry);
+		}
+	}
+	size_t nNamesOffset = sizeof(Int8WeightsHeader) +
+			entries.size() * sizeof(Int8BlobEntry);
+	size_t nOffset = nNamesOffset + strNames.size();
+	for (size_t i = 0; i < entries.size(); ++i) {
+		entries[i].nNameOffset += nNamesOffset;
+		for (size_t j = i * 2; j < i * 2 + 2; ++j) {
+			if (payloads[j].pData != nullptr) {
+				nOffset = (nOffset + INT8_ALIGNMENT - 1) / INT8_ALIGNMENT *
+						INT8_ALIGNMENT;
+				payloads[j].nOffset = nOffset;
+				nOffset += payloads[j].nBytes;
+			}
+		}
+		entries[i].nScalesOffset = payloads[i * 2].nOffset;
+		entries[i].nDataOffset = payloads[i * 2 + 1].nOffset;
+	}
+
+	Int8WeightsHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INT8_MAGIC, sizeof(header.magic));
+	header.nVersion = 1;
+	header.nNumBlobs = entries.size();
+	header.nFileBytes = nOffset;
+
+	std::ofstream outFile(strFn, std::ios::binary);
+	CHECK(outFile.is_open()) << strFn;
+	outFile.write((const char*)&header, sizeof(header));
+	outFile.write((const char*)entries.data(),
+			entries.size() * sizeof(Int8BlobEntry));
+	outFile.write(strNames.data(), strNames.size());
+	size_t nWritten = nNamesOffset + strNames.size();
+	const char zeros[INT8_ALIGNMENT] = {0};
+	for (auto &payload : payloads) {
+		if (payload.pData == nullptr) {
+			continue;
+		}
+		outFile.write(zeros, payload.nOffset - nWritten);
+		outFile.write((const char*)payload.pData, payload.nBytes);
+		nWritten = payload.nOffset + payload.nBytes;
+	}
+	CHECK(outFile.good()) << strFn;
+	outFile.close();
+}
+
+std::string FormatQuantizationReport(const caffe::NetParameter &net,
+		const std::vector<QuantizedBlob> &quantized) {
+	std::ostringstream oss;
+	oss << std::left << std::setw(24) << "layer" << std::setw(14) << "type" <<
+			std::right << std::setw(10) << "channels" << std::setw(14) <<
+			"max abs err" << std::setw(12) << "SQNR(dB)";
+	for (auto &blob : quantized) {
+		auto &layer = net.layer(blob.nLayerIdx);
+		oss << "\n" << std::left << std::setw(24) << layer.name() <<
+				std::setw(14) << layer.type() << std::right <<
+				std::setw(10) << blob.shape[0] << std::scientific <<
+				std::setprecision(3) << std::setw(14) << blob.fMaxAbsError <<
+				std::fixed << std::setprecision(2) << std::setw(12) <<
+				blob.dSqnr;
+		oss.unsetf(std::ios::floatfield);
+	}
+	return oss.str();
+}
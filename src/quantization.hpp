@@ -0,0 +1,91 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Post-training INT8 quantization of weights.
+*	Weights of Convolution and InnerProduct are quantized symmetrically with
+*	one scale per output channel, w = q * scale with q in [-127, 127]. The
+*	quantized weights are written to a sidecar file together with all other
+*	blobs of the net in float32, so the float caffemodel is not needed.
+*
+*	Layout of the sidecar, little-endian, packed up to the payloads:
+*		Int8WeightsHeader
+*		Int8BlobEntry[nNumBlobs]
+*		names of layers, referenced by the entries
+*		scales (float32) and data of each blob, at the offsets of the entry,
+*			each aligned to INT8_ALIGNMENT (64) bytes
+*/
+
+#ifndef QUANTIZATION_HPP_
+#define QUANTIZATION_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "common.hpp"
+#include "model_writer.hpp"
+
+const size_t INT8_ALIGNMENT = 64;
+const char INT8_MAGIC[8] = {'C', 'A', 'F', 'F', 'E', 'I', '8', 'W'};
+const size_t INT8_MAX_AXES = 4;
+
+enum Int8BlobType : uint32_t {
+	INT8_BLOB_FLOAT32 = 0,
+	INT8_BLOB_INT8 = 1	// per-channel scales along axis 0
+};
+
+// The first 64 bytes of a sidecar
+struct Int8WeightsHeader {
+	char magic[8];
+	uint64_t nVersion;		// 1
+	uint64_t nNumBlobs;
+	uint64_t nFileBytes;
+	uint8_t reserved[32];
+};
+
+struct Int8BlobEntry {
+	uint64_t nNameOffset;	// name of the layer
+	uint32_t nNameBytes;
+	uint32_t nBlobIdx;		// index of the blob in the layer
+	uint32_t nType;			// Int8BlobType
+	uint32_t nNumAxes;
+	uint64_t dims[INT8_MAX_AXES];
+	uint64_t nScalesOffset;	// shape[0] floats, 0 for float32 blobs
+	uint64_t nDataOffset;
+};
+
+struct QuantizedBlob {
+	int nLayerIdx;
+	size_t nBlobIdx;
+	Shape shape;
+	std::vector<float> scales;	// per output channel
+	std::vector<int8_t> data;
+	float fMaxAbsError;		// of the dequantized weights
+	double dSqnr;			// signal to quantization noise ratio in dB
+};
+
+// Max of absolute values, vectorized
+float MaxAbs(const float *pData, size_t nCount);
+
+// Quantizes weights of Convolution and InnerProduct layers, in parallel by
+//	nNumThreads (0 for all hardware threads). Layers of shared blobs are
+//	skipped like in the caffemodel.
+std::vector<QuantizedBlob> QuantizeWeights(const caffe::NetParameter &net,
+		const CaffeWeights &weights, size_t nNumThreads);
+
+// Writes the quantized blobs and all other blobs of weights in float32
+void WriteInt8Weights(const caffe::NetParameter &net,
+		const CaffeWeights &weights,
+		const std::vector<QuantizedBlob> &quantized,
+		const std::string &strFn);
+
+// One line for each quantized layer
+std::string FormatQuantizationReport(const caffe::NetParameter &net,
+		const std::vector<QuantizedBlob> &quantized);
+
+#endif /* QUANTIZATION_HPP_ */
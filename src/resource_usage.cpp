@@ -0,0 +1,95 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Memory, CPU time and I/O of the process
+*/
+
+#include "resource_usage.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <ctime>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Value of a "field: value" line of a file in /proc, 0 if absent
+size_t ReadProcField(const char *pFn, const char *pField) {
+	std::ifstream procFile(pFn);
+	size_t nFieldLen = std::strlen(pField);
+	std::string strLine;
+	while (std::getline(procFile, strLine)) {
+		if (strLine.compare(0, nFieldLen, pField) == 0 &&
+				strLine.size() > nFieldLen && strLine[nFieldLen] == ':') {
+			return std::strtoull(strLine.c_str() + nFieldLen + 1,
+					nullptr, 10);
+		}
+	}
+	return 0;
+}
+
+// Value of a field in kB of /proc/self/status
+size_t ReadStatusBytes(const char *pField) {
+	return ReadProcField("/proc/self/status", pField) * 1024;
+}
+
+size_t CurrentRssBytes() {
+	return ReadStatusBytes("VmRSS");
+}
+
+size_t PeakRssBytes() {
+	size_t nPeak = ReadStatusBytes("VmHWM");
+	if (nPeak == 0) {
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+			nPeak = (size_t)usage.ru_maxrss * 1024;
+		}
+	}
+	return nPeak;
+}
+
+bool ResetPeakRss() {
+	std::ofstream clearFile("/proc/self/clear_refs");
+	clearFile << "5";
+	clearFile.close();
+	return !clearFile.fail();
+}
+
+size_t PhysicalMemoryBytes() {
+	long nNumPages = sysconf(_SC_PHYS_PAGES);
+	long nPageSize = sysconf(_SC_PAGESIZE);
+	if (nNumPages <= 0 || nPageSize <= 0) {
+		return 0;
+	}
+	return (size_t)nNumPages * (size_t)nPageSize;
+}
+
+double ProcessCpuSeconds() {
+	struct timespec ts;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+		return 0.;
+	}
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double ChildCpuSeconds(const struct rusage &usage) {
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+			(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+void ReadIoBytes(size_t &nReadBytes, size_t &nWrittenBytes) {
+	nReadBytes = ReadProcField("/proc/self/io", "rchar");
+	nWrittenBytes = ReadProcField("/proc/self/io", "wchar");
+}
+
+size_t FileBytes(const std::string &strFn) {
+	struct stat fileStat;
+	if (stat(strFn.c_str(), &fileStat) != 0) {
+		return 0;
+	}
+	return (size_t)fileStat.st_size;
+}
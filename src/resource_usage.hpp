@@ -0,0 +1,44 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Memory, CPU time and I/O of the process, read from /proc on Linux
+*/
+
+#ifndef RESOURCE_USAGE_HPP_
+#define RESOURCE_USAGE_HPP_
+
+#include <cstddef>
+#include <string>
+
+struct rusage;
+
+// Resident set size, including the pages of mapped files, 0 if unknown
+size_t CurrentRssBytes();
+
+// Peak of the resident set size since the start or the last ResetPeakRss
+size_t PeakRssBytes();
+
+// Resets the peak to the current resident set size (Linux 4.0+), so that
+//	the peak of a stage can be measured. Returns false if not supported, the
+//	peak is then the one of the whole process.
+bool ResetPeakRss();
+
+// Physical memory of the machine, 0 if unknown
+size_t PhysicalMemoryBytes();
+
+// CPU time of all threads of the process
+double ProcessCpuSeconds();
+
+// CPU time of a terminated child, from its usage given by wait4
+double ChildCpuSeconds(const struct rusage &usage);
+
+// Bytes read and written by system calls (rchar and wchar of /proc/self/io),
+//	pages of mapped files are not counted. Both are 0 if unknown.
+void ReadIoBytes(size_t &nReadBytes, size_t &nWrittenBytes);
+
+// Size of the file, 0 if it does not exist
+size_t FileBytes(const std::string &strFn);
+
+#endif /* RESOURCE_USAGE_HPP_ */
@@ -0,0 +1,167 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Measured forward time of layers against their predicted cost
+*/
+
+#include "roofline.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <glog/logging.h>
+
+#include "json_helper.hpp"
+
+// Layers faster than this are within the noise of the timer, they do not
+//	set the peaks
+const double MIN_PEAK_LAYER_MS = 0.01;
+
+// Flagged layers take at least this share of the forward time
+const double MIN_FLAGGED_SHARE = 0.01;
+
+double PearsonCorrelation(const std::vector<double> &x,
+		const std::vector<double> &y) {
+	size_t n = x.size();
+	if (n < 2) {
+		return 0.;
+	}
+	double dMeanX = 0., dMeanY = 0.;
+	for (size_t i = 0; i < n; ++i) {
+		dMeanX += x[i] / n;
+		dMeanY += y[i] / n;
+	}
+	double dCov = 0., dVarX = 0., dVarY = 0.;
+	for (size_t i = 0; i < n; ++i) {
+		dCov += (x[i] - dMeanX) * (y[i] - dMeanY);
+		dVarX += (x[i] - dMeanX) * (x[i] - dMeanX);
+		dVarY += (y[i] - dMeanY) * (y[i] - dMeanY);
+	}
+	return (dVarX > 0. && dVarY > 0.) ? dCov / std::sqrt(dVarX * dVarY) : 0.;
+}
+
+RooflineReport CompareWithCosts(const std::vector<LayerCost> &costs,
+		size_t nCostBatchSize, const BenchmarkResult &result,
+		const RooflinePeaks &peaks, double dThreshold) {
+	CHECK_GT(nCostBatchSize, 0U);
+	std::map<std::string, const LayerCost*> layerCosts;
+	for (auto &cost : costs) {
+		layerCosts[cost.strLayer] = &cost;
+	}
+	// Activations scale with the batch, parameters do not
+	double dBatchScale = (double)result.nBatchSize / nCostBatchSize;
+
+	RooflineReport report = {result.nBatchSize, peaks, 0., {}};
+	std::vector<double> gflops, bytes;
+	double dTotalMs = 0.;
+	for (auto &layerTime : result.layers) {
+		auto iCost = layerCosts.find(layerTime.strLayer);
+		if (iCost == layerCosts.end()) {
+			continue;
+		}
+		auto &cost = *iCost->second;
+		double dFlops = 2. * cost.nMacs * dBatchScale;
+		double dBytes = cost.nParamBytes + cost.nActivationBytes * dBatchScale;
+		if (dFlops == 0. && dBytes == 0.) {
+			continue;
+		}
+		LayerEfficiency layer = {layerTime.strLayer, layerTime.strType,
+				layerTime.dMeanMs, 0., 0., 0., 0., false};
+		if (layer.dMeasuredMs > 0.) {
+			layer.dGflops = dFlops / layer.dMeasuredMs * 1e-6;
+			layer.dGbps = dBytes / layer.dMeasuredMs * 1e-6;
+		}
+		if (layer.dMeasuredMs >= MIN_PEAK_LAYER_MS) {
+			if (peaks.dGflops <= 0.) {
+				report.peaks.dGflops = std::max(report.peaks.dGflops,
+						layer.dGflops);
+			}
+			if (peaks.dGbps <= 0.) {
+				report.peaks.dGbps = std::max(report.peaks.dGbps, layer.dGbps);
+			}
+		}
+		dTotalMs += layer.dMeasuredMs;
+		gflops.push_back(dFlops);
+		bytes.push_back(dBytes);
+		report.layers.emplace_back(std::move(layer));
+	}
+
+	std::vector<double> measured, predicted;
+	for (size_t i = 0; i < report.layers.size(); ++i) {
+		auto &layer = report.layers[i];
+		double dComputeMs = report.peaks.dGflops > 0. ?
+				gflops[i] / report.peaks.dGflops * 1e-6 : 0.;
+		double dMemoryMs = report.peaks.dGbps > 0. ?
+				bytes[i] / report.peaks.dGbps * 1e-6 : 0.;
+		layer.dPredictedMs = std::max(dComputeMs, dMemoryMs);
+		layer.dEfficiency = layer.dMeasuredMs > 0. ?
+				layer.dPredictedMs / layer.dMeasuredMs : 1.;
+		layer.bFlagged = layer.dEfficiency < dThreshold &&
+				layer.dMeasuredMs >= MIN_FLAGGED_SHARE * dTotalMs;
+		measured.push_back(layer.dMeasuredMs);
+		predicted.push_back(layer.dPredictedMs);
+	}
+	report.dCorrelation = PearsonCorrelation(measured, predicted);
+	return report;
+}
+
+std::string FormatRooflineReport(const RooflineReport &report) {
+	auto layers = report.layers;
+	std::stable_sort(layers.begin(), layers.end(),
+			[](const LayerEfficiency &l1, const LayerEfficiency &l2) {
+				return l1.dMeasuredMs - l1.dPredictedMs >
+						l2.dMeasuredMs - l2.dPredictedMs;
+			});
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(2) << "batch " <<
+			report.nBatchSize << ", peaks " << report.peaks.dGflops <<
+			" GFLOP/s and " << report.peaks.dGbps << " GB/s, correlation " <<
+			"of measured and predicted times " << report.dCorrelation << "\n";
+	oss << std::left << std::setw(32) << "layer" << std::setw(20) << "type" <<
+			std::right << std::setw(12) << "measured ms" << std::setw(13) <<
+			"predicted ms" << std::setw(10) << "GFLOP/s" << std::setw(10) <<
+			"GB/s" << std::setw(12) << "efficiency";
+	for (auto &layer : layers) {
+		oss << "\n" << std::left << std::setw(32) << layer.strLayer <<
+				std::setw(20) << layer.strType << std::right <<
+				std::setprecision(3) << std::setw(12) << layer.dMeasuredMs <<
+				std::setw(13) << layer.dPredictedMs << std::setprecision(2) <<
+				std::setw(10) << layer.dGflops << std::setw(10) <<
+				layer.dGbps << std::setw(12) << layer.dEfficiency;
+		if (layer.bFlagged) {
+			oss << "  <- below attainable";
+		}
+	}
+	return oss.str();
+}
+
+void WriteRooflineReports(const std::vector<RooflineReport> &reports,
+		const std::string &strFn) {
+	Json jReports = Json::array();
+	for (auto &report : reports) {
+		Json jLayers = Json::array();
+		for (auto &layer : report.layers) {
+			jLayers.push_back({{"name", layer.strLayer},
+					{"type", layer.strType},
+					{"measured_ms", layer.dMeasuredMs},
+					{"predicted_ms", layer.dPredictedMs},
+					{"gflops", layer.dGflops}, {"gbps", layer.dGbps},
+					{"efficiency", layer.dEfficiency},
+					{"flagged", layer.bFlagged}});
+		}
+		jReports.push_back({{"batch_size", report.nBatchSize},
+				{"peak_gflops", report.peaks.dGflops},
+				{"peak_gbps", report.peaks.dGbps},
+				{"correlation", report.dCorrelation},
+				{"layers", std::move(jLayers)}});
+	}
+	std::ofstream reportFile(strFn);
+	CHECK(reportFile.is_open()) << strFn;
+	reportFile << Json({{"reports", std::move(jReports)}}).dump(1) <<
+			std::endl;
+}
@@ -0,0 +1,61 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Measured forward time of layers against their predicted cost.
+*	The time a layer could take is predicted by the roofline model from its
+*	FLOPs and bytes (cost_model.hpp), with the peak compute and bandwidth
+*	either given or taken as the best achieved by any layer of the net.
+*	Layers far below that, which are usually odd shapes, grouped
+*	convolutions of stock caffe or bad layouts, are flagged.
+*/
+
+#ifndef ROOFLINE_HPP_
+#define ROOFLINE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "cost_model.hpp"
+
+struct RooflinePeaks {
+	double dGflops;	// 0 for the best of the layers
+	double dGbps;	// 0 for the best of the layers
+};
+
+struct LayerEfficiency {
+	std::string strLayer;
+	std::string strType;
+	double dMeasuredMs;
+	double dPredictedMs;	// by the roofline of the peaks
+	double dGflops;			// achieved
+	double dGbps;			// achieved
+	double dEfficiency;		// predicted over measured time
+	bool bFlagged;
+};
+
+struct RooflineReport {
+	size_t nBatchSize;
+	RooflinePeaks peaks;	// the ones used
+	double dCorrelation;	// Pearson's r of measured and predicted times
+	std::vector<LayerEfficiency> layers;
+};
+
+// Compares the layer times of a benchmark result with the costs, estimated
+//	at nCostBatchSize and scaled to the batch size of the result. Layers of
+//	an efficiency below dThreshold taking at least 1% of the time are
+//	flagged.
+RooflineReport CompareWithCosts(const std::vector<LayerCost> &costs,
+		size_t nCostBatchSize, const BenchmarkResult &result,
+		const RooflinePeaks &peaks, double dThreshold);
+
+// The peaks, the correlation, and the layers sorted by their time lost to
+//	the prediction
+std::string FormatRooflineReport(const RooflineReport &report);
+
+void WriteRooflineReports(const std::vector<RooflineReport> &reports,
+		const std::string &strFn);
+
+#endif /* ROOFLINE_HPP_ */
@@ -0,0 +1,362 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Static shape inference of the MxNet nodes.
+*/
+
+#include "shape_inference.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <glog/logging.h>
+
+#include "str_helper.hpp"
+
+size_t ShapeCount(const Shape &shape) {
+	return std::accumulate(shape.begin(), shape.end(), size_t(1),
+			std::multiplies<size_t>());
+}
+
+std::string ShapeString(const Shape &shape) {
+	std::ostringstream oss;
+	oss << "(";
+	for (size_t i = 0; i < shape.size(); ++i) {
+		oss << (i > 0 ? "," : "") << shape[i];
+	}
+	oss << ")";
+	return oss.str();
+}
+
+Shape BroadcastShapes(const Shape &shape1, const Shape &shape2) {
+	Shape result(std::max(shape1.size(), shape2.size()), 1);
+	for (size_t i = 0; i < result.size(); ++i) {
+		size_t d1 = i < shape1.size() ? shape1[shape1.size() - 1 - i] : 1;
+		size_t d2 = i < shape2.size() ? shape2[shape2.size() - 1 - i] : 1;
+		CHECK(d1 == d2 || d1 == 1 || d2 == 1) << "Can not broadcast " <<
+				ShapeString(shape1) << " with " << ShapeString(shape2);
+		result[result.size() - 1 - i] = std::max(d1, d2);
+	}
+	return result;
+}
+
+size_t CanonicalAxis(int nAxis, size_t nNumAxes) {
+	if (nAxis < 0) {
+		nAxis += (int)nNumAxes;
+	}
+	CHECK_GE(nAxis, 0);
+	CHECK_LT(nAxis, (int)nNumAxes);
+	return (size_t)nAxis;
+}
+
+// Same as InferReshapeShape of MxNet, special values 0, -1, -2, -3, -4
+Shape InferReshape(const Shape &inShape, std::vector<int> shapeParam,
+		bool bReverse) {
+	Shape dims = inShape;
+	if (bReverse) {
+		std::reverse(dims.begin(), dims.end());
+		std::reverse(shapeParam.begin(), shapeParam.end());
+	}
+	Shape outShape;
+	size_t nSrcIdx = 0;
+	int nInferIdx = -1;
+	for (size_t i = 0; i < shapeParam.size(); ++i) {
+		int nProposed = shapeParam[i];
+		if (nProposed == 0) {
+			CHECK_LT(nSrcIdx, dims.size());
+			outShape.push_back(dims[nSrcIdx++]);
+		} else if (nProposed == -1) {
+			CHECK_LT(nInferIdx, 0) << "One and only one dim can be inferred";
+			nInferIdx = (int)outShape.size();
+			outShape.push_back(1);
+			++nSrcIdx;
+		} else if (nProposed == -2) {
+			while (nSrcIdx < dims.size()) {
+				outShape.push_back(dims[nSrcIdx++]);
+			}
+		} else if (nProposed == -3) {
+			CHECK_LT(nSrcIdx + 1, dims.size());
+			outShape.push_back(dims[nSrcIdx] * dims[nSrcIdx + 1]);
+			nSrcIdx += 2;
+		} else if (nProposed == -4) {
+			CHECK_LT(nSrcIdx, dims.size());
+			CHECK_LT(i + 2, shapeParam.size());
+			int64_t d0 = dims[nSrcIdx++];
+			int64_t d1 = shapeParam[++i];
+			int64_t d2 = shapeParam[++i];
+			CHECK(d1 != -1 || d2 != -1) << "Split dims can not be both -1";
+			if (d1 == -1) {
+				d1 = d0 / d2;
+			} else if (d2 == -1) {
+				d2 = d0 / d1;
+			}
+			CHECK_EQ(d1 * d2, d0) << "Split dims do not match the input";
+			outShape.push_back((size_t)d1);
+			outShape.push_back((size_t)d2);
+		} else {
+			CHECK_GT(nProposed, 0) << "Invalid reshape value " << nProposed;
+			outShape.push_back((size_t)nProposed);
+			++nSrcIdx;
+		}
+	}
+	if (nInferIdx >= 0) {
+		size_t nKnown = ShapeCount(outShape);
+		CHECK_GT(nKnown, 0);
+		CHECK_EQ(ShapeCount(inShape) % nKnown, 0);
+		outShape[nInferIdx] = ShapeCount(inShape) / nKnown;
+	}
+	if (bReverse) {
+		std::reverse(outShape.begin(), outShape.end());
+	}
+	CHECK_EQ(ShapeCount(outShape), ShapeCount(inShape)) << "Can not reshape "
+			<< ShapeString(inShape) << " to " << ShapeString(outShape);
+	return outShape;
+}
+
+size_t WindowOutSize(size_t nIn, int nKernel, int nPad, int nStride,
+		int nDilate, bool bCeil) {
+	int64_t nExtent = (int64_t)nDilate * (nKernel - 1) + 1;
+	int64_t nSpan = (int64_t)nIn + 2 * nPad - nExtent;
+	CHECK_GE(nSpan, 0) << "Window " << nExtent << " exceeds input " << nIn;
+	if (bCeil) {
+		return (size_t)((nSpan + nStride - 1) / nStride + 1);
+	}
+	return (size_t)(nSpan / nStride + 1);
+}
+
+std::vector<Shape> InferNodeShapes(const MxnetNode &node,
+		const std::vector<Shape> &inShapes,
+		const std::vector<InputInfo> &inputInfos) {
+	auto &attrs = node.attrs;
+	auto &strOp = node.strOp;
+	if (strOp == "null") {
+		auto iInputInfo = std::find_if(inputInfos.begin(), inputInfos.end(),
+				[&](const InputInfo &ii) { return ii.first == node.strName; });
+		if (iInputInfo != inputInfos.end()) {
+			return {iInputInfo->second};
+		}
+		return {Shape()};
+	}
+
+	size_t nNumOutputs = 1;
+	if (strOp == "SliceChannel") {
+		nNumOutputs = Str2Num<size_t>(attrs.GetValue("num_outputs", true), 1);
+	}
+	CHECK(!inShapes.empty()) << "No input of node " << node.strName;
+	const Shape &inShape = inShapes[0];
+	if (inShape.empty()) {
+		return std::vector<Shape>(nNumOutputs);
+	}
+
+	static std::set<std::string> unaryOps = {
+			"Activation", "LeakyReLU", "abs", "SoftmaxActivation", "softmax",
+			"Dropout", "BatchNorm", "L2Normalization", "_mul_scalar",
+			"SoftmaxOutput"
+		};
+	static std::set<std::string> elemwiseOps = {
+			"elemwise_add", "_Plus", "add_n", "ElementWiseSum",
+			"elemwise_sub", "_Minus", "elemwise_mul"
+		};
+	static std::set<std::string> broadcastOps = {
+			"broadcast_mul", "broadcast_add", "broadcast_plus",
+			"broadcast_sub", "broadcast_minus"
+		};
+	if (unaryOps.count(strOp)) {
+		return {inShape};
+	} else if (elemwiseOps.count(strOp)) {
+		for (auto &shape : inShapes) {
+			CHECK(shape.empty() || shape == inShape) << "Shapes of inputs of "
+					<< node.strName << " mismatch: " << ShapeString(shape) <<
+					" vs " << ShapeString(inShape);
+		}
+		return {inShape};
+	} else if (broadcastOps.count(strOp)) {
+		CHECK_EQ(inShapes.size(), 2U);
+		if (inShapes[1].empty()) {
+			return {Shape()};
+		}
+		return {BroadcastShapes(inShapes[0], inShapes[1])};
+	} else if (strOp == "Flatten") {
+		CHECK_GE(inShape.size(), 1U);
+		Shape tail(inShape.begin() + 1, inShape.end());
+		return {{inShape[0], ShapeCount(tail)}};
+	} else if (strOp == "FullyConnected") {
+		size_t nNumHidden = Str2Num<size_t>(
+				attrs.GetValue("num_hidden", true), 1);
+		std::string strFlatten = attrs.GetValue("flatten", false);
+		if (!strFlatten.empty() && !Str2Bool(strFlatten)) {
+			Shape outShape = inShape;
+			outShape.back() = nNumHidden;
+			return {outShape};
+		}
+		return {{inShape[0], nNumHidden}};
+	} else if (strOp == "Convolution" || strOp == "Pooling") {
+		CHECK_EQ(inShape.size(), 4U) << "Only 2D " << strOp << " is supported";
+		Shape outShape = inShape;
+		std::string strGlobal = attrs.GetValue("global_pool", false);
+		if (strOp == "Pooling" && !strGlobal.empty() && Str2Bool(strGlobal)) {
+			outShape[2] = outShape[3] = 1;
+			return {outShape};
+		}
+		auto GetPair = [&](const std::string &strKey, int nDefault) {
+				std::string strVal = attrs.GetValue(strKey, false);
+				if (strVal.empty()) {
+					return std::make_pair(nDefault, nDefault);
+				}
+				return Str2Pair<int>(strVal);
+			};
+		auto kernel = Str2Pair<int>(attrs.GetValue("kernel", true), 1);
+		auto stride = GetPair("stride", 1);
+		auto pad = GetPair("pad", 0);
+		auto dilate = std::make_pair(1, 1);
+		bool bCeil = false;
+		if (strOp == "Convolution") {
+			dilate = GetPair("dilate", 1);
+			outShape[1] = Str2Num<size_t>(attrs.GetValue("num_filter", true), 1);
+		} else {
+			bCeil = (attrs.GetValue("pooling_convention", false) == "full");
+		}
+		outShape[2] = WindowOutSize(inShape[2], kernel.first, pad.first,
+				stride.first, dilate.first, bCeil);
+		outShape[3] = WindowOutSize(inShape[3], kernel.second, pad.second,
+				stride.second, dilate.second, bCeil);
+		return {outShape};
+	} else if (strOp == "concat" || strOp == "Concat") {
+		std::string strDim = attrs.GetValue("dim", false);
+		size_t nAxis = CanonicalAxis(strDim.empty() ? 1 :
+				Str2Num<int>(strDim), inShape.size());
+		Shape outShape = inShape;
+		outShape[nAxis] = 0;
+		for (auto &shape : inShapes) {
+			if (shape.empty()) {
+				return {Shape()};
+			}
+			CHECK_EQ(shape.size(), inShape.size());
+			outShape[nAxis] += shape[nAxis];
+		}
+		return {outShape};
+	} else if (strOp == "SliceChannel") {
+		std::string strAxis = attrs.GetValue("axis", false);
+		size_t nAxis = CanonicalAxis(strAxis.empty() ? 1 :
+				Str2Num<int>(strAxis), inShape.size());
+		CHECK_EQ(inShape[nAxis] % nNumOutputs, 0) << "Can not slice " <<
+				ShapeString(inShape) << " into " << nNumOutputs << " parts";
+		Shape outShape = inShape;
+		outShape[nAxis] /= nNumOutputs;
+		std::string strSqueeze = attrs.GetValue("squeeze_axis", false);
+		if (!strSqueeze.empty() && Str2Bool(strSqueeze)) {
+			CHECK_EQ(outShape[nAxis], 1U);
+			outShape.erase(outShape.begin() + nAxis);
+		}
+		return std::vector<Shape>(nNumOutputs, outShape);
+	} else if (strOp == "reshape" || strOp == "Reshape") {
+		auto shapeParam = Str2Tuple<int>(attrs.GetValue("shape", true));
+		std::string strReverse = attrs.GetValue("reverse", false);
+		bool bReverse = !strReverse.empty() && Str2Bool(strReverse);
+		return {InferReshape(inShape, shapeParam, bReverse)};
+	}
+	LOG(FATAL) << "Unsupported op: " << strOp;
+	return {};
+}
+
+// Shapes of the parameter inputs (weights, labels) required by a node,
+// indexed by the input index. Empty shapes for non-parameter inputs.
+std::vector<Shape> InferArgShapes(const MxnetNode &node,
+		const Shape &inShape) {
+	std::vector<Shape> argShapes(node.inputs.size());
+	auto &attrs = node.attrs;
+	auto &strOp = node.strOp;
+	if (inShape.empty() || argShapes.size() < 2) {
+		return argShapes;
+	}
+	if (strOp == "Convolution") {
+		size_t nNumFilter = Str2Num<size_t>(
+				attrs.GetValue("num_filter", true), 1);
+		std::string strGroup = attrs.GetValue("num_group", false);
+		size_t nNumGroup = strGroup.empty() ? 1 : Str2Num<size_t>(strGroup, 1);
+		CHECK_EQ(inShape[1] % nNumGroup, 0);
+		auto kernel = Str2Pair<size_t>(attrs.GetValue("kernel", true), 1);
+		argShapes[1] = {nNumFilter, inShape[1] / nNumGroup,
+				kernel.first, kernel.second};
+		if (argShapes.size() > 2) {
+			argShapes[2] = {nNumFilter};
+		}
+	} else if (strOp == "FullyConnected") {
+		size_t nNumHidden = Str2Num<size_t>(
+				attrs.GetValue("num_hidden", true), 1);
+		std::string strFlatten = attrs.GetValue("flatten", false);
+		size_t nNumInput = inShape.back();
+		if (strFlatten.empty() || Str2Bool(strFlatten)) {
+			nNumInput = ShapeCount(inShape) / inShape[0];
+		}
+		argShapes[1] = {nNumHidden, nNumInput};
+		if (argShapes.size() > 2) {
+			argShapes[2] = {nNumHidden};
+		}
+	} else if (strOp == "BatchNorm") {
+		CHECK_GE(inShape.size(), 2U);
+		for (size_t i = 1; i < argShapes.size(); ++i) {
+			argShapes[i] = {inShape[1]}; // gamma, beta, moving_mean, moving_var
+		}
+	} else if (strOp == "LeakyReLU") {
+		if (attrs.GetValue("act_type", false) == "prelu") {
+			CHECK_GE(inShape.size(), 2U);
+			argShapes[1] = {inShape[1]};
+		}
+	} else if (strOp == "SoftmaxOutput") {
+		std::string strMultiOut = attrs.GetValue("multi_output", false);
+		std::string strPreserve = attrs.GetValue("preserve_shape", false);
+		if (!strPreserve.empty() && Str2Bool(strPreserve)) {
+			argShapes[1] = Shape(inShape.begin(), inShape.end() - 1);
+		} else if (!strMultiOut.empty() && Str2Bool(strMultiOut)) {
+			argShapes[1] = {inShape[0], ShapeCount(inShape) /
+					(inShape[0] * inShape[1])};
+		} else {
+			argShapes[1] = {inShape[0]};
+		}
+	}
+	return argShapes;
+}
+
+NodeShapes InferMxnetShapes(const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<InputInfo> &inputInfos) {
+	NodeShapes nodeShapes(mxnetNodes.size());
+	for (size_t i = 0; i < mxnetNodes.size(); ++i) {
+		auto &node = mxnetNodes[i];
+		std::vector<Shape> inShapes;
+		for (auto &input : node.inputs) {
+			CHECK_LT(input.first, i) << "Inputs of node " << node.strName <<
+					" are not defined before it";
+			auto &outShapes = nodeShapes[input.first];
+			CHECK_LT(input.second, outShapes.size());
+			inShapes.push_back(outShapes[input.second]);
+		}
+		nodeShapes[i] = InferNodeShapes(node, inShapes, inputInfos);
+
+		// Parameters get their shapes from the first node using them
+		auto argShapes = InferArgShapes(node,
+				inShapes.empty() ? Shape() : inShapes[0]);
+		for (size_t j = 1; j < argShapes.size(); ++j) {
+			auto &input = node.inputs[j];
+			auto &argShape = nodeShapes[input.first][input.second];
+			if (argShapes[j].empty()) {
+				continue;
+			} else if (argShape.empty()) {
+				CHECK(mxnetNodes[input.first].strOp == "null") << "Shape of "
+						<< mxnetNodes[input.first].strName << " is unknown";
+				argShape = argShapes[j];
+			} else {
+				CHECK(argShape == argShapes[j]) << "Shape of " <<
+						mxnetNodes[input.first].strName << " used by " <<
+						node.strName << " mismatch: " << ShapeString(argShape)
+						<< " vs " << ShapeString(argShapes[j]);
+			}
+		}
+	}
+	return nodeShapes;
+}
@@ -0,0 +1,39 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Static shape inference of the MxNet nodes.
+*	Output shapes of every node are inferred from the shapes of the inputs
+*	given in config, without any allocation of blobs. Shapes of parameters
+*	(weights, biases, statistics of BatchNorm) are inferred from the nodes
+*	using them.
+*/
+
+#ifndef SHAPE_INFERENCE_HPP_
+#define SHAPE_INFERENCE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "mxnet_parser.hpp"
+
+// Output shapes of each node, indexed by the node index and the output index.
+//	An empty shape means unknown (e.g. parameters of the model).
+using NodeShapes = std::vector<std::vector<Shape>>;
+
+NodeShapes InferMxnetShapes(const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<InputInfo> &inputInfos);
+
+// Numpy-style broadcasting of two shapes, aligned to the last axis
+Shape BroadcastShapes(const Shape &shape1, const Shape &shape2);
+
+// Non-negative index of an axis, counted from the last one if negative
+size_t CanonicalAxis(int nAxis, size_t nNumAxes);
+
+size_t ShapeCount(const Shape &shape);
+
+std::string ShapeString(const Shape &shape);
+
+#endif /* SHAPE_INFERENCE_HPP_ */
@@ -0,0 +1,86 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* String helper: parsing attribute values of MxNet nodes.
+*
+* Written by Devymex <yumengwang@deepglint.com>, Jan. 2019
+*/
+
+#ifndef STR_HELPER_HPP_
+#define STR_HELPER_HPP_
+
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glog/logging.h>
+
+#include "istream_helper.hpp"
+
+template<typename _Ty>
+_Ty Str2Num(std::string str, _Ty _min = std::numeric_limits<_Ty>::min(),
+		_Ty _max = std::numeric_limits<_Ty>::max()) {
+	CHECK(!str.empty());
+	std::istringstream iss(str);
+	_Ty val;
+	CHECK(iss >> val);
+	CHECK_GE(val, _min);
+	CHECK_LE(val, _max);
+	return val;
+}
+
+template<typename _Ty>
+std::pair<_Ty, _Ty> Str2Pair(std::string str,
+		_Ty _min = std::numeric_limits<_Ty>::min(),
+		_Ty _max = std::numeric_limits<_Ty>::max()) {
+	CHECK(!str.empty());
+	std::istringstream iss(str);
+	std::pair<_Ty, _Ty> ret;
+	CHECK(iss >> Expect('(') >> ret.first >> Expect(',') >>
+			ret.second >> Expect(')'));
+	CHECK_GE(ret.first, _min);
+	CHECK_LE(ret.first, _max);
+	CHECK_GE(ret.second, _min);
+	CHECK_LE(ret.second, _max);
+	return ret;
+}
+
+template<typename _Ty>
+std::vector<_Ty> Str2Tuple(std::string str) {
+	CHECK(!str.empty());
+	std::string::size_type beg = str.find('(');
+	std::string::size_type end = str.rfind(')');
+	CHECK_NE(beg, std::string::npos);
+	CHECK_NE(end, std::string::npos);
+	CHECK_GT(end - beg, 1);
+	str.erase(end, -1);
+	str.erase(0, beg + 1);
+	std::istringstream iss(str);
+	std::vector<_Ty> ret;
+	for (std::string strVal; std::getline(iss, strVal, ','); ) {
+		std::istringstream isv(strVal);
+		_Ty val;
+		isv >> val;
+		ret.push_back(val);
+	}
+	return ret;
+}
+
+template<typename _Ty>
+_Ty Pair2Num(const std::pair<_Ty, _Ty> &pair) {
+	CHECK_EQ(pair.first, pair.second);
+	return pair.first;
+}
+
+inline bool Str2Bool(std::string str) {
+	if (str == "True" || str == "true" || str == "1") {
+		return true;
+	}
+	CHECK(str == "False" || str == "false" || str == "0");
+	return false;
+}
+
+#endif /* STR_HELPER_HPP_ */
@@ -0,0 +1,199 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Numerical verification of a conversion
+*/
+
+#include "verification.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <glog/logging.h>
+
+#include "shape_inference.hpp"
+
+std::map<std::string, Tensor> RandomInputs(
+		const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<InputInfo> &inputInfos, unsigned nSeed) {
+	std::set<std::string> labels;
+	for (auto &node : mxnetNodes) {
+		if (node.strOp == "SoftmaxOutput" && node.inputs.size() > 1) {
+			labels.insert(mxnetNodes[node.inputs[1].first].strName);
+		}
+	}
+	std::mt19937 rng(nSeed);
+	std::uniform_real_distribution<float> dist(-1.f, 1.f);
+	std::map<std::string, Tensor> inputs;
+	for (auto &inputInfo : inputInfos) {
+		Tensor tensor = {inputInfo.second,
+				std::vector<float>(ShapeCount(inputInfo.second), 0.f)};
+		if (labels.count(inputInfo.first) == 0) {
+			for (auto &fVal : tensor.data) {
+				fVal = dist(rng);
+			}
+		}
+		inputs[inputInfo.first] = std::move(tensor);
+	}
+	return inputs;
+}
+
+void RenameNodeBlobs(std::vector<NodeBlobs> &nodeBlobs,
+		const BlobRenames &renames) {
+	for (auto &blobs : nodeBlobs) {
+		for (auto &strTop : blobs.tops) {
+			auto iRename = renames.find(strTop);
+			if (iRename != renames.end()) {
+				strTop = iRename->second;
+			}
+		}
+	}
+}
+
+// Max abs error of the data to the reference, NaN counts as infinite
+void CompareData(const float *pRef, const float *pData, size_t nCount,
+		float &fMaxAbsError, float &fMaxAbsRef) {
+	fMaxAbsError = 0.f;
+	fMaxAbsRef = 0.f;
+	for (size_t i = 0; i < nCount; ++i) {
+		float fError = std::fabs(pRef[i] - pData[i]);
+		if (std::isnan(fError)) {
+			fError = std::numeric_limits<float>::infinity();
+		}
+		fMaxAbsError = std::max(fMaxAbsError, fError);
+		fMaxAbsRef = std::max(fMaxAbsRef, std::fabs(pRef[i]));
+	}
+}
+
+// Compares an output of a node with the caffe blob holding it
+BlobError CompareBlob(const caffe::Net<float> &caffeNet,
+		const std::vector<MxnetNode> &mxnetNodes,
+		const NodeTensors &nodeTensors, const NodeBlobs &blobs,
+		const MxnetInput &output) {
+	auto &tensors = nodeTensors[output.first];
+	auto &tensor = tensors[output.second];
+	BlobError error = {mxnetNodes[output.first].strName, blobs.strLayer,
+			std::string(), tensor.data.size(), 0,
+			std::numeric_limits<float>::infinity(),
+			std::numeric_limits<float>::infinity()};
+	if (tensors.size() > 1) {
+		error.strNode += std::to_string(output.second);
+	}
+	if (output.second >= blobs.tops.size() ||
+			!caffeNet.has_blob(blobs.tops[output.second])) {
+		return error;
+	}
+	error.strBlob = blobs.tops[output.second];
+	auto pBlob = caffeNet.blob_by_name(error.strBlob);
+	error.nBlobCount = pBlob->count();
+	if (error.nBlobCount == error.nCount) {
+		float fMaxAbsRef;
+		CompareData(tensor.data.data(), pBlob->cpu_data(), error.nCount,
+				error.fMaxAbsError, fMaxAbsRef);
+		error.fRelError = error.fMaxAbsError / std::max(fMaxAbsRef, FLT_MIN);
+	}
+	return error;
+}
+
+VerificationResult VerifyConversion(
+		const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<MxnetInput> &heads,
+		const std::vector<MxnetParam> &mxnetParams,
+		const std::vector<NodeBlobs> &nodeBlobs,
+		const caffe::NetParameter &net, const CaffeWeights &weights,
+		const std::map<std::string, Tensor> &inputs, size_t nNumThreads) {
+	CHECK_EQ(nodeBlobs.size(), mxnetNodes.size());
+	auto nodeTensors = RunMxnetGraph(mxnetNodes, mxnetParams, inputs,
+			nNumThreads);
+
+	auto testNet = InferenceNet(net);
+	caffe::Net<float> caffeNet(testNet);
+	BindNetWeights(caffeNet, testNet, weights);
+	auto &inputIndices = caffeNet.input_blob_indices();
+	for (size_t i = 0; i < inputIndices.size(); ++i) {
+		auto &strName = caffeNet.blob_names()[inputIndices[i]];
+		auto iInput = inputs.find(strName);
+		CHECK(iInput != inputs.end()) << "No data for input " << strName;
+		auto *pBlob = caffeNet.input_blobs()[i];
+		CHECK_EQ((size_t)pBlob->count(), iInput->second.data.size()) <<
+				"Size of input " << strName << " mismatch";
+		std::memcpy(pBlob->mutable_cpu_data(), iInput->second.data.data(),
+				iInput->second.data.size() * sizeof(float));
+	}
+
+	// Nodes completed by each layer, variables are not compared
+	std::map<std::string, std::vector<size_t>> layerNodes;
+	for (size_t i = 0; i < mxnetNodes.size(); ++i) {
+		if (mxnetNodes[i].strOp != "null" && !nodeBlobs[i].strLayer.empty()) {
+			layerNodes[nodeBlobs[i].strLayer].push_back(i);
+		}
+	}
+	VerificationResult result;
+	auto &layerNames = caffeNet.layer_names();
+	for (size_t l = 0; l < layerNames.size(); ++l) {
+		caffeNet.ForwardFromTo((int)l, (int)l);
+		auto iNodes = layerNodes.find(layerNames[l]);
+		if (iNodes == layerNodes.end()) {
+			continue;
+		}
+		for (auto iNode : iNodes->second) {
+			for (size_t j = 0; j < nodeTensors[iNode].size(); ++j) {
+				result.layers.push_back(CompareBlob(caffeNet, mxnetNodes,
+						nodeTensors, nodeBlobs[iNode], MxnetInput(iNode, j)));
+			}
+		}
+	}
+	auto outputs = heads.empty() ? MxnetGraphOutputs(mxnetNodes) : heads;
+	for (auto &output : outputs) {
+		if (mxnetNodes[output.first].strOp == "null") {
+			continue;
+		}
+		result.outputs.push_back(CompareBlob(caffeNet, mxnetNodes,
+				nodeTensors, nodeBlobs[output.first], output));
+	}
+	return result;
+}
+
+size_t FirstExceeding(const std::vector<BlobError> &errors,
+		double dTolerance) {
+	return std::find_if(errors.begin(), errors.end(),
+			[&](const BlobError &error) {
+				return !(error.fRelError <= dTolerance);
+			}) - errors.begin();
+}
+
+std::string FormatErrorTable(const std::vector<BlobError> &errors,
+		double dTolerance) {
+	size_t nFirst = FirstExceeding(errors, dTolerance);
+	std::ostringstream oss;
+	oss << std::left << std::setw(24) << "node" << std::setw(24) << "layer" <<
+			std::setw(24) << "blob" << std::right << std::setw(12) <<
+			"count" << std::setw(14) << "max abs err" << std::setw(12) <<
+			"rel err";
+	for (size_t i = 0; i < errors.size(); ++i) {
+		auto &error = errors[i];
+		oss << "\n" << std::left << std::setw(24) << error.strNode <<
+				std::setw(24) << error.strLayer << std::setw(24) <<
+				(error.strBlob.empty() ? "(absent)" : error.strBlob) <<
+				std::right << std::setw(12) << error.nCount;
+		if (error.nBlobCount != error.nCount) {
+			oss << "  caffe blob has " << error.nBlobCount << " elements";
+		} else {
+			oss << std::scientific << std::setprecision(3) << std::setw(14) <<
+					error.fMaxAbsError << std::setw(12) << error.fRelError;
+			oss.unsetf(std::ios::floatfield);
+		}
+		if (i == nFirst) {
+			oss << "  <- first over " << dTolerance;
+		}
+	}
+	return oss.str();
+}
@@ -0,0 +1,77 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Numerical verification of a conversion.
+*	The converted net is forwarded by caffe on CPU and the outputs are
+*	compared with the outputs of the MxNet nodes run by the reference
+*	executor on the same random inputs.
+*/
+
+#ifndef VERIFICATION_HPP_
+#define VERIFICATION_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define CPU_ONLY
+#include <caffe/caffe.hpp>
+
+#include "converter.hpp"
+#include "memory_planner.hpp"
+#include "model_writer.hpp"
+#include "mxnet_executor.hpp"
+
+struct BlobError {
+	std::string strNode;	// name of the MxNet node, indexed if sliced
+	std::string strLayer;	// the caffe layer after which it is compared
+	std::string strBlob;	// the caffe blob compared, empty if absent
+	size_t nCount;			// number of elements of the MxNet output
+	size_t nBlobCount;		// of the caffe blob, 0 if absent
+	float fMaxAbsError;		// infinite if the counts mismatch
+	float fRelError;		// fMaxAbsError over the max abs of the output
+};
+
+struct VerificationResult {
+	// Every output of a node right after its layer, in the order of layers
+	std::vector<BlobError> layers;
+	// Heads of the graph after the whole forward
+	std::vector<BlobError> outputs;
+};
+
+// Uniform random values in [-1, 1) for the inputs, the labels of
+//	SoftmaxOutput are zeros so that they are valid classes for caffe.
+std::map<std::string, Tensor> RandomInputs(
+		const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<InputInfo> &inputInfos, unsigned nSeed);
+
+// Applies the renames of ReuseDeadBlobs to the tops of the nodes
+void RenameNodeBlobs(std::vector<NodeBlobs> &nodeBlobs,
+		const BlobRenames &renames);
+
+// Compares the outputs of the MxNet nodes with the blobs of the converted
+//	net holding them, element by element regardless of the shapes. The net
+//	is forwarded layer by layer by caffe in the TEST phase, so the blobs of
+//	in-place layers are compared before being overwritten. The MxNet nodes
+//	are run in nNumThreads threads (0 for all hardware threads). Without
+//	heads, the outputs not used by other nodes are compared as the heads.
+VerificationResult VerifyConversion(
+		const std::vector<MxnetNode> &mxnetNodes,
+		const std::vector<MxnetInput> &heads,
+		const std::vector<MxnetParam> &mxnetParams,
+		const std::vector<NodeBlobs> &nodeBlobs,
+		const caffe::NetParameter &net, const CaffeWeights &weights,
+		const std::map<std::string, Tensor> &inputs, size_t nNumThreads);
+
+// Index of the first error over the relative tolerance, or the size of
+//	errors if there is none
+size_t FirstExceeding(const std::vector<BlobError> &errors,
+		double dTolerance);
+
+// One line for each error, the first one over the tolerance is marked
+std::string FormatErrorTable(const std::vector<BlobError> &errors,
+		double dTolerance);
+
+#endif /* VERIFICATION_HPP_ */
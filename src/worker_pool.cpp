@@ -0,0 +1,97 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Worker processes forked for conversions
+*/
+
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "parallel.hpp"
+#include "resource_usage.hpp"
+
+WorkerPool::WorkerPool(size_t nNumJobs, size_t nMemoryBudget)
+		: m_nNumJobs(NumWorkerThreads(nNumJobs)),
+		m_nBudget(nMemoryBudget), m_nUsedBytes(0) {
+	if (m_nBudget == 0) {
+		m_nBudget = PhysicalMemoryBytes() / 4 * 3;
+	}
+	m_nNumThreads = std::max(NumWorkerThreads(0) / m_nNumJobs, size_t(1));
+}
+
+size_t WorkerPool::NumJobs() const {
+	return m_nNumJobs;
+}
+
+size_t WorkerPool::Budget() const {
+	return m_nBudget;
+}
+
+size_t WorkerPool::NumThreads() const {
+	return m_nNumThreads;
+}
+
+size_t WorkerPool::NumRunning() const {
+	return m_workers.size();
+}
+
+bool WorkerPool::CanStart(size_t nEstimatedBytes) const {
+	if (m_workers.size() >= m_nNumJobs) {
+		return false;
+	}
+	return m_workers.empty() || m_nUsedBytes + nEstimatedBytes <= m_nBudget;
+}
+
+pid_t WorkerPool::Start(size_t nEstimatedBytes,
+		const std::function<void()> &work) {
+	// Buffered output would be written again by the worker
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(nullptr);
+	pid_t nPid = fork();
+	CHECK_GE(nPid, 0) << "Failed to fork: " << std::strerror(errno);
+	if (nPid == 0) {
+		work();
+		std::cout.flush();
+		std::fflush(nullptr);
+		_exit(0);
+	}
+	m_workers[nPid] = {nEstimatedBytes, std::chrono::steady_clock::now()};
+	m_nUsedBytes += nEstimatedBytes;
+	return nPid;
+}
+
+bool WorkerPool::Wait(pid_t nPid, pid_t &nExitedPid, WorkerExit &exit) {
+	int nStatus = 0;
+	struct rusage usage;
+	nExitedPid = wait4(nPid, &nStatus, 0, &usage);
+	if (nExitedPid < 0) {
+		CHECK_EQ(errno, EINTR) << "Failed to wait for the workers: " <<
+				std::strerror(errno);
+		return false;
+	}
+	auto iWorker = m_workers.find(nExitedPid);
+	if (iWorker == m_workers.end()) {
+		return false;
+	}
+	exit.bSucceeded = WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0;
+	exit.nStatus = nStatus;
+	exit.dWallSeconds = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - iWorker->second.tBeg).count();
+	exit.dCpuSeconds = ChildCpuSeconds(usage);
+	exit.nPeakRss = (size_t)usage.ru_maxrss * 1024;
+	m_nUsedBytes -= iWorker->second.nEstimatedBytes;
+	m_workers.erase(iWorker);
+	return true;
+}
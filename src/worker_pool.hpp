@@ -0,0 +1,57 @@
+/**
+* Copyright (C) DeepGlint, Inc - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+*
+* Worker processes forked for conversions, shared by the batch conversion
+*	and the daemon. Workers run concurrently up to a number of jobs and a
+*	memory budget: a job is started when the estimated memory of the running
+*	ones and its own fits in the budget, or when nothing else runs. The cores
+*	are shared by the workers running together.
+*/
+
+#ifndef WORKER_POOL_HPP_
+#define WORKER_POOL_HPP_
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <sys/types.h>
+
+struct WorkerExit {
+	bool bSucceeded;		// exited with 0
+	int nStatus;			// of wait()
+	double dWallSeconds;
+	double dCpuSeconds;
+	size_t nPeakRss;
+};
+
+class WorkerPool {
+public:
+	// nNumJobs 0 for all cores, nMemoryBudget 0 for 3/4 of the physical memory
+	WorkerPool(size_t nNumJobs, size_t nMemoryBudget);
+	size_t NumJobs() const;
+	size_t Budget() const;
+	// Threads of a worker, to share the cores with the others
+	size_t NumThreads() const;
+	size_t NumRunning() const;
+	// Whether a job of the estimated bytes may start now
+	bool CanStart(size_t nEstimatedBytes) const;
+	// Forks a worker calling work() and exiting with 0 if it returns
+	pid_t Start(size_t nEstimatedBytes, const std::function<void()> &work);
+	// Waits for the worker, any of them if nPid is -1. False if interrupted
+	//	or a process not started by the pool is reaped.
+	bool Wait(pid_t nPid, pid_t &nExitedPid, WorkerExit &exit);
+private:
+	struct Worker {
+		size_t nEstimatedBytes;
+		std::chrono::steady_clock::time_point tBeg;
+	};
+	size_t m_nNumJobs;
+	size_t m_nBudget;
+	size_t m_nNumThreads;
+	size_t m_nUsedBytes;
+	std::map<pid_t, Worker> m_workers;
+};
+
+#endif /* WORKER_POOL_HPP_ */